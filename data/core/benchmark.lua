@@ -0,0 +1,110 @@
+local core = require "core"
+local command = require "core.command"
+
+-- Runs a benchmark scenario in headless mode (--benchmark <scenario.lua> or LITE_XL_BENCHMARK).
+-- The scenario is a Lua file called with this module; it runs in a thread, so the editor
+-- keeps updating and drawing while it waits. Each phase prints one line of JSON to stdout.
+local benchmark = {}
+
+local frames_drawn = 0
+
+local function json_string(s)
+  return '"' .. s:gsub('[%c"\\]', function(c) return string.format("\\u%04x", c:byte()) end) .. '"'
+end
+
+---Prints a result line; values are numbers or strings.
+---@param fields table<string, number|string>
+function benchmark.report(fields)
+  local keys = {}
+  for k in pairs(fields) do table.insert(keys, k) end
+  table.sort(keys)
+  local parts = {}
+  for _, k in ipairs(keys) do
+    local v = fields[k]
+    table.insert(parts, json_string(k) .. ": " .. (type(v) == "number" and string.format("%.6g", v) or json_string(tostring(v))))
+  end
+  io.stdout:write("{", table.concat(parts, ", "), "}\n")
+  io.stdout:flush()
+end
+
+---Lets the editor run a step, drawing a frame.
+---@param count? integer @Number of frames, 1 by default
+function benchmark.frames(count)
+  for _ = 1, count or 1 do
+    core.redraw = true
+    coroutine.yield(0)
+  end
+end
+
+---Runs steps until the predicate returns true.
+---@param predicate fun(): boolean
+---@param timeout? number @Seconds before giving up with an error, 60 by default
+function benchmark.wait(predicate, timeout)
+  local deadline = system.get_time() + (timeout or 60)
+  while not predicate() do
+    if system.get_time() > deadline then error("benchmark: timed out waiting", 2) end
+    benchmark.frames()
+  end
+end
+
+---Times fn, which can draw frames and wait, and reports it as a phase.
+---@param name string
+---@param fn fun()
+function benchmark.phase(name, fn)
+  local frames, start = frames_drawn, system.get_time()
+  fn()
+  benchmark.report {
+    phase = name,
+    seconds = system.get_time() - start,
+    frames = frames_drawn - frames,
+  }
+end
+
+---Types text into the active view, a character and a frame at a time.
+---@param text string
+function benchmark.type(text)
+  for char in text:gmatch(utf8.charpattern) do
+    core.on_event("textinput", char)
+    benchmark.frames()
+  end
+end
+
+---Performs a command, failing if it doesn't apply.
+---@param name string
+function benchmark.command(name, ...)
+  if not command.perform(name, ...) then error("benchmark: command " .. name .. " did not run", 2) end
+end
+
+---Opens a file in a new DocView and returns the view.
+---@param path string
+---@return core.docview
+function benchmark.open(path)
+  return core.root_view:open_doc(core.open_doc(path))
+end
+
+---Counts drawn frames; called by core.step.
+function benchmark.on_frame()
+  frames_drawn = frames_drawn + 1
+end
+
+---Loads and starts the scenario, quitting once it's done.
+---@param path string
+---@param startup_time number @Seconds core.init took
+function benchmark.run(path, startup_time)
+  benchmark.report { phase = "startup", seconds = startup_time, frames = 0 }
+  local scenario, err = loadfile(path)
+  if not scenario then
+    io.stderr:write("benchmark: ", err, "\n")
+    os.exit(1)
+  end
+  core.add_thread(function()
+    local ok, err = xpcall(scenario, debug.traceback, benchmark)
+    if not ok then
+      io.stderr:write("benchmark: ", tostring(err), "\n")
+      os.exit(1)
+    end
+    core.quit_request = true
+  end)
+end
+
+return benchmark
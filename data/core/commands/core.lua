@@ -7,6 +7,7 @@ local LogView = require "core.logview"
 
 local fullscreen = false
 local restore_title_view = false
+local recording_path
 
 local function suggest_directory(text)
   text = common.home_expand(text)
@@ -47,6 +48,27 @@ command.add(nil, {
     core.title_view:configure_hit_test(not fullscreen and restore_title_view)
   end,
 
+  ["core:toggle-render-stats"] = function()
+    require("core.renderstats").toggle()
+  end,
+
+  ["core:toggle-render-recording"] = function()
+    if recording_path then
+      renderer.record_commands()
+      core.log("Recorded render commands to %s", recording_path)
+      recording_path = nil
+      return
+    end
+    local path = USERDIR .. PATHSEP .. "render-commands.lxrc"
+    local ok, err = renderer.record_commands(path)
+    if not ok then
+      core.error("Unable to record render commands: %s", err)
+      return
+    end
+    recording_path = path
+    core.log("Recording render commands to %s", path)
+  end,
+
   ["core:reload-module"] = function()
     core.command_view:enter("Reload Module", {
       submit = function(text, item)
@@ -87,9 +109,6 @@ command.add(nil, {
   end,
 
   ["core:find-file"] = function()
-    if not core.project_files_number() then
-       return command.perform "core:open-file"
-    end
     local files = {}
     for dir, item in core.get_project_files() do
       if item.type == "file" then
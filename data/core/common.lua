@@ -81,6 +81,20 @@ function common.color(str)
 end
 
 
+---Returns a string that changes with the components of the given colors, for
+---use in `View:get_draw_version`. Anything that is not a color is skipped.
+---@param ... renderer.color?
+---@return string
+function common.color_version(...)
+  local parts = {}
+  for i = 1, select("#", ...) do
+    local color = select(i, ...)
+    parts[i] = type(color) == "table" and table.concat(color, ",") or ""
+  end
+  return table.concat(parts, " ")
+end
+
+
 function common.splice(t, at, remove, insert)
   assert(remove >= 0, "bad argument #3 to 'splice' (non-negative value expected)")
   insert = insert or {}
@@ -21,6 +21,8 @@ config.ignore_files = {
   "%.suo$",         "%.pdb$",       "%.idb$",        "%.class$", "%.psd$", "%.db$",
   "^desktop%.ini$", "^%.DS_Store$", "^%.directory$",
 }
+-- Also leave out of the project what its .gitignore and .ignore files exclude.
+config.use_gitignore = true
 config.symbol_pattern = "[%a_][%w_]*"
 config.non_word_chars = " \t\n/\\()\"':,.;<>~!@#$%^&*|+=[]{}`?-"
 config.undo_merge_timeout = 0.3
@@ -34,7 +36,9 @@ config.indent_size = 2
 config.tab_type = "soft"
 config.keep_newline_whitespace = false
 config.line_limit = 80
-config.max_project_files = 2000
+-- Keep the listing of each project under USERDIR, to show it right away when the
+-- project is opened again while the directories that changed are read.
+config.project_index = true
 config.transitions = true
 config.disabled_transitions = {
   scroll = false,
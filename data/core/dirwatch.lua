@@ -2,6 +2,9 @@ local common = require "core.common"
 local config = require "core.config"
 local dirwatch = {}
 
+-- coroutines currently checking a dirwatch, woken up when a monitor reports changes
+local checking = setmetatable({}, { __mode = "k" })
+
 function dirwatch:__index(idx)
   local value = rawget(self, idx)
   if value ~= nil then return value end
@@ -74,7 +77,7 @@ function dirwatch:unwatch(directory)
   if self.watched[directory] then
     if self.monitor:mode() == "multiple" then
       self.monitor:unwatch(self.watched[directory])
-      self.reverse_watched[directory] = nil
+      self.reverse_watched[self.watched[directory]] = nil
     else
       self.single_watch_count = self.single_watch_count - 1
       if self.single_watch_count == 0 then
@@ -88,21 +91,60 @@ function dirwatch:unwatch(directory)
   end
 end
 
+-- moves the watches of a renamed directory, and of the ones below it, to their new paths.
+function dirwatch:rename(old_path, new_path)
+  for _, paths in ipairs({ self.watched, self.scanned }) do
+    local renamed = {}
+    for path, value in pairs(paths) do
+      if path == old_path or common.path_belongs_to(path, old_path) then renamed[path] = value end
+    end
+    for path, value in pairs(renamed) do
+      local new = new_path .. path:sub(#old_path + 1)
+      paths[path], paths[new] = nil, value
+      if paths == self.watched and self.reverse_watched[value] == path then
+        self.reverse_watched[value] = new
+      end
+    end
+  end
+end
+
 -- designed to be run inside a coroutine.
+-- change_callback is called with the directory that changed; when the monitor can tell,
+-- it also gets the name of the entry in it and the kind of change ("create", "delete",
+-- "modify" or "move"), and for moves the directory and name the entry came from.
 function dirwatch:check(change_callback, scan_time, wait_time)
   local had_change = false
-  self.monitor:check(function(id)
+  checking[coroutine.running()] = true
+  local changes = {}
+  self.monitor:check(function(id, name, kind, from_id, from_name)
     had_change = true
     if self.monitor:mode() == "single" then
       local path = common.dirname(id)
       if not string.match(id, "^/") and not string.match(id, "^%a:[/\\]") then
         path = common.dirname(self.single_watch_top .. PATHSEP .. id)
       end
-      change_callback(path)
+      table.insert(changes, { path })
+    elseif kind == "overflow" then
+      -- changes were lost, every directory has to be checked again
+      for directory in pairs(self.watched) do table.insert(changes, { directory }) end
+    elseif kind == "move" then
+      local path, from_path = self.reverse_watched[id], self.reverse_watched[from_id]
+      if path and from_path then
+        self:rename(from_path .. PATHSEP .. from_name, path .. PATHSEP .. name)
+        table.insert(changes, { path, name, kind, from_path, from_name })
+      elseif from_path then
+        table.insert(changes, { from_path, from_name, "delete" })
+      elseif path then
+        table.insert(changes, { path, name, "create" })
+      end
     elseif self.reverse_watched[id] then
-      change_callback(self.reverse_watched[id])
+      table.insert(changes, { self.reverse_watched[id], name, kind })
     end
   end)
+  -- called once the monitor is done, so that callbacks are free to change the watches
+  for _, change in ipairs(changes) do
+    change_callback(table.unpack(change, 1, 5))
+  end
   local start_time = system.get_time()
   for directory, old_modified in pairs(self.scanned) do
     if old_modified then
@@ -123,6 +165,22 @@ function dirwatch:check(change_callback, scan_time, wait_time)
 end
 
 
+-- whether any directory has to be polled for changes, rather than being
+-- reported by the monitor; if not, checks need not be frequent.
+function dirwatch:is_polling()
+  for _, modified in pairs(self.scanned) do
+    if modified then return true end
+  end
+  return false
+end
+
+
+-- whether the coroutine checks a dirwatch, and should be resumed on "dirchange" events.
+function dirwatch.is_checking(co)
+  return checking[co] == true
+end
+
+
 -- inspect config.ignore_files patterns and prepare ready to use entries.
 local function compile_ignore_files()
   local ipatterns = config.ignore_files
@@ -144,92 +202,115 @@ local function compile_ignore_files()
 end
 
 
-local function fileinfo_pass_filter(info, ignore_compiled)
-  if info.size >= config.file_size_limit * 1e6 then return false end
-  local basename = common.basename(info.filename)
-  -- replace '\' with '/' for Windows where PATHSEP = '\'
-  local fullname = "/" .. info.filename:gsub("\\", "/")
-  for _, compiled in ipairs(ignore_compiled) do
-    local test = compiled.use_path and fullname or basename
-    if compiled.match_dir then
-      if info.type == "dir" and string.match(test .. "/", compiled.pattern) then
-        return false
-      end
-    else
-      if string.match(test, compiled.pattern) then
-        return false
-      end
-    end
+-- compiled rules of each project root, along with the settings they were compiled from
+local ignore_rules = {}
+
+local function ignore_key()
+  local patterns = config.ignore_files
+  return (type(patterns) == "table" and table.concat(patterns, "\0") or tostring(patterns))
+    .. (config.use_gitignore and "\1" or "")
+end
+
+-- Returns the system.ignore_rules for the tree at root, from config.ignore_files
+-- and, with config.use_gitignore, its .gitignore and .ignore files.
+function dirwatch.ignore_rules(root)
+  local key = ignore_key()
+  local cached = ignore_rules[root]
+  if not cached or cached.key ~= key then
+    cached = { key = key, rules = system.ignore_rules(root, compile_ignore_files(), { vcs = config.use_gitignore }) }
+    ignore_rules[root] = cached
   end
-  return true
+  return cached.rules
 end
 
+-- Drops the rules of root, for when one of its ignore files changed.
+function dirwatch.reset_ignore_rules(root)
+  ignore_rules[root] = nil
+end
+
+
+-- the index of a project is only used with the settings its listing was made with
+local function index_key(root)
+  return root .. "\0" .. ignore_key() .. "\0" .. config.file_size_limit
+end
 
-local function compare_file(a, b)
-  return system.path_compare(a.filename, a.type, b.filename, b.type)
+local function index_filename(root)
+  -- 64 bit fnv-1a hash of the root
+  local hash = -3750763034362895579
+  for i = 1, #root do hash = (hash ~ root:byte(i)) * 1099511628211 end
+  return USERDIR .. PATHSEP .. "projectindex" .. PATHSEP .. string.format("%016x", hash)
 end
 
+-- Returns the system.load_project_index saved for root, if there's one made
+-- with the current settings.
+function dirwatch.load_index(root)
+  if not USERDIR then return end
+  return system.load_project_index(index_filename(root), index_key(root))
+end
 
--- compute a file's info entry completed with "filename" to be used
--- in project scan or falsy if it shouldn't appear in the list.
-local function get_project_file_info(root, file, ignore_compiled)
-  local info = system.get_file_info(root .. PATHSEP .. file)
-  -- info can be not nil but info.type may be nil if is neither a file neither
-  -- a directory, for example for /dev/* entries on linux.
-  if info and info.type then
-    info.filename = file
-    return fileinfo_pass_filter(info, ignore_compiled) and info
+-- Saves tree, a system.project_tree with the complete listing of root started at
+-- time, when root was last modified at root_modified, as the index of root.
+-- Returns true, or nil and an error message.
+function dirwatch.save_index(root, tree, time, root_modified)
+  if not USERDIR then return end
+  local dir = USERDIR .. PATHSEP .. "projectindex"
+  if not system.get_file_info(dir) then
+    local ok, err = common.mkdirp(dir)
+    if not ok then return nil, err end
   end
+  return system.save_project_index(index_filename(root), index_key(root), tree, time, root_modified)
 end
 
+function dirwatch.remove_index(root)
+  if USERDIR then os.remove(index_filename(root)) end
+end
 
+
+-- Starts a system.scan_tree of root .. PATHSEP .. path with the project's ignore rules.
 -- "root" will by an absolute path without trailing '/'
 -- "path" will be a path starting without '/' and without trailing '/'
 --    or the empty string.
---    It will identifies a sub-path within "root.
--- The current path location will therefore always be: root .. path.
--- When recursing "root" will always be the same, only "path" will change.
--- Returns a list of file "items". In each item the "filename" will be the
--- complete file path relative to "root" *without* the trailing '/', and without the starting '/'.
-function dirwatch.get_directory_files(dir, root, path, t, entries_count, recurse_pred)
-  local t0 = system.get_time()
-  local t_elapsed = system.get_time() - t0
-  local dirs, files = {}, {}
-  local ignore_compiled = compile_ignore_files()
-
+-- The filenames of the scanned entries are relative to "root".
+-- opts can set names, recurse, max_entries, timeout and index, see system.scan_tree.
+function dirwatch.scan_tree(root, path, opts)
+  opts = opts or {}
+  return system.scan_tree(root, dirwatch.ignore_rules(root), {
+    path = path,
+    names = opts.names,
+    recurse = opts.recurse,
+    max_entries = opts.max_entries,
+    timeout = opts.timeout,
+    index = opts.index,
+    file_size_limit = config.file_size_limit * 1e6
+  })
+end
 
-  local all = system.list_dir(root .. PATHSEP .. path)
-  if not all then return nil end
 
-  for _, file in ipairs(all or {}) do
-    local info = get_project_file_info(root, (path ~= "" and (path .. PATHSEP) or "") .. file, ignore_compiled)
-    if info then
-      table.insert(info.type == "dir" and dirs or files, info)
-      entries_count = entries_count + 1
-    end
+-- Returns a list of file "items" in system.path_compare order, whether every
+-- directory was descended into and the number of entries listed, or nil if
+-- root .. PATHSEP .. path can't be read. In each item the "filename" will be the
+-- complete file path relative to "root" *without* the trailing '/', and without the starting '/'.
+function dirwatch.get_directory_files(root, path, opts)
+  local scan = dirwatch.scan_tree(root, path, opts)
+  if not scan then return nil end
+  local t = {}
+  while true do
+    local batch, complete, entries_count = scan:read()
+    if not batch then return t, complete, entries_count end
+    table.move(batch, 1, #batch, #t + 1, t)
   end
+end
 
-  local recurse_complete = true
-  table.sort(dirs, compare_file)
-  for _, f in ipairs(dirs) do
-    table.insert(t, f)
-    if recurse_pred(dir, f.filename, entries_count, t_elapsed) then
-      local _, complete, n = dirwatch.get_directory_files(dir, root, f.filename, t, entries_count, recurse_pred)
-      recurse_complete = recurse_complete and complete
-      if n ~= nil then
-        entries_count = n
-      end
-    else
-      recurse_complete = false
-    end
-  end
 
-  table.sort(files, compare_file)
-  for _, f in ipairs(files) do
-    table.insert(t, f)
+-- Like get_directory_files, but returns the entries in a new system.project_tree.
+function dirwatch.get_directory_tree(root, path, opts)
+  local scan = dirwatch.scan_tree(root, path, opts)
+  if not scan then return nil end
+  local tree = system.project_tree()
+  while true do
+    local dirs, complete, entries_count = scan:read(nil, tree)
+    if not dirs then return tree, complete, entries_count end
   end
-
-  return t, recurse_complete, entries_count
 end
 
 
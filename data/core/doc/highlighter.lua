@@ -11,6 +11,8 @@ local Highlighter = Object:extend()
 function Highlighter:new(doc)
   self.doc = doc
   self.running = false
+  -- bumped whenever the tokens of any line may have changed
+  self.generation = 0
   self:reset()
 end
 
@@ -74,9 +76,11 @@ function Highlighter:soft_reset()
   end
   self.first_invalid_line = 1
   self.max_wanted_line = 0
+  self.generation = self.generation + 1
 end
 
 function Highlighter:invalidate(idx)
+  self.generation = self.generation + 1
   self.first_invalid_line = math.min(self.first_invalid_line, idx)
   set_max_wanted_lines(self, math.min(self.max_wanted_line, #self.doc.lines))
 end
@@ -101,6 +105,7 @@ end
 
 
 function Highlighter:tokenize_line(idx, state, resume)
+  self.generation = self.generation + 1
   local res = {}
   res.init_state = state
   res.text = self.doc.lines[idx]
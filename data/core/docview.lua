@@ -66,6 +66,8 @@ function DocView:new(doc)
   self.hovering_gutter = false
   self.v_scrollbar:set_forced_status(config.force_scrollbar_status)
   self.h_scrollbar:set_forced_status(config.force_scrollbar_status)
+  -- have the glyph worker prepare the glyphs used at the start of the document, before it's drawn
+  self:get_font():warm(doc.lines, 1000)
 end
 
 
@@ -436,22 +438,10 @@ end
 
 
 function DocView:draw_line_text(line, x, y)
-  local default_font = self:get_font()
-  local tx, ty = x, y + self:get_line_text_y_offset()
-  local last_token = nil
   local tokens = self.doc.highlighter:get_line(line).tokens
-  local tokens_count = #tokens
-  if string.sub(tokens[tokens_count], -1) == "\n" then
-    last_token = tokens_count - 1
-  end
-  for tidx, type, text in self.doc.highlighter:each_token(line) do
-    local color = style.syntax[type]
-    local font = style.syntax_fonts[type] or default_font
-    -- do not render newline, fixes issue #1164
-    if tidx == last_token then text = text:sub(1, -2) end
-    tx = renderer.draw_text(font, text, tx, ty, color)
-    if tx > self.position.x + self.size.x then break end
-  end
+  -- the trailing newline is not rendered, fixes issue #1164
+  renderer.draw_tokens(self:get_font(), style.syntax_fonts, tokens, style.syntax,
+    x, y + self:get_line_text_y_offset(), self.position.x + self.size.x)
   return self:get_line_height()
 end
 
@@ -591,4 +581,51 @@ function DocView:draw()
 end
 
 
+local function syntax_version()
+  local parts = {}
+  for name, color in pairs(style.syntax) do
+    table.insert(parts, name .. " " .. common.color_version(color))
+  end
+  for name, font in pairs(style.syntax_fonts) do
+    table.insert(parts, name .. " " .. tostring(font))
+  end
+  return table.concat(parts, " ")
+end
+
+-- the draw methods whose output DocView:get_draw_version accounts for
+local draw_methods = {
+  "draw", "draw_background", "draw_line_highlight", "draw_line_text", "draw_caret",
+  "draw_line_body", "draw_line_gutter", "draw_ime_decoration", "draw_overlay",
+  "draw_scrollbar"
+}
+
+---The draw methods `DocView:get_draw_version` accounts for. A plugin that
+---overrides one of them extends `DocView:get_draw_version` with whatever its
+---override draws and then adds the new function here; until it does,
+---docviews are redrawn every frame.
+---@type table<function, boolean>
+DocView.versioned_draws = {}
+for _, name in ipairs(draw_methods) do
+  DocView.versioned_draws[DocView[name]] = true
+end
+
+---The active docview draws the blinking caret and is always redrawn; the
+---others only change with their scroll position, size, selections and text.
+function DocView:get_draw_version()
+  if core.active_view == self then return nil end
+  for _, name in ipairs(draw_methods) do
+    if not DocView.versioned_draws[self[name]] then return nil end
+  end
+  local _, indent_size = self.doc:get_indent_info()
+  return string.format("%s %s %s %s %s %s %s %s %s %s %s %s %s %s %s %s %s %s",
+    self.position.x, self.position.y, self.size.x, self.size.y,
+    self.scroll.x, self.scroll.y, self.doc:get_change_id(),
+    self.doc.highlighter.generation, #self.doc.lines,
+    table.concat(self.doc.selections, ","), indent_size,
+    self:get_font(), config.line_height, style.padding.x, style.padding.y,
+    common.color_version(style.background, style.line_number, style.line_number2, style.selection),
+    syntax_version(), self:get_scrollbar_draw_version())
+end
+
+
 return DocView
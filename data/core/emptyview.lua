@@ -6,13 +6,14 @@ local View = require "core.view"
 ---@field super core.view
 local EmptyView = View:extend()
 
+local lines = {
+  { fmt = "%s to run a command", cmd = "core:find-command" },
+  { fmt = "%s to open a file from the project", cmd = "core:find-file" },
+  { fmt = "%s to change project folder", cmd = "core:change-project-folder" },
+  { fmt = "%s to open a project folder", cmd = "core:open-project-folder" },
+}
+
 local function draw_text(x, y, color)
-  local lines = {
-    { fmt = "%s to run a command", cmd = "core:find-command" },
-    { fmt = "%s to open a file from the project", cmd = "core:find-file" },
-    { fmt = "%s to change project folder", cmd = "core:change-project-folder" },
-    { fmt = "%s to open a project folder", cmd = "core:open-project-folder" },
-  }
   local th = style.big_font:get_height()
   local dh = 2 * th + style.padding.y * 2
   local x1, y1 = x, y + ((dh - th) / #lines)
@@ -41,6 +42,17 @@ local function draw_text(x, y, color)
   return w, dh
 end
 
+function EmptyView:get_draw_version()
+  local bindings = {}
+  for _, line in ipairs(lines) do
+    table.insert(bindings, keymap.get_binding(line.cmd) or "")
+  end
+  return string.format("%s %s %s %s %s %s %s %s %s %s %s",
+    self.position.x, self.position.y, self.size.x, self.size.y, style.padding.x, style.padding.y,
+    table.concat(style.background, ","), table.concat(style.dim, ","),
+    style.font, style.big_font, table.concat(bindings, ","))
+end
+
 function EmptyView:draw()
   self:draw_background(style.background)
   local w, h = draw_text(0, 0, { 0, 0, 0, 0 })
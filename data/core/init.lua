@@ -7,6 +7,8 @@ local command
 local keymap
 local dirwatch
 local ime
+local renderstats
+local benchmark
 local RootView
 local StatusView
 local TitleView
@@ -97,10 +99,6 @@ function core.open_folder_project(dir_path_abs)
 end
 
 
-local function strip_leading_path(filename)
-    return filename:sub(2)
-end
-
 local function strip_trailing_slash(filename)
   if filename:match("[^:][/\\]$") then
     return filename:sub(1, -2)
@@ -109,141 +107,182 @@ local function strip_trailing_slash(filename)
 end
 
 
-function core.project_subdir_is_shown(dir, filename)
-  return not dir.files_limit or dir.shown_subdir[filename]
+-- Watches the directories of a project that were added to its tree, and unwatches
+-- those that were removed; both are lists of filenames relative to the project root.
+local function watch_project_dirs(topdir, added, removed)
+  for _, filename in ipairs(removed or {}) do topdir.watch:unwatch(topdir.name .. PATHSEP .. filename) end
+  for _, filename in ipairs(added or {}) do topdir.watch:watch(topdir.name .. PATHSEP .. filename) end
 end
 
 
-local function show_max_files_warning(dir)
-  local message = dir.slow_filesystem and
-    "Filesystem is too slow: project files will not be indexed." or
-    "Too many files in project directory: stopped reading at "..
-    config.max_project_files.." files. For more information see "..
-    "usage.md at https://github.com/lite-xl/lite-xl."
-  if core.status_view then
-    core.status_view:show_message("!", style.accent, message)
-  end
+local function project_tree_changed(topdir)
+  topdir.is_dirty, core.redraw = true, true
 end
 
 
--- bisects the sorted file list to get to things in ln(n)
-local function file_bisect(files, is_superior, start_idx, end_idx)
-  local inf, sup = start_idx or 1, end_idx or #files
-  while sup - inf > 8 do
-    local curr = math.floor((inf + sup) / 2)
-    if is_superior(files[curr]) then
-      sup = curr - 1
-    else
-      inf = curr
+-- Should be called on any directory that registers a change.
+-- Uses relative paths at the project root (i.e. target = "", target = "first-level-directory", target = "first-level-directory/second-level-directory")
+local function refresh_directory(topdir, target)
+  target = target or ""
+  local listing = dirwatch.get_directory_tree(topdir.name, target, { recurse = false })
+
+  -- If this file doesn't exist, we should be calling this on our parent directory, assume we'll do that.
+  -- Unwatch just in case.
+  if listing == nil then
+    topdir.watch:unwatch(topdir.name .. PATHSEP .. target)
+    return true
+  end
+
+  local tree, change = topdir.tree, false
+  local old = {}
+  for _, item in ipairs(tree:list(target) or {}) do old[item.filename] = item end
+  -- Compare the entries of the directory with the ones in the tree. New directories are
+  -- listed with everything below them, the ones that were already there report their own changes.
+  for _, item in ipairs(listing:list(target) or {}) do
+    local old_item = old[item.filename]
+    old[item.filename] = nil
+    if not old_item or old_item.type ~= item.type then
+      local src = listing
+      if item.type == "dir" then
+        src = dirwatch.get_directory_tree(topdir.name, target, { names = { common.basename(item.filename) } })
+      end
+      watch_project_dirs(topdir, tree:replace(item.filename, src))
+      change = true
+    elseif item.type == "file" and (old_item.size ~= item.size or old_item.modified ~= item.modified) then
+      tree:replace(item.filename, listing)
+      change = true
     end
   end
-  while inf <= sup and not is_superior(files[inf]) do
-    inf = inf + 1
+  for filename in pairs(old) do
+    watch_project_dirs(topdir, nil, tree:remove(filename))
+    change = true
   end
-  return inf
+  if change then project_tree_changed(topdir) end
+  return change
 end
 
 
-local function file_search(files, info)
-  local idx = file_bisect(files, function(file)
-    return system.path_compare(info.filename, info.type, file.filename, file.type)
-  end)
-  if idx > 1 and files[idx-1].filename == info.filename then
-    return idx - 1, true
-  end
-  return idx, false
+local function project_dir_is_listed(topdir, dirpath)
+  if dirpath == "" then return true end
+  local item = topdir.tree:get(dirpath)
+  return item and item.type == "dir"
 end
 
 
-local function files_info_equal(a, b)
-  return (a == nil and b == nil) or (a and b and a.filename == b.filename and a.type == b.type)
+-- Lists a directory and everything below it again, after the ignore files that
+-- apply to it changed.
+local function relist_project_dir(topdir, dirpath)
+  dirwatch.reset_ignore_rules(topdir.name)
+  local tree = dirwatch.get_directory_tree(topdir.name, dirpath, {})
+  if not tree then return false end
+  local added, removed = topdir.tree:replace_children(dirpath, tree)
+  if not added then return false end
+  watch_project_dirs(topdir, added, removed)
+  project_tree_changed(topdir)
+  return true
 end
 
 
-local function project_subdir_bounds(dir, filename, start_index)
-  local found = true
-  if not start_index then
-    start_index, found = file_search(dir.files, { type = "dir", filename = filename })
-  end
-  if found then
-    local end_index = file_bisect(dir.files, function(file)
-      return not common.path_belongs_to(file.filename, filename)
-    end, start_index + 1)
-    return start_index, end_index - start_index, dir.files[start_index]
-  end
+local function is_ignore_file(name)
+  return config.use_gitignore and (name == ".gitignore" or name == ".ignore")
 end
 
 
--- Should be called on any directory that registers a change, or on a directory we open if we're over the file limit.
--- Uses relative paths at the project root (i.e. target = "", target = "first-level-directory", target = "first-level-directory/second-level-directory")
-local function refresh_directory(topdir, target)
-  local directory_start_idx, directory_end_idx = 1, #topdir.files
-  if target and target ~= "" then
-    directory_start_idx, directory_end_idx = project_subdir_bounds(topdir, target)
-    directory_end_idx = directory_start_idx + directory_end_idx - 1
-    directory_start_idx = directory_start_idx + 1
-  end
-
-  local files = dirwatch.get_directory_files(topdir, topdir.name, (target or ""), {}, 0, function() return false end)
-  local change = false
-
-  -- If this file doesn't exist, we should be calling this on our parent directory, assume we'll do that.
-  -- Unwatch just in case.
-  if files == nil then
-    topdir.watch:unwatch(topdir.name .. PATHSEP .. (target or ""))
-    return true
-  end
-
-  local new_idx, old_idx = 1, directory_start_idx
-  local new_directories = {}
-  -- Run through each sorted list and compare them. If we find a new entry, insert it and flag as new. If we're missing an entry
-  -- remove it and delete the entry from the list.
-  while old_idx <= directory_end_idx or new_idx <= #files do
-    local old_info, new_info = topdir.files[old_idx], files[new_idx]
-    if not files_info_equal(new_info, old_info) then
-      change = true
-      -- If we're a new file, and we exist *before* the other file in the list, then add to the list.
-      if not old_info or (new_info and system.path_compare(new_info.filename, new_info.type, old_info.filename, old_info.type)) then
-        table.insert(topdir.files, old_idx, new_info)
-        old_idx, new_idx = old_idx + 1, new_idx + 1
-        if new_info.type == "dir" then
-          table.insert(new_directories, new_info)
-        end
-        directory_end_idx = directory_end_idx + 1
-      else
-      -- If it's not there, remove the entry from the list as being out of order.
-        table.remove(topdir.files, old_idx)
-        if old_info.type == "dir" then
-          topdir.watch:unwatch(topdir.name .. PATHSEP .. old_info.filename)
-        end
-        directory_end_idx = directory_end_idx - 1
+-- Applies a change to a single entry reported by the directory monitor, rather than listing
+-- the whole directory again. dirpath and from_dirpath are relative to the project root.
+local function update_project_file(topdir, dirpath, name, kind, from_dirpath, from_name)
+  if is_ignore_file(name) or is_ignore_file(from_name) then
+    if kind == "move" and from_dirpath ~= dirpath and is_ignore_file(from_name) then
+      relist_project_dir(topdir, from_dirpath)
+    end
+    if project_dir_is_listed(topdir, dirpath) then return relist_project_dir(topdir, dirpath) end
+  end
+  local tree = topdir.tree
+  local filename = dirpath == "" and name or dirpath .. PATHSEP .. name
+  local listed = project_dir_is_listed(topdir, dirpath)
+  local moved
+  if kind == "move" then
+    -- the watches were already moved to the new path by dirwatch
+    local from = from_dirpath == "" and from_name or from_dirpath .. PATHSEP .. from_name
+    local replaced = listed and tree:move(from, filename)
+    if replaced then
+      moved = true
+      for _, dirname in ipairs(replaced) do
+        local item = tree:get(dirname)
+        if not item or item.type ~= "dir" then topdir.watch:unwatch(topdir.name .. PATHSEP .. dirname) end
       end
     else
-      -- If this file is a directory, determine in ln(n) the size of the directory, and skip every file in it.
-      local size = old_info and old_info.type == "dir" and select(2, project_subdir_bounds(topdir, old_info.filename, old_idx)) or 1
-      old_idx, new_idx = old_idx + size, new_idx + 1
+      local removed = tree:remove(from)
+      if removed then
+        moved = true
+        for i, dirname in ipairs(removed) do removed[i] = filename .. dirname:sub(#from + 1) end
+        watch_project_dirs(topdir, nil, removed)
+      end
     end
-  end
-  for i, v in ipairs(new_directories) do
-    topdir.watch:watch(topdir.name .. PATHSEP .. v.filename)
-    if not topdir.files_limit or core.project_subdir_is_shown(topdir, v.filename) then
-      refresh_directory(topdir, v.filename)
+    if moved then project_tree_changed(topdir) end
+  end
+  if not listed then return moved end
+
+  local listing = kind ~= "delete" and dirwatch.get_directory_tree(topdir.name, dirpath, {
+    names = { name }, recurse = false
+  })
+  local item, old_item = listing and listing:get(filename), tree:get(filename)
+  if item and old_item and item.type == old_item.type then
+    -- a directory keeps what's below it, which reports its own changes
+    if item.type == "file" then
+      tree:replace(filename, listing)
+      project_tree_changed(topdir)
     end
+    return true
   end
-  if change then
-    core.redraw = true
-    topdir.is_dirty = true
+  if item and item.type == "dir" then
+    listing = dirwatch.get_directory_tree(topdir.name, dirpath, { names = { name } })
   end
-  return change
+  -- deleted, or its directory is gone, which its parent will report
+  watch_project_dirs(topdir, tree:replace(filename, item and listing or nil))
+  project_tree_changed(topdir)
+  return true
+end
+
+
+local function project_dir_is_open(topdir)
+  for _, prj in ipairs(core.project_directories) do
+    if topdir == prj then return true end
+  end
+  return false
 end
 
 
--- Predicate function to inhibit directory recursion in get_directory_files
--- based on a time limit and the number of files.
-local function timed_max_files_pred(dir, filename, entries_count, t_elapsed)
-  local n_limit = entries_count <= config.max_project_files
-  local t_limit = t_elapsed < 20 / config.fps
-  return n_limit and t_limit and core.project_subdir_is_shown(dir, filename)
+-- Adds what a scan lists to the tree of a project, watching the directories that
+-- come in, until the scan is done or the time is past deadline. Returns whether
+-- the scan is done.
+local function read_project_scan(topdir, scan, deadline)
+  repeat
+    local dirs = scan:read(0.005, topdir.tree)
+    if not dirs then return true end
+    watch_project_dirs(topdir, dirs)
+    project_tree_changed(topdir)
+  until system.get_time() > deadline
+  return false
+end
+
+
+-- Lists the whole project again in the background, taking the directories that
+-- didn't change from its index, and keeps the listing as its tree and as its new
+-- index.
+local function index_project_dir(topdir, index)
+  local started, info = os.time(), system.get_file_info(topdir.name)
+  local scan = info and dirwatch.scan_tree(topdir.name, "", { index = index })
+  if not scan then return end
+  local tree = system.project_tree()
+  while scan:read(0.005, tree) do
+    coroutine.yield(0)
+    if not project_dir_is_open(topdir) then return end
+  end
+  watch_project_dirs(topdir, topdir.tree:replace_children("", tree))
+  project_tree_changed(topdir)
+  local ok, err = dirwatch.save_index(topdir.name, topdir.tree, started, info.modified)
+  if ok == nil and err then core.log_quiet("Can't save the index of %s: %s", topdir.name, err) end
 end
 
 
@@ -255,9 +294,8 @@ function core.add_project_directory(path)
   local topdir = {
     name = path,
     item = {filename = common.basename(path), type = "dir", topdir = true},
-    files_limit = false,
+    tree = system.project_tree(),
     is_dirty = true,
-    shown_subdir = {},
     watch_thread = nil,
     watch = dirwatch.new()
   }
@@ -265,16 +303,17 @@ function core.add_project_directory(path)
 
   local fstype = PLATFORM == "Linux" and system.get_fs_type(topdir.name) or "unknown"
   topdir.force_scans = (fstype == "nfs" or fstype == "fuse")
-  local t, complete, entries_count = dirwatch.get_directory_files(topdir, topdir.name, "", {}, 0, timed_max_files_pred)
-  topdir.files = t
-  if not complete then
-    topdir.slow_filesystem = not complete and (entries_count <= config.max_project_files)
-    topdir.files_limit = true
-    show_max_files_warning(topdir)
-    refresh_directory(topdir)
+  -- the listing saved the last time the project was open is shown until it's
+  -- checked against the filesystem in the background.
+  local index = config.project_index and dirwatch.load_index(path)
+  local started, info, scan = os.time(), system.get_file_info(path)
+  if index then
+    watch_project_dirs(topdir, topdir.tree:replace_children("", index:get_tree()))
   else
-    for i,v in ipairs(t) do
-      if v.type == "dir" then topdir.watch:watch(path .. PATHSEP .. v.filename) end
+    -- what can't be listed right away is added to the tree in the background.
+    scan = dirwatch.scan_tree(path, "")
+    if scan and read_project_scan(topdir, scan, system.get_time() + 20 / config.fps) then
+      scan = false
     end
   end
   topdir.watch:watch(topdir.name)
@@ -284,37 +323,41 @@ function core.add_project_directory(path)
   -- quick; essentially one syscall per check. Otherwise, this may take a bit of
   -- time; the watch will yield in this coroutine after 0.01 second, for 0.1 seconds.
   topdir.watch_thread = core.add_thread(function()
+    while scan and not read_project_scan(topdir, scan, system.get_time() + 0.01) do
+      coroutine.yield(0)
+      if not project_dir_is_open(topdir) then return end
+    end
+    if config.project_index then
+      if index then
+        index_project_dir(topdir, index)
+        index = nil
+      elseif scan ~= nil and info then
+        local ok, err = dirwatch.save_index(topdir.name, topdir.tree, started, info.modified)
+        if ok == nil and err then core.log_quiet("Can't save the index of %s: %s", topdir.name, err) end
+      end
+    end
     while true do
-      local changed = topdir.watch:check(function(target)
-        if target == topdir.name then return refresh_directory(topdir) end
-        local dirpath = target:sub(#topdir.name + 2)
-        local abs_dirpath = topdir.name .. PATHSEP .. dirpath
-        if dirpath then
-          -- check if the directory is in the project files list, if not exit.
-          local dir_index, dir_match = file_search(topdir.files, {filename = dirpath, type = "dir"})
-          if not dir_match or not core.project_subdir_is_shown(topdir, topdir.files[dir_index].filename) then return end
+      local changed = topdir.watch:check(function(target, name, kind, from_target, from_name)
+        local dirpath = target == topdir.name and "" or target:sub(#topdir.name + 2)
+        if name then
+          local from_dirpath = from_target and (from_target == topdir.name and "" or from_target:sub(#topdir.name + 2))
+          return update_project_file(topdir, dirpath, name, kind, from_dirpath, from_name)
         end
+        -- check if the directory is in the project files list, if not exit.
+        if not project_dir_is_listed(topdir, dirpath) then return end
         return refresh_directory(topdir, dirpath)
       end, 0.01, 0.01)
       -- properly exit coroutine if project not open anymore to clear dir watch
-      local project_dir_open = false
-      for _, prj in ipairs(core.project_directories) do
-        if topdir == prj then
-          project_dir_open = true
-          break
-        end
-      end
-      if project_dir_open then
-        coroutine.yield(changed and 0 or 0.05)
+      if project_dir_is_open(topdir) then
+        -- the monitor wakes this thread up on changes, so it only has to
+        -- come back soon for directories that are polled.
+        coroutine.yield(changed and 0 or (topdir.watch:is_polling() and 0.05 or 1))
       else
         return
       end
     end
   end)
 
-  if path == core.project_dir then
-    core.project_files = topdir.files
-  end
   core.redraw = true
   return topdir
 end
@@ -323,41 +366,11 @@ end
 -- The function below is needed to reload the project directories
 -- when the project's module changes.
 function core.rescan_project_directories()
-  local save_project_dirs = {}
-  local n = #core.project_directories
-  for i = 1, n do
-    local dir = core.project_directories[i]
-    save_project_dirs[i] = {name = dir.name, shown_subdir = dir.shown_subdir}
-  end
+  local names = {}
+  for i, dir in ipairs(core.project_directories) do names[i] = dir.name end
   core.project_directories = {}
-  for i = 1, n do -- add again the directories in the project
-    local dir = core.add_project_directory(save_project_dirs[i].name)
-    if dir.files_limit then
-      -- We need to sort the list of shown subdirectories so that higher level
-      -- directories are populated first. We use the function system.path_compare
-      -- because it order the entries in the appropriate order.
-      -- TODO: we may consider storing the table shown_subdir as a sorted table
-      -- since the beginning.
-      local subdir_list = {}
-      for subdir in pairs(save_project_dirs[i].shown_subdir) do
-        table.insert(subdir_list, subdir)
-      end
-      table.sort(subdir_list, function(a, b) return system.path_compare(a, "dir", b, "dir") end)
-      for _, subdir in ipairs(subdir_list) do
-        local show = save_project_dirs[i].shown_subdir[subdir]
-        for j = 1, #dir.files do
-          if dir.files[j].filename == subdir then
-            -- The instructions below match when happens in TreeView:on_mouse_pressed.
-            -- We perform the operations only once iff the subdir is in dir.files.
-            -- In theory set_show below may fail and return false but is it is listed
-            -- there it means it succeeded before so we are optimistically assume it
-            -- will not fail for the sake of simplicity.
-            core.update_project_subdir(dir, subdir, show)
-            break
-          end
-        end
-      end
-    end
+  for _, name in ipairs(names) do
+    core.add_project_directory(name)
   end
 end
 
@@ -371,77 +384,21 @@ function core.project_dir_by_name(name)
 end
 
 
-function core.update_project_subdir(dir, filename, expanded)
-  assert(dir.files_limit, "function should be called only when directory is in files limit mode")
-  dir.shown_subdir[filename] = expanded
-  if expanded then
-    dir.watch:watch(dir.name .. PATHSEP .. filename)
-  else
-    dir.watch:unwatch(dir.name .. PATHSEP .. filename)
-  end
-  return refresh_directory(dir, filename)
-end
-
-
--- Find files and directories recursively reading from the filesystem.
--- Filter files and yields file's directory and info table. This latter
--- is filled to be like required by project directories "files" list.
-local function find_files_rec(root, path)
-  local all = system.list_dir(root .. path) or {}
-  for _, file in ipairs(all) do
-    local file = path .. PATHSEP .. file
-    local info = system.get_file_info(root .. file)
-    if info then
-      info.filename = strip_leading_path(file)
-      if info.type == "file" then
-        coroutine.yield(root, info)
-      elseif not common.match_pattern(common.basename(info.filename), config.ignore_files) then
-        find_files_rec(root, PATHSEP .. info.filename)
-      end
-    end
-  end
-end
-
-
 -- Iterator function to list all project files
 local function project_files_iter(state)
-  local dir = core.project_directories[state.dir_index]
-  if state.co then
-    -- We have a coroutine to fetch for files, use the coroutine.
-    -- Used for directories that exceeds the files nuumber limit.
-    local ok, name, file = coroutine.resume(state.co, dir.name, "")
-    if ok and name then
-      return name, file
-    else
-      -- The coroutine terminated, increment file/dir counter to scan
-      -- next project directory.
-      state.co = false
-      state.file_index = 1
-      state.dir_index = state.dir_index + 1
-      dir = core.project_directories[state.dir_index]
-    end
-  else
-    -- Increase file/dir counter
-    state.file_index = state.file_index + 1
-    while dir and state.file_index > #dir.files do
-      state.dir_index = state.dir_index + 1
-      state.file_index = 1
-      dir = core.project_directories[state.dir_index]
-    end
-  end
-  if not dir then return end
-  if dir.files_limit then
-    -- The current project directory is files limited: create a couroutine
-    -- to read files from the filesystem.
-    state.co = coroutine.create(find_files_rec)
-    return project_files_iter(state)
+  while true do
+    local dir = core.project_directories[state.dir_index]
+    if not dir then return end
+    state.entries = state.entries or dir.tree:entries()
+    local item = state.entries()
+    if item then return dir.name, item end
+    state.dir_index, state.entries = state.dir_index + 1, nil
   end
-  return dir.name, dir.files[state.file_index]
 end
 
 
 function core.get_project_files()
-  local state = { dir_index = 1, file_index = 0 }
+  local state = { dir_index = 1 }
   return project_files_iter, state
 end
 
@@ -449,8 +406,7 @@ end
 function core.project_files_number()
   local n = 0
   for i = 1, #core.project_directories do
-    if core.project_directories[i].files_limit then return end
-    n = n + #core.project_directories[i].files
+    n = n + core.project_directories[i].tree:count()
   end
   return n
 end
@@ -550,6 +506,9 @@ local style = require "core.style"
 --   "^desktop%.ini$", "^%.DS_Store$", "^%.directory$",
 -- }
 
+-- disable to index what the project's .gitignore and .ignore files exclude:
+-- config.use_gitignore = false
+
 ]])
   init_file:close()
 end
@@ -670,6 +629,7 @@ end
 
 
 function core.init()
+  local init_start = system.get_time()
   core.log_items = {}
   core.log_quiet("Lite XL version %s - mod-version %s", VERSION, MOD_VERSION_STRING)
 
@@ -677,6 +637,7 @@ function core.init()
   keymap = require "core.keymap"
   dirwatch = require "core.dirwatch"
   ime = require "core.ime"
+  renderstats = require "core.renderstats"
   RootView = require "core.rootview"
   StatusView = require "core.statusview"
   TitleView = require "core.titleview"
@@ -706,10 +667,18 @@ function core.init()
   local project_dir = core.recent_projects[1] or "."
   local project_dir_explicit = false
   local files = {}
+  local benchmark_scenario = os.getenv("LITE_XL_BENCHMARK")
+  if benchmark_scenario == "" then benchmark_scenario = nil end
+  local skip_arg = false
   for i = 2, #ARGS do
     local arg_filename = strip_trailing_slash(ARGS[i])
     local info = system.get_file_info(arg_filename) or {}
-    if info.type == "dir" then
+    if skip_arg then
+      skip_arg = false
+    elseif ARGS[i] == "--benchmark" then
+      benchmark_scenario = ARGS[i + 1]
+      skip_arg = true
+    elseif info.type == "dir" then
       project_dir = arg_filename
       project_dir_explicit = true
     else
@@ -799,12 +768,6 @@ function core.init()
   -- We add the project directory now because the project's module is loaded.
   core.add_project_directory(project_dir_abs)
 
-  -- We assume we have just a single project directory here. Now that StatusView
-  -- is there show max files warning if needed.
-  if core.project_directories[1].files_limit then
-    show_max_files_warning(core.project_directories[1])
-  end
-
   for _, filename in ipairs(files) do
     core.root_view:open_doc(core.open_doc(filename))
   end
@@ -842,6 +805,11 @@ function core.init()
   end
 
   add_config_files_hooks()
+
+  if benchmark_scenario then
+    benchmark = require "core.benchmark"
+    benchmark.run(benchmark_scenario, system.get_time() - init_start)
+  end
 end
 
 
@@ -1262,6 +1230,9 @@ function core.try(fn, ...)
   return false, err
 end
 
+-- set when an event wakes up threads, so that core.run doesn't wait before running them
+local threads_woken = false
+
 function core.on_event(type, ...)
   local did_keymap = false
   if type == "textinput" then
@@ -1313,6 +1284,13 @@ function core.on_event(type, ...)
     end
   elseif type == "focuslost" then
     core.root_view:on_focus_lost(...)
+  elseif type == "dirchange" then
+    for _, thread in pairs(core.threads) do
+      if dirwatch.is_checking(thread.cr) then
+        thread.wake = 0
+        threads_woken = true
+      end
+    end
   elseif type == "quit" then
     core.quit()
   end
@@ -1333,6 +1311,7 @@ end
 
 
 function core.step()
+  local step_start = system.get_time()
   -- handle events
   local did_keymap = false
 
@@ -1350,7 +1329,8 @@ function core.step()
       local _, res = core.try(core.on_event, type, a, b, c, d)
       did_keymap = res or did_keymap
     end
-    core.redraw = true
+    -- directory changes only wake up the threads checking them, which redraw if needed
+    if type ~= "dirchange" then core.redraw = true end
   end
 
   local width, height = renderer.get_size()
@@ -1382,7 +1362,10 @@ function core.step()
   core.clip_rect_stack[1] = { 0, 0, width, height }
   renderer.set_clip_rect(table.unpack(core.clip_rect_stack[1]))
   core.root_view:draw()
+  if renderstats.enabled then renderstats.draw() end
   renderer.end_frame()
+  if renderstats.enabled then renderstats.add_frame(system.get_time() - step_start) end
+  if benchmark then benchmark.on_frame() end
   return true
 end
 
@@ -1434,8 +1417,14 @@ function core.run()
     end
     if core.restart_request or core.quit_request then break end
 
-    if not did_redraw then
-      if system.window_has_focus() then
+    if benchmark then
+      -- a benchmark runs without a display, there's nothing to wait for
+      next_step = nil
+    elseif not did_redraw then
+      if threads_woken then
+        -- run the threads woken up by an event before waiting for the next one
+        threads_woken = false
+      elseif system.window_has_focus() then
         local now = system.get_time()
         if not next_step then -- compute the time until the next blink
           local t = now - core.blink_start
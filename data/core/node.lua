@@ -594,9 +594,16 @@ function Node:draw()
     if self:should_show_tabs() then
       self:draw_tabs()
     end
-    local pos, size = self.active_view.position, self.active_view.size
+    local view = self.active_view
+    local pos, size = view.position, view.size
     core.push_clip_rect(pos.x, pos.y, size.x, size.y)
-    self.active_view:draw()
+    local version = view:get_draw_version()
+    if not version then
+      view:draw()
+    elseif renderer.begin_list(view.display_list_id, version) then
+      view:draw()
+      renderer.end_list()
+    end
     core.pop_clip_rect()
   else
     local x, y, w, h = self:get_divider_rect()
@@ -0,0 +1,80 @@
+local core = require "core"
+local config = require "core.config"
+local style = require "core.style"
+
+local renderstats = { enabled = false }
+
+-- frame time histogram: BUCKETS buckets of BUCKET_MS, the last one collects everything slower
+local BUCKETS = 20
+local BUCKET_MS = 2
+local HISTORY = 240
+
+local frame_times, frame_index = {}, 0
+local stats
+
+---Shows or hides the overlay, along with the renderer's redrawn rects.
+function renderstats.toggle()
+  renderstats.enabled = not renderstats.enabled
+  renderer.show_debug(renderstats.enabled)
+  frame_times, frame_index, stats = {}, 0, nil
+  core.redraw = true
+end
+
+---Records a frame that was drawn, along with the renderer's counters for it.
+---@param step_time number @Seconds spent in core.step
+function renderstats.add_frame(step_time)
+  frame_index = frame_index % HISTORY + 1
+  frame_times[frame_index] = step_time
+  stats = renderer.get_stats()
+  stats.step_time = step_time
+end
+
+local function ms(seconds)
+  return string.format("%.2f", seconds * 1000)
+end
+
+function renderstats.draw()
+  if not stats then return end
+  local font = style.code_font
+  local lh = font:get_height()
+  local lines = {
+    string.format("step %s ms  lua %s  end_frame %s  update %s",
+      ms(stats.step_time), ms(stats.lua_time), ms(stats.end_frame_time), ms(stats.update_rects_time)),
+    string.format("commands %d  %d KiB  culled %d  lists replayed %d",
+      stats.commands, math.ceil(stats.command_bytes / 1024), stats.culled, stats.lists_replayed),
+    string.format("cells %d/%d  rects %d  px %d  saved %d  moved %d",
+      stats.cells_dirty, stats.cells, stats.rects, stats.pixels, stats.pixels_saved, stats.moved_pixels),
+  }
+  local counts, max_count = {}, 1
+  for i = 1, BUCKETS do counts[i] = 0 end
+  for _, t in ipairs(frame_times) do
+    local b = math.min(math.floor(t * 1000 / BUCKET_MS) + 1, BUCKETS)
+    counts[b] = counts[b] + 1
+    max_count = math.max(max_count, counts[b])
+  end
+
+  local pad = style.padding.x
+  local w = 0
+  for _, line in ipairs(lines) do w = math.max(w, font:get_width(line)) end
+  w = w + pad * 2
+  local graph_h = lh * 4
+  local h = lh * #lines + graph_h + pad * 3
+  local width, height = renderer.get_size()
+  local x, y = width - w - pad, height - h - pad
+  renderer.set_clip_rect(x, y, w, h)
+  renderer.draw_rect(x, y, w, h, style.background3)
+  for i, line in ipairs(lines) do
+    renderer.draw_text(font, line, x + pad, y + pad + (i - 1) * lh, style.text)
+  end
+
+  local gx, gy, gw = x + pad, y + h - pad - graph_h, w - pad * 2
+  local bar_w = gw / BUCKETS
+  renderer.draw_rect(gx, gy + graph_h, gw, 1, style.dim)
+  for i = 1, BUCKETS do
+    local bh = math.floor(graph_h * counts[i] / max_count + 0.5)
+    local color = (i - 1) * BUCKET_MS < 1000 / config.fps and style.accent or style.error
+    renderer.draw_rect(gx + (i - 1) * bar_w, gy + graph_h - bh, math.max(bar_w - 1, 1), bh, color)
+  end
+end
+
+return renderstats
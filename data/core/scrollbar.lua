@@ -332,6 +332,17 @@ function Scrollbar:draw_thumb()
   renderer.draw_rect(x, y, w, h, color)
 end
 
+---Returns a value that changes whenever the drawn scrollbar changes.
+---@return string
+function Scrollbar:get_draw_version()
+  local r = self.rect
+  return string.format("%s %s %s %s %s %s %s %s %s %s %s %s %s",
+    r.x, r.y, r.w, r.h, r.scrollable, self.percent, self.expand_percent,
+    self.hovering.track, self.hovering.thumb, self.dragging,
+    self.contracted_size or style.scrollbar_size, self.expanded_size or style.expanded_scrollbar_size,
+    common.color_version(style.scrollbar, style.scrollbar2, style.scrollbar_track))
+end
+
 ---Draw both the scrollbar track and thumb
 function Scrollbar:draw()
   self:draw_track()
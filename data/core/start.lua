@@ -13,6 +13,9 @@ USERDIR = (system.get_file_info(EXEDIR .. PATHSEP .. 'user') and (EXEDIR .. PATH
        or ((os.getenv("XDG_CONFIG_HOME") and os.getenv("XDG_CONFIG_HOME") .. PATHSEP .. NAME))
        or (HOME and (HOME .. PATHSEP .. '.config' .. PATHSEP .. NAME))
 
+-- persist rasterized glyphs across launches; call again with nil from the user module to disable.
+if USERDIR then renderer.set_glyph_cache_dir(USERDIR .. PATHSEP .. "glyphcache") end
+
 package.path = DATADIR .. '/?.lua;'
 package.path = DATADIR .. '/?/init.lua;' .. package.path
 package.path = USERDIR .. '/?.lua;' .. package.path
@@ -323,7 +323,7 @@ function StatusView:register_command_items()
         style.icon_font, "g",
         style.font, style.dim, self.separator2,
         style.text, #core.docs, style.text, " / ",
-        #core.project_files, " files"
+        core.project_files_number(), " files"
       }
     end
   })
@@ -1184,4 +1184,61 @@ function StatusView:draw()
   end
 end
 
+
+---Helper function to add the version of a styled text to the given table.
+---@param parts string[]
+---@param items core.statusview.styledtext
+local function add_styled_text_version(parts, items)
+  for _, item in ipairs(items) do
+    if type(item) == "table" then
+      table.insert(parts, common.color_version(item))
+    else
+      table.insert(parts, tostring(item))
+    end
+  end
+end
+
+
+-- the draw methods whose output StatusView:get_draw_version accounts for
+local draw_methods = { "draw", "draw_background", "draw_items", "draw_item_tooltip" }
+
+---The draw methods `StatusView:get_draw_version` accounts for; see
+---`DocView.versioned_draws`.
+---@type table<function, boolean>
+StatusView.versioned_draws = {}
+for _, name in ipairs(draw_methods) do
+  StatusView.versioned_draws[StatusView[name]] = true
+end
+
+function StatusView:get_draw_version()
+  for _, name in ipairs(draw_methods) do
+    if not StatusView.versioned_draws[self[name]] then return nil end
+  end
+  -- the hovered item's tooltip is drawn outside of the view
+  if self.hovered_item.tooltip ~= "" and self.hovered_item.active then return nil end
+  local show_message = self.message and system.get_time() <= self.message_timeout
+  local parts = {
+    self.visible, self.position.x, self.position.y, self.size.x, self.size.y,
+    self.scroll.y, show_message, self.tooltip_mode,
+    self.left_width, self.right_width, self.left_xoffset, self.right_xoffset,
+    style.font, style.padding.x, style.padding.y,
+    common.color_version(style.background2, style.text)
+  }
+  for i = 1, #parts do parts[i] = tostring(parts[i]) end
+  if show_message then
+    add_styled_text_version(parts, self.message)
+  elseif self.tooltip_mode then
+    add_styled_text_version(parts, self.tooltip)
+  end
+  for _, item in ipairs(self.active_items) do
+    -- items drawn by a function can't tell when they change
+    if item.on_draw then return nil end
+    table.insert(parts, string.format("%s %s %s %s %s",
+      item.alignment, item.x, item.w, self.hovered_item == item,
+      common.color_version(item.background_color, item.background_color_hover)))
+    add_styled_text_version(parts, item.cached_item)
+  end
+  return table.concat(parts, " ")
+end
+
 return StatusView
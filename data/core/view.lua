@@ -46,8 +46,11 @@ local Scrollbar = require "core.scrollbar"
 ---@field v_scrollbar core.scrollbar
 ---@field h_scrollbar core.scrollbar
 ---@field current_scale number
+---@field display_list_id integer
 local View = Object:extend()
 
+local next_display_list_id = 0
+
 -- context can be "application" or "session". The instance of objects
 -- with context "session" will be closed when a project session is
 -- terminated. The context "application" is for functional UI elements.
@@ -62,6 +65,8 @@ function View:new()
   self.v_scrollbar = Scrollbar({direction = "v", alignment = "e"})
   self.h_scrollbar = Scrollbar({direction = "h", alignment = "e"})
   self.current_scale = SCALE
+  next_display_list_id = next_display_list_id + 1
+  self.display_list_id = next_display_list_id
 end
 
 function View:move_towards(t, k, dest, rate, name)
@@ -325,6 +330,23 @@ function View:draw_scrollbar()
 end
 
 
+---Returns a value that changes whenever the drawn scrollbars change, for use
+---in `View:get_draw_version`.
+---@return string
+function View:get_scrollbar_draw_version()
+  return self.v_scrollbar:get_draw_version() .. " " .. self.h_scrollbar:get_draw_version()
+end
+
+
+---Returns a value that changes whenever anything the view draws changes, or
+---nil if the view can't tell. While it stays the same, the commands the view
+---drew the last time are replayed instead of calling `View:draw`.
+---@return string|number|nil
+function View:get_draw_version()
+  return nil
+end
+
+
 function View:draw()
 end
 
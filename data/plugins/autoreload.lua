@@ -65,9 +65,10 @@ end
 
 local on_check = dirwatch.check
 function dirwatch:check(change_callback, ...)
-  on_check(self, function(dir)
+  on_check(self, function(dir, name, ...)
     for _, doc in ipairs(core.docs) do
-      if doc.abs_filename and (dir == common.dirname(doc.abs_filename) or dir == doc.abs_filename) then
+      if doc.abs_filename and (dir == common.dirname(doc.abs_filename) or dir == doc.abs_filename)
+        and (not name or dir == doc.abs_filename or name == common.basename(doc.abs_filename)) then
         local info = system.get_file_info(doc.filename or "")
         if info and times[doc] ~= info.modified then
           if not doc:is_dirty() and not config.plugins.autoreload.always_show_nagview then
@@ -79,7 +80,7 @@ function dirwatch:check(change_callback, ...)
         end
       end
     end
-    change_callback(dir)
+    change_callback(dir, name, ...)
   end, ...)
 end
 
@@ -101,7 +102,7 @@ core.add_thread(function()
     -- because we already hook this function above; we only
     -- need to check the file.
     watch:check(function() end)
-    coroutine.yield(0.05)
+    coroutine.yield(watch:is_polling() and 0.05 or 1)
   end
 end)
 
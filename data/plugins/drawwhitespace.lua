@@ -343,6 +343,21 @@ function DocView:draw_line_text(idx, x, y)
 
   return draw_line_text(self, idx, x, y)
 end
+DocView.versioned_draws[DocView.draw_line_text] = true
+
+local get_draw_version = DocView.get_draw_version
+function DocView:get_draw_version()
+  local version = get_draw_version(self)
+  if not version then return nil end
+  -- like the cache above, assumes that colors and substitutions are replaced
+  -- rather than modified
+  local settings = config.plugins.drawwhitespace
+  return string.format("%s %s %s %s %s %s %s %s %s %s %s %s", version,
+    settings.enabled, settings.show_leading, settings.show_trailing, settings.show_middle,
+    settings.show_middle_min, settings.show_selected_only, settings.color,
+    settings.leading_color, settings.middle_color, settings.trailing_color,
+    settings.substitutions)
+end
 
 
 command.add(nil, {
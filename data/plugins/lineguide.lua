@@ -107,6 +107,23 @@ function DocView:draw_overlay(...)
     end
   end
 end
+DocView.versioned_draws[DocView.draw_overlay] = true
+
+local get_draw_version = DocView.get_draw_version
+function DocView:get_draw_version()
+  local version = get_draw_version(self)
+  if not version or type(config.plugins.lineguide) ~= "table" then return version end
+  local settings = config.plugins.lineguide
+  local rulers = {}
+  for _, v in ipairs(settings.rulers) do
+    local ruler = get_ruler(v)
+    if ruler then
+      table.insert(rulers, tostring(ruler.columns) .. " " .. common.color_version(ruler.color))
+    end
+  end
+  return string.format("%s %s %s %s %s", version, settings.enabled, settings.width,
+    common.color_version(style.guide), table.concat(rulers, ","))
+end
 
 command.add(nil, {
   ["lineguide:toggle"] = function()
@@ -539,6 +539,20 @@ function DocView:draw_line_gutter(line, x, y, width)
   return (old_draw_line_gutter(self, line, x, y, width) or lh) * count
 end
 
+for _, fn in ipairs({ DocView.draw_line_text, DocView.draw_line_body, DocView.draw, DocView.draw_line_gutter }) do
+  DocView.versioned_draws[fn] = true
+end
+
+local old_get_draw_version = DocView.get_draw_version
+function DocView:get_draw_version()
+  local version = old_get_draw_version(self)
+  if not version or not self.wrapped_settings then return version end
+  -- the breaks are recomputed into a new settings table when the width or
+  -- font change, and updated along with the doc otherwise
+  return string.format("%s %s %s %s", version, self.wrapped_settings,
+    #self.wrapped_lines, config.plugins.linewrapping.guide)
+end
+
 local old_translate_end_of_line = translate.end_of_line
 function translate.end_of_line(doc, line, col)
   if not core.active_view or core.active_view.doc ~= doc or not core.active_view.wrapped_settings then old_translate_end_of_line(doc, line, col) end
@@ -1,6 +1,7 @@
 -- mod-version:3
 local core = require "core"
 local common = require "core.common"
+local config = require "core.config"
 local keymap = require "core.keymap"
 local command = require "core.command"
 local style = require "core.style"
@@ -45,28 +46,74 @@ local function find_all_matches_in_file(t, filename, fn)
 end
 
 
+-- Searches the project natively, on worker threads, taking the matches in in
+-- file order as they're found. The results stay in the search, and are only
+-- fetched a page at a time as they're drawn.
+function ResultsView:begin_native_search(path, text, opts)
+  local dirs = {}
+  for _, dir in ipairs(core.project_directories) do
+    local prefix = dir.name == core.project_dir and "" or (dir.name .. PATHSEP)
+    table.insert(dirs, { path = dir.name, tree = dir.tree, prefix = prefix })
+  end
+  local search, err = system.search_files(dirs, text, {
+    path = path, regex = opts.regex, insensitive = opts.insensitive
+  })
+  if not search then
+    core.error("Can't search for %q: %s", text, err)
+    self.searching = false
+    return
+  end
+  self.search = search
+  core.add_thread(function()
+    -- a refresh starts another search, this one is then cancelled
+    while self.search == search do
+      -- only take what the workers already finished, they keep searching between frames
+      local matches, files_searched, files_number = search:read(0)
+      if matches ~= 0 or files_searched ~= self.last_file_idx then
+        core.redraw = true
+      end
+      self.last_file_idx, self.files_number = files_searched, files_number
+      if not matches then
+        self.searching = false
+        self.brightness = 100
+        break
+      end
+      coroutine.yield(1 / config.fps)
+    end
+  end, search)
+end
+
+
 function ResultsView:begin_search(path, text, fn)
   self.search_args = { path, text, fn }
   self.results = {}
   self.last_file_idx = 1
+  self.files_number = nil
+  self.page = nil
   self.query = text
   self.searching = true
   self.selected_idx = 0
+  if self.search then self.search:cancel() end
+  self.search = nil
 
-  core.add_thread(function()
-    local i = 1
-    for dir_name, file in core.get_project_files() do
-      if file.type == "file" and (not path or (dir_name .. "/" .. file.filename):find(path, 1, true) == 1) then
-        local truncated_path = (dir_name == core.project_dir and "" or (dir_name .. PATHSEP))
-        find_all_matches_in_file(self.results, truncated_path .. file.filename, fn)
+  if type(fn) == "table" then
+    self:begin_native_search(path, text, fn)
+  else
+    core.add_thread(function()
+      local i = 1
+      for dir_name, file in core.get_project_files() do
+        if file.type == "file" and (not path or (dir_name .. "/" .. file.filename):find(path, 1, true) == 1) then
+          local truncated_path = (dir_name == core.project_dir and "" or (dir_name .. PATHSEP))
+          find_all_matches_in_file(self.results, truncated_path .. file.filename, fn)
+        end
+        self.last_file_idx = i
+        i = i + 1
       end
-      self.last_file_idx = i
-      i = i + 1
-    end
-    self.searching = false
-    self.brightness = 100
-    core.redraw = true
-  end, self.results)
+      self.searching = false
+      self.brightness = 100
+      core.redraw = true
+    end, self.results)
+  end
 
   self.scroll.to.y = 0
 end
@@ -77,6 +124,12 @@ function ResultsView:refresh()
 end
 
 
+function ResultsView:try_close(...)
+  if self.search then self.search:cancel() end
+  ResultsView.super.try_close(self, ...)
+end
+
+
 function ResultsView:on_mouse_moved(mx, my, ...)
   ResultsView.super.on_mouse_moved(self, mx, my, ...)
   self.selected_idx = 0
@@ -98,7 +151,7 @@ end
 
 
 function ResultsView:open_selected_result()
-  local res = self.results[self.selected_idx]
+  local res = self:get_results(self.selected_idx, self.selected_idx)[1]
   if not res then
     return
   end
@@ -129,7 +182,23 @@ end
 
 
 function ResultsView:get_scrollable_size()
-  return self:get_results_yoffset() + #self.results * self:get_line_height()
+  return self:get_results_yoffset() + self:get_results_number() * self:get_line_height()
+end
+
+
+function ResultsView:get_results_number()
+  return self.search and self.search:count() or #self.results
+end
+
+
+---Returns the results from first to last, with the text of native results
+---read back from their files.
+---@param first integer
+---@param last integer
+---@return table[]
+function ResultsView:get_results(first, last)
+  if self.search then return self.search:get(first, last) end
+  return table.move(self.results, first, last, 1, {})
 end
 
 
@@ -147,8 +216,13 @@ function ResultsView:each_visible_result()
     local x, y = self:get_content_offset()
     local min, max = self:get_visible_results_range()
     y = y + self:get_results_yoffset() + lh * (min - 1)
+    -- the page is kept until the view scrolls or more results come in
+    local last = math.min(max, self:get_results_number())
+    if not self.page or self.page.first ~= min or self.page.last ~= last then
+      self.page = { first = min, last = last, items = self:get_results(min, last) }
+    end
     for i = min, max do
-      local item = self.results[i]
+      local item = self.page.items[i - min + 1]
       if not item then break end
       coroutine.yield(i, item, x, y, self.size.x, lh)
       y = y + lh
@@ -171,21 +245,22 @@ function ResultsView:draw()
   -- status
   local ox, oy = self:get_content_offset()
   local x, y = ox + style.padding.x, oy + style.padding.y
-  local files_number = core.project_files_number()
+  local results_number = self:get_results_number()
+  local files_number = self.files_number or core.project_files_number()
   local per = common.clamp(files_number and self.last_file_idx / files_number or 1, 0, 1)
   local text
   if self.searching then
     if files_number then
       text = string.format("Searching %.f%% (%d of %d files, %d matches) for %q...",
         per * 100, self.last_file_idx, files_number,
-        #self.results, self.query)
+        results_number, self.query)
     else
       text = string.format("Searching (%d files, %d matches) for %q...",
-        self.last_file_idx, #self.results, self.query)
+        self.last_file_idx, results_number, self.query)
     end
   else
     text = string.format("Found %d matches for %q",
-      #self.results, self.query)
+      results_number, self.query)
   end
   local color = common.lerp(style.text, style.accent, self.brightness / 100)
   renderer.draw_text(style.font, text, x, y, color)
@@ -221,7 +296,7 @@ end
 
 ---@param path string
 ---@param text string
----@param fn fun(line_text:string):...
+---@param fn (fun(line_text:string):...)|{regex:boolean?,insensitive:boolean?} A predicate, or options for the native search
 ---@return plugins.projectsearch.resultsview?
 local function begin_search(path, text, fn)
   if text == "" then
@@ -266,13 +341,7 @@ projectsearch.ResultsView = ResultsView
 ---@return plugins.projectsearch.resultsview?
 function projectsearch.search_plain(text, path, insensitive)
   if insensitive then text = text:lower() end
-  return begin_search(path, text, function(line_text)
-    if insensitive then
-      return line_text:lower():find(text, nil, true)
-    else
-      return line_text:find(text, nil, true)
-    end
-  end)
+  return begin_search(path, text, { insensitive = insensitive })
 end
 
 ---@param text string
@@ -287,9 +356,7 @@ function projectsearch.search_regex(text, path, insensitive)
     re, errmsg = regex.compile(text)
   end
   if not re then core.log("%s", errmsg) return end
-  return begin_search(path, text, function(line_text)
-    return regex.cmatch(re, line_text)
-  end)
+  return begin_search(path, text, { regex = true, insensitive = insensitive })
 end
 
 ---@param text string
@@ -348,7 +415,7 @@ command.add(ResultsView, {
 
   ["project-search:select-next"] = function()
     local view = core.active_view
-    view.selected_idx = math.min(view.selected_idx + 1, #view.results)
+    view.selected_idx = math.min(view.selected_idx + 1, view:get_results_number())
     view:scroll_to_make_selected_visible()
   end,
 
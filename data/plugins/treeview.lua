@@ -50,8 +50,12 @@ function TreeView:new()
   self.init_size = true
   self.target_size = config.plugins.treeview.size
   self.cache = {}
+  -- the entries of each expanded directory, by project
+  self.listings = {}
   self.tooltip = { x = 0, y = 0, begin = 0, alpha = 0 }
   self.cursor_pos = { x = 0, y = 0 }
+  -- bumped whenever the listed items may have changed
+  self.items_generation = 0
 
   self.item_icon_width = 0
   self.item_text_spacing = 0
@@ -110,17 +114,16 @@ end
 
 
 function TreeView:invalidate_cache(dirname)
-  for _, v in pairs(self.cache[dirname]) do
-    v.skip = nil
-  end
+  self.listings[dirname] = nil
+  self.items_generation = self.items_generation + 1
 end
 
 
 function TreeView:check_cache()
   for i = 1, #core.project_directories do
     local dir = core.project_directories[i]
-    -- invalidate cache's skip values if directory is declared dirty
-    if dir.is_dirty and self.cache[dir.name] then
+    -- drop the listings of a project declared dirty
+    if dir.is_dirty then
       self:invalidate_cache(dir.name)
     end
     dir.is_dirty = false
@@ -128,6 +131,21 @@ function TreeView:check_cache()
 end
 
 
+function TreeView:get_listing(dir, dirpath)
+  local listings = self.listings[dir.name]
+  if not listings then
+    listings = {}
+    self.listings[dir.name] = listings
+  end
+  local listing = listings[dirpath]
+  if not listing then
+    listing = dir.tree:list(dirpath) or {}
+    listings[dirpath] = listing
+  end
+  return listing
+end
+
+
 function TreeView:each_item()
   return coroutine.wrap(function()
     self:check_cache()
@@ -137,36 +155,27 @@ function TreeView:each_item()
     local w = self.size.x
     local h = self:get_item_height()
 
+    -- only the entries of expanded directories are read from the project tree
+    local function each_entry(dir, dirpath)
+      for _, item in ipairs(self:get_listing(dir, dirpath)) do
+        local cached = self:get_cached(dir, item, dir.name)
+        coroutine.yield(cached, ox, y, w, h)
+        count_lines = count_lines + 1
+        y = y + h
+        if cached.expanded then
+          each_entry(dir, item.filename)
+        end
+      end
+    end
+
     for k = 1, #core.project_directories do
       local dir = core.project_directories[k]
       local dir_cached = self:get_cached(dir, dir.item, dir.name)
       coroutine.yield(dir_cached, ox, y, w, h)
       count_lines = count_lines + 1
       y = y + h
-      local i = 1
-      if dir.files then -- if consumed max sys file descriptors this can be nil
-        while i <= #dir.files and dir_cached.expanded do
-          local item = dir.files[i]
-          local cached = self:get_cached(dir, item, dir.name)
-
-          coroutine.yield(cached, ox, y, w, h)
-          count_lines = count_lines + 1
-          y = y + h
-          i = i + 1
-
-          if not cached.expanded then
-            if cached.skip then
-              i = cached.skip
-            else
-              local depth = cached.depth
-              while i <= #dir.files do
-                if get_depth(dir.files[i].filename) <= depth then break end
-                i = i + 1
-              end
-              cached.skip = i
-            end
-          end
-        end -- while files
+      if dir_cached.expanded then
+        each_entry(dir, "")
       end
     end -- for directories
     self.count_lines = count_lines
@@ -456,6 +465,44 @@ function TreeView:draw()
 end
 
 
+-- the draw methods whose output TreeView:get_draw_version accounts for
+local draw_methods = {
+  "draw", "draw_background", "draw_scrollbar", "draw_item", "draw_item_background",
+  "draw_item_chevron", "draw_item_body", "draw_item_icon", "draw_item_text",
+  "get_item_icon", "get_item_text"
+}
+
+---The draw methods `TreeView:get_draw_version` accounts for; see
+---`DocView.versioned_draws`.
+---@type table<function, boolean>
+TreeView.versioned_draws = {}
+for _, name in ipairs(draw_methods) do
+  TreeView.versioned_draws[TreeView[name]] = true
+end
+
+function TreeView:get_draw_version()
+  if not self.visible or (self.hovered_item and self.tooltip.x and self.tooltip.alpha > 0) then
+    -- the tooltip is drawn outside of the view
+    return nil
+  end
+  for _, name in ipairs(draw_methods) do
+    if not TreeView.versioned_draws[self[name]] then return nil end
+  end
+  self:check_cache()
+  local dirs = {}
+  for _, dir in ipairs(core.project_directories) do
+    table.insert(dirs, dir.name)
+  end
+  return string.format("%s %s %s %s %s %s %s %s %s %s %s %s %s %s %s %s %s",
+    self.position.x, self.position.y, self.size.x, self.size.y,
+    self.scroll.x, self.scroll.y, self.items_generation, table.concat(dirs, PATHSEP),
+    self.selected_item, self.hovered_item, self.item_icon_width, self.item_text_spacing,
+    style.font, style.icon_font, style.padding.x, style.padding.y,
+    common.color_version(style.background2, style.text, style.accent, style.line_highlight))
+    .. " " .. self:get_scrollbar_draw_version()
+end
+
+
 function TreeView:get_parent(item)
   local parent_path = common.dirname(item.abs_filename)
   if not parent_path then return end
@@ -511,10 +558,7 @@ function TreeView:toggle_expand(toggle, item)
     else
       item.expanded = not item.expanded
     end
-    local hovered_dir = core.project_dir_by_name(item.dir_name)
-    if hovered_dir and hovered_dir.files_limit then
-      core.update_project_subdir(hovered_dir, item.depth == 0 and "" or item.filename, item.expanded)
-    end
+    self.items_generation = self.items_generation + 1
   end
 end
 
@@ -585,6 +629,7 @@ end
 local on_quit_project = core.on_quit_project
 function core.on_quit_project()
   view.cache = {}
+  view.listings = {}
   on_quit_project()
 end
 
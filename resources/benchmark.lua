@@ -0,0 +1,87 @@
+-- An example benchmark scenario; run it with `lite-xl --benchmark resources/benchmark.lua`.
+-- It builds a large file out of the editor's own sources, then opens, tokenizes, scrolls,
+-- edits and searches it, checks that an idle split is replayed rather than redrawn, and
+-- toggles a plugin while it's on screen.
+local bench = ...
+local core = require "core"
+local config = require "core.config"
+local search = require "core.doc.search"
+
+local path = USERDIR .. PATHSEP .. "benchmark-input.lua"
+local source = io.open(DATADIR .. PATHSEP .. "core" .. PATHSEP .. "init.lua", "rb"):read("*a")
+local fp = assert(io.open(path, "wb"))
+for _ = 1, 40 do fp:write(source) end
+fp:close()
+
+local view
+bench.phase("open", function()
+  view = bench.open(path)
+  bench.frames()
+end)
+
+bench.phase("tokenize", function()
+  local highlighter = view.doc.highlighter
+  for i = 1, #view.doc.lines do highlighter:get_line(i) end
+end)
+
+bench.phase("scroll", function()
+  for _ = 1, 200 do
+    view.scroll.to.y = view.scroll.to.y + view:get_line_height() * 3
+    bench.frames()
+  end
+end)
+
+bench.phase("type", function()
+  bench.command("doc:move-to-start-of-doc")
+  bench.type("local benchmark_typed_text = { 1, 2, 3 } -- typed by the benchmark\n")
+end)
+
+bench.phase("search", function()
+  for _ = 1, 50 do
+    local line, col = view.doc:get_selection()
+    local line1, col1, line2, col2 = search.find(view.doc, line, col, "function", { wrap = true })
+    if not line1 then break end
+    view.doc:set_selection(line2, col2, line1, col1)
+    view:scroll_to_line(line2, true)
+    bench.frames()
+  end
+end)
+
+-- scrolls a view for a number of frames, returning how many display lists were replayed
+local function scroll_replays(v, frames)
+  local replayed = 0
+  for _ = 1, frames do
+    v.scroll.to.y = v.scroll.to.y + v:get_line_height()
+    bench.frames()
+    replayed = replayed + renderer.get_stats().lists_replayed
+  end
+  return replayed
+end
+
+bench.phase("idle-split", function()
+  local frames = 50
+  local alone = scroll_replays(view, frames)
+  bench.command("root:split-right")
+  local split_view = core.active_view
+  bench.frames()
+  -- the idle split only changes once, so its list should be replayed on every frame
+  local split = scroll_replays(split_view, frames)
+  bench.report { phase = "idle-split-replays", alone = alone, split = split }
+  if split - alone < frames / 2 then
+    error(string.format("the idle split was replayed on %d of %d frames", split - alone, frames))
+  end
+  local root = core.root_view.root_node
+  root:get_node_for_view(split_view):close_view(root, split_view)
+  core.set_active_view(view)
+  bench.frames()
+end)
+
+bench.phase("toggle-plugin", function()
+  for _ = 1, 10 do
+    config.plugins.drawwhitespace.enabled = not config.plugins.drawwhitespace.enabled
+    bench.frames(5)
+  end
+end)
+
+view.doc:clean()
+os.remove(path)
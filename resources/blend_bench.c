@@ -0,0 +1,107 @@
+/*
+** Compares the vectorized glyph blending kernels of ren_draw_text with the scalar one, on grayscale
+** and subpixel coverage, and checks that every kernel produces exactly the same pixels as the scalar
+** kernel. The kernels are private to renderer.c, so it is included here rather than linked.
+** Build it from the repository root against the same libraries as lite-xl, eg.
+**
+**   gcc -O3 -Isrc resources/blend_bench.c src/renwindow.c src/rencache.c \
+**     `pkg-config --cflags --libs sdl2 freetype2 lua5.4` -lm -o blend_bench
+**
+** usage: blend_bench [iterations]
+*/
+#include "renderer.c"
+
+#define ROW_WIDTH 1024
+#define CHECK_ROWS 4096
+
+typedef struct { const char *name; BlendRowFunction blend; } Kernel;
+
+static const RenColor colors[] = {
+  { 220, 220, 220, 255 },
+  { 40, 120, 200, 100 },
+  { 255, 0, 128, 1 },
+  { 0, 0, 0, 254 },
+};
+
+const char* retrieve_internal_file(UNUSED const char* path, UNUSED int* size) {
+  return NULL;
+}
+
+static double now(void) {
+  return SDL_GetPerformanceCounter() / (double) SDL_GetPerformanceFrequency();
+}
+
+static int get_kernels(Kernel *kernels) {
+  int count = 0;
+  kernels[count++] = (Kernel){ "scalar", blend_row_scalar };
+#if defined(RENDERER_BLEND_X86)
+  if (SDL_HasSSE2())
+    kernels[count++] = (Kernel){ "sse2", blend_row_sse2 };
+  if (SDL_HasAVX2())
+    kernels[count++] = (Kernel){ "avx2", blend_row_avx2 };
+#elif defined(RENDERER_BLEND_NEON)
+  kernels[count++] = (Kernel){ "neon", blend_row_neon };
+#endif
+  return count;
+}
+
+static void fill_random(uint8_t *data, size_t size) {
+  for (size_t i = 0; i < size; i++)
+    data[i] = rand();
+  // fully transparent and fully covered runs are the most common in glyphs.
+  for (size_t i = 0; i < size / 4; i++)
+    data[rand() % size] = rand() % 2 ? 0xFF : 0;
+}
+
+// blends rows of every width up to a few vectors past the widest kernel, so that the tails are covered too.
+static bool check_kernel(BlendRowFunction blend, bool subpixel, uint32_t amask) {
+  static uint32_t expected[ROW_WIDTH], actual[ROW_WIDTH];
+  static uint8_t source[ROW_WIDTH * 3];
+  srand(1);
+  for (int row = 0; row < CHECK_ROWS; row++) {
+    int width = row % 64 + 1;
+    RenColor color = row % 8 ? (RenColor){ rand(), rand(), rand(), rand() } : colors[row / 8 % (sizeof(colors) / sizeof(colors[0]))];
+    fill_random(source, width * (subpixel ? 3 : 1));
+    fill_random((uint8_t*)expected, width * sizeof(uint32_t));
+    memcpy(actual, expected, width * sizeof(uint32_t));
+    blend_row_scalar(expected, source, width, subpixel, color, amask);
+    blend(actual, source, width, subpixel, color, amask);
+    if (memcmp(expected, actual, width * sizeof(uint32_t)))
+      return false;
+  }
+  return true;
+}
+
+static double time_kernel(BlendRowFunction blend, bool subpixel, int iterations) {
+  static uint32_t destination[ROW_WIDTH];
+  static uint8_t source[ROW_WIDTH * 3];
+  srand(1);
+  fill_random(source, sizeof(source));
+  fill_random((uint8_t*)destination, sizeof(destination));
+  double start = now();
+  for (int n = 0; n < iterations; n++)
+    blend(destination, source, ROW_WIDTH, subpixel, colors[n % (sizeof(colors) / sizeof(colors[0]))], 0xFF000000);
+  return (now() - start) * 1e9 / ((double)ROW_WIDTH * iterations);
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+  Kernel kernels[4];
+  int kernel_count = get_kernels(kernels);
+  bool matches = true;
+
+  printf("%-10s %-8s %10s %8s %8s\n", "coverage", "kernel", "ns/px", "speedup", "exact");
+  for (int subpixel = 0; subpixel < 2; subpixel++) {
+    double scalar_time = 0;
+    for (int i = 0; i < kernel_count; i++) {
+      bool exact = check_kernel(kernels[i].blend, subpixel, 0) && check_kernel(kernels[i].blend, subpixel, 0xFF000000);
+      double time = time_kernel(kernels[i].blend, subpixel, iterations);
+      scalar_time = i == 0 ? time : scalar_time;
+      matches = matches && exact;
+      printf("%-10s %-8s %10.2f %7.2fx %8s\n", subpixel ? "subpixel" : "grayscale", kernels[i].name, time, scalar_time / time, exact ? "yes" : "NO");
+    }
+  }
+  if (!matches)
+    fprintf(stderr, "error: a kernel doesn't match the scalar kernel\n");
+  return matches ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+/*
+** Compares ren_draw_rect's fill of translucent rects with the generic path it replaced, which
+** blitted a 1x1 surface with SDL_BlitScaled, on rects shaped like the ones the editor draws.
+** Build it from the repository root against the same libraries as lite-xl, eg.
+**
+**   gcc -O3 -Isrc resources/rect_bench.c src/renderer.c src/renwindow.c src/rencache.c \
+**     `pkg-config --cflags --libs sdl2 freetype2 lua5.4` -lm -o rect_bench
+**
+** usage: rect_bench [iterations]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "renderer.h"
+
+#define SURFACE_WIDTH 1920
+#define SURFACE_HEIGHT 1080
+
+static const struct { const char *name; RenRect rect; } shapes[] = {
+  { "selection",      { 300, 200, 600, 20 } },
+  { "line highlight", { 0, 400, SURFACE_WIDTH, 20 } },
+  { "scrollbar",      { SURFACE_WIDTH - 12, 0, 12, SURFACE_HEIGHT } },
+  { "drag overlay",   { 100, 50, 900, 1000 } },
+};
+
+static const RenColor color = { 40, 120, 200, 100 };
+
+const char* retrieve_internal_file(UNUSED const char* path, UNUSED int* size) {
+  return NULL;
+}
+
+static double now(void) {
+  return SDL_GetPerformanceCounter() / (double) SDL_GetPerformanceFrequency();
+}
+
+static void blit_rect(SDL_Surface *surface, SDL_Surface *pixel, RenRect rect) {
+  SDL_Rect dest_rect = { rect.x, rect.y, rect.width, rect.height };
+  *(uint32_t*)pixel->pixels = SDL_MapRGBA(pixel->format, color.r, color.g, color.b, color.a);
+  SDL_BlitScaled(pixel, NULL, surface, &dest_rect);
+}
+
+static void fill_noise(SDL_Surface *surface) {
+  srand(1);
+  for (int y = 0; y < surface->h; y++) {
+    uint32_t *row = (uint32_t*)((uint8_t*)surface->pixels + y * surface->pitch);
+    for (int x = 0; x < surface->w; x++)
+      row[x] = rand() & 0xFFFFFF;
+  }
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 200;
+  SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+  if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+    fprintf(stderr, "error: can't initialize SDL: %s\n", SDL_GetError());
+    return 1;
+  }
+  SDL_Window *window = SDL_CreateWindow("", 0, 0, 64, 64, SDL_WINDOW_HIDDEN);
+  if (!window) {
+    fprintf(stderr, "error: can't create a window: %s\n", SDL_GetError());
+    return 1;
+  }
+  ren_init(window);
+
+  SDL_Surface *fill = SDL_CreateRGBSurfaceWithFormat(0, SURFACE_WIDTH, SURFACE_HEIGHT, 32, SDL_PIXELFORMAT_RGB888);
+  SDL_Surface *blit = SDL_CreateRGBSurfaceWithFormat(0, SURFACE_WIDTH, SURFACE_HEIGHT, 32, SDL_PIXELFORMAT_RGB888);
+  SDL_Surface *pixel = SDL_CreateRGBSurface(0, 1, 1, 32, 0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF);
+  if (!fill || !blit || !pixel) {
+    fprintf(stderr, "error: can't create surfaces: %s\n", SDL_GetError());
+    return 1;
+  }
+  RenSurface rs = { fill, 1, { 0, 0, SURFACE_WIDTH, SURFACE_HEIGHT } };
+
+  printf("%-16s %12s %12s %8s %9s\n", "rect", "fill Mpx/s", "blit Mpx/s", "speedup", "max diff");
+  for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+    RenRect rect = shapes[i].rect;
+    double pixels = (double)rect.width * rect.height * iterations / 1e6;
+
+    fill_noise(fill);
+    fill_noise(blit);
+    ren_draw_rect(&rs, rect, color);
+    blit_rect(blit, pixel, rect);
+    int max_diff = 0;
+    for (int y = 0; y < SURFACE_HEIGHT; y++) {
+      uint8_t *a = (uint8_t*)fill->pixels + y * fill->pitch, *b = (uint8_t*)blit->pixels + y * blit->pitch;
+      for (int x = 0; x < SURFACE_WIDTH * 4; x++) {
+        int diff = abs(a[x] - b[x]);
+        max_diff = diff > max_diff ? diff : max_diff;
+      }
+    }
+
+    double start = now();
+    for (int n = 0; n < iterations; n++)
+      ren_draw_rect(&rs, rect, color);
+    double fill_time = now() - start;
+    start = now();
+    for (int n = 0; n < iterations; n++)
+      blit_rect(blit, pixel, rect);
+    double blit_time = now() - start;
+    printf("%-16s %12.1f %12.1f %7.2fx %9d\n", shapes[i].name, pixels / fill_time, pixels / blit_time, blit_time / fill_time, max_diff);
+  }
+
+  SDL_FreeSurface(fill);
+  SDL_FreeSurface(blit);
+  SDL_FreeSurface(pixel);
+  ren_free_window_resources(&window_renderer);
+  SDL_DestroyWindow(window);
+  SDL_Quit();
+  return 0;
+}
@@ -0,0 +1,261 @@
+/*
+** Replays render commands recorded with renderer.record_commands (core:toggle-render-recording)
+** through rencache, on an offscreen window of SDL's dummy video driver, and reports how long
+** frames took. Build it from the repository root against the same libraries as lite-xl, eg.
+**
+**   gcc -O3 -Isrc resources/rencache_bench.c src/renderer.c src/renwindow.c src/rencache.c \
+**     `pkg-config --cflags --libs sdl2 freetype2 lua5.4` -lm -o rencache_bench
+**
+** usage: rencache_bench [-p passes] [-t render threads] recording.lxrc
+** the first pass loads fonts and fills the glyph caches, and is only counted when it's the only one.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "rencache.h"
+#include "renwindow.h"
+
+#define LOADED_FONTS_MAX 256
+
+typedef struct {
+  char *path;
+  float size;
+  uint8_t options[4];
+  RenFont *font;
+} LoadedFont;
+
+static LoadedFont loaded_fonts[LOADED_FONTS_MAX];
+static int loaded_fonts_count;
+
+typedef struct {
+  const uint8_t *data, *end;
+} Reader;
+
+static bool read_bytes(Reader *r, void *dst, size_t size) {
+  if ((size_t)(r->end - r->data) < size) {
+    return false;
+  }
+  memcpy(dst, r->data, size);
+  r->data += size;
+  return true;
+}
+
+/* fonts are loaded once per description, tab size included, for all frames and passes */
+static RenFont* load_font(const char *path, float size, const uint8_t options[4]) {
+  for (int i = 0; i < loaded_fonts_count; i++) {
+    LoadedFont *f = &loaded_fonts[i];
+    if (f->size == size && memcmp(f->options, options, sizeof(f->options)) == 0 && strcmp(f->path, path) == 0) {
+      return f->font;
+    }
+  }
+  if (loaded_fonts_count == LOADED_FONTS_MAX) {
+    return NULL;
+  }
+  RenFont *font = ren_font_load(&window_renderer, path, size, options[0], options[1], options[2]);
+  if (!font) {
+    return NULL;
+  }
+  RenFont *group[FONT_FALLBACK_MAX] = { font };
+  ren_font_group_set_tab_size(group, options[3]);
+  loaded_fonts[loaded_fonts_count++] = (LoadedFont) { strdup(path), size, { options[0], options[1], options[2], options[3] }, font };
+  return font;
+}
+
+/* fonts are loaded from the paths they were recorded with; packed fonts of all-in-one builds aren't available */
+const char* retrieve_internal_file(UNUSED const char* path, UNUSED int* size) {
+  return NULL;
+}
+
+static int compare_times(const void *a, const void *b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return x < y ? -1 : x > y;
+}
+
+static double now(void) {
+  return SDL_GetPerformanceCounter() / (double) SDL_GetPerformanceFrequency();
+}
+
+int main(int argc, char **argv) {
+  int passes = 3, threads = -1;
+  const char *path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      passes = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else {
+      path = argv[i];
+    }
+  }
+  if (!path || passes < 1) {
+    fprintf(stderr, "usage: %s [-p passes] [-t render threads] recording.lxrc\n", argv[0]);
+    return 1;
+  }
+
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "error: can't open %s\n", path);
+    return 1;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  uint8_t *recording = malloc(length > 0 ? length : 1);
+  if (!recording || length < 0 || fread(recording, 1, length, file) != (size_t)length) {
+    fprintf(stderr, "error: can't read %s\n", path);
+    return 1;
+  }
+  fclose(file);
+  size_t magic_len = strlen(RENCACHE_RECORD_MAGIC);
+  if ((size_t)length < magic_len || memcmp(recording, RENCACHE_RECORD_MAGIC, magic_len) != 0) {
+    fprintf(stderr, "error: %s is not a render command recording\n", path);
+    return 1;
+  }
+
+  SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+  if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+    fprintf(stderr, "error: can't initialize SDL: %s\n", SDL_GetError());
+    return 1;
+  }
+  SDL_Window *window = SDL_CreateWindow("", 0, 0, 800, 600, SDL_WINDOW_HIDDEN);
+  if (!window) {
+    fprintf(stderr, "error: can't create a window: %s\n", SDL_GetError());
+    return 1;
+  }
+  ren_init(window);
+  if (threads >= 0) {
+    rencache_set_thread_count(threads);
+  }
+
+  int frames_max = 0, frames = 0, width = 0, height = 0;
+  double *times = NULL, total = 0, pixels = 0;
+  RenFont *fonts[LOADED_FONTS_MAX] = { 0 };
+  char *text = NULL;
+  size_t text_capacity = 0;
+  for (int pass = 0; pass < passes; pass++) {
+    bool counted = pass > 0 || passes == 1;
+    Reader r = { recording + magic_len, recording + length };
+    rencache_invalidate();
+    double pass_start = now();
+    uint8_t kind;
+    while (read_bytes(&r, &kind, 1)) {
+      bool ok = true;
+      switch (kind) {
+        case RENCACHE_RECORD_FRAME: {
+          int w, h;
+          ok = read_bytes(&r, &w, sizeof(w)) && read_bytes(&r, &h, sizeof(h));
+          if (ok && (w != width || h != height)) {
+            SDL_SetWindowSize(window, w, h);
+            ren_resize_window(&window_renderer);
+            width = w, height = h;
+          }
+          rencache_begin_frame(&window_renderer);
+          break;
+        }
+        case RENCACHE_RECORD_FONT: {
+          uint32_t id, path_len;
+          float size;
+          uint8_t options[4];
+          char font_path[4096];
+          ok = read_bytes(&r, &id, sizeof(id)) && read_bytes(&r, &size, sizeof(size)) && read_bytes(&r, options, sizeof(options))
+            && read_bytes(&r, &path_len, sizeof(path_len)) && path_len < sizeof(font_path) && read_bytes(&r, font_path, path_len)
+            && id < LOADED_FONTS_MAX;
+          if (ok) {
+            font_path[path_len] = '\0';
+            if (!(fonts[id] = load_font(font_path, size, options))) {
+              fprintf(stderr, "error: can't load font %s\n", font_path);
+              return 1;
+            }
+          }
+          break;
+        }
+        case RENCACHE_RECORD_CLIP: {
+          RenRect rect;
+          if ((ok = read_bytes(&r, &rect, sizeof(rect))))
+            rencache_set_clip_rect(rect);
+          break;
+        }
+        case RENCACHE_RECORD_RECT: {
+          RenRect rect;
+          RenColor color;
+          if ((ok = read_bytes(&r, &rect, sizeof(rect)) && read_bytes(&r, &color, sizeof(color))))
+            rencache_draw_rect(rect, color);
+          break;
+        }
+        case RENCACHE_RECORD_TEXT: {
+          double x;
+          int y;
+          RenColor color;
+          uint32_t count, len, ids[FONT_FALLBACK_MAX];
+          RenFont *group[FONT_FALLBACK_MAX] = { 0 };
+          ok = read_bytes(&r, &x, sizeof(x)) && read_bytes(&r, &y, sizeof(y)) && read_bytes(&r, &color, sizeof(color))
+            && read_bytes(&r, &count, sizeof(count)) && count > 0 && count <= FONT_FALLBACK_MAX
+            && read_bytes(&r, ids, count * sizeof(uint32_t)) && read_bytes(&r, &len, sizeof(len)) && len <= (size_t)(r.end - r.data);
+          for (uint32_t i = 0; ok && i < count; i++)
+            ok = ids[i] < LOADED_FONTS_MAX && (group[i] = fonts[ids[i]]);
+          /* rencache copies the text along with its terminator */
+          if (ok && len >= text_capacity) {
+            text_capacity = len + 1;
+            if (!(text = realloc(text, text_capacity))) {
+              fprintf(stderr, "error: out of memory\n");
+              return 1;
+            }
+          }
+          if (ok && read_bytes(&r, text, len)) {
+            text[len] = '\0';
+            rencache_draw_text(&window_renderer, group, text, len, x, y, color);
+          }
+          break;
+        }
+        case RENCACHE_RECORD_END_FRAME: {
+          double start = now();
+          rencache_end_frame(&window_renderer);
+          if (counted) {
+            if (frames == frames_max) {
+              frames_max = frames_max ? frames_max * 2 : 256;
+              times = realloc(times, frames_max * sizeof(double));
+              if (!times) {
+                fprintf(stderr, "error: out of memory\n");
+                return 1;
+              }
+            }
+            times[frames++] = now() - start;
+            RenCacheStats stats;
+            rencache_get_stats(&stats);
+            pixels += stats.pixels;
+          }
+          break;
+        }
+        default:
+          ok = false;
+      }
+      if (!ok) {
+        fprintf(stderr, "error: %s is truncated or corrupt\n", path);
+        return 1;
+      }
+    }
+    if (counted) {
+      total += now() - pass_start;
+    }
+  }
+
+  if (frames == 0) {
+    fprintf(stderr, "error: %s has no frames\n", path);
+    return 1;
+  }
+  double sum = 0;
+  for (int i = 0; i < frames; i++)
+    sum += times[i];
+  qsort(times, frames, sizeof(double), compare_times);
+  printf("%d frames, %.1f frames/s, %.0f px redrawn per frame\n", frames, frames / total, pixels / frames);
+  printf("end_frame ms: mean %.3f  p50 %.3f  p95 %.3f  p99 %.3f  max %.3f\n", sum / frames * 1000,
+         times[frames / 2] * 1000, times[frames * 95 / 100] * 1000, times[frames * 99 / 100] * 1000, times[frames - 1] * 1000);
+  free(times);
+  free(text);
+  free(recording);
+  ren_free_window_resources(&window_renderer);
+  SDL_DestroyWindow(window);
+  SDL_Quit();
+  return 0;
+}
@@ -4,11 +4,18 @@
 #include <lua.h>
 #include <lauxlib.h>
 #include <lualib.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 #define API_TYPE_FONT "Font"
 #define API_TYPE_PROCESS "Process"
 #define API_TYPE_DIRMONITOR "Dirmonitor"
 #define API_TYPE_NATIVE_PLUGIN "NativePlugin"
+#define API_TYPE_SCAN "Scan"
+#define API_TYPE_IGNORE_RULES "IgnoreRules"
+#define API_TYPE_PROJECT_INDEX "ProjectIndex"
+#define API_TYPE_PROJECT_TREE "ProjectTree"
+#define API_TYPE_SEARCH "Search"
 
 #if LUA_VERSION_NUM < 502
   #define lua_rawlen lua_objlen
@@ -18,4 +25,34 @@
 
 void api_load_libs(lua_State *L);
 
+/* shared between system and scan */
+int path_compare(const char *path1, size_t len1, int type1, const char *path2, size_t len2, int type2);
+int f_scan_tree(lua_State *L);
+int f_load_project_index(lua_State *L);
+int f_save_project_index(lua_State *L);
+
+/* ignore rules, shared between system and scan */
+typedef struct IgnoreRules IgnoreRules;
+typedef struct IgnoreDir IgnoreDir;
+IgnoreRules *ignore_rules_arg(lua_State *L, int idx, const char *root);
+IgnoreDir *ignore_dir_read(const IgnoreRules *rules, const IgnoreDir *parent, const char *root, const char *path, size_t path_len);
+void ignore_dirs_push(IgnoreDir **list, IgnoreDir *dir);
+void ignore_dirs_free(IgnoreDir *list);
+int ignore_rules_match(const IgnoreRules *rules, const IgnoreDir *dir, const char *fullname, size_t fullname_len, const char *name, size_t name_len, int is_dir);
+int f_ignore_rules(lua_State *L);
+
+/* project trees, shared between system and scan */
+typedef struct ProjectTree ProjectTree;
+typedef struct TreeNode TreeNode;
+typedef void (*project_tree_visitor)(void *data, int depth, const char *name, size_t name_len, bool dir, bool symlink, int64_t size, int64_t modified);
+ProjectTree *project_tree_new(lua_State *L);
+ProjectTree *project_tree_check(lua_State *L, int idx);
+bool project_tree_add(ProjectTree *tree, const char *dir, size_t dir_len, const char *name, size_t name_len, bool is_dir, bool symlink, int64_t size, int64_t modified);
+void project_tree_walk(const ProjectTree *tree, project_tree_visitor visit, void *data);
+uint32_t project_tree_count(const ProjectTree *tree);
+int f_project_tree(lua_State *L);
+
+/* project search, shared between system and search */
+int f_search_files(lua_State *L);
+
 #endif
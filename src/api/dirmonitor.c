@@ -4,21 +4,39 @@
 #include <string.h>
 #include <stdbool.h>
 
-static unsigned int DIR_EVENT_TYPE = 0;
+/* backends that can't wait for changes are asked again after this many ms */
+#define DIRMONITOR_IDLE_DELAY 100
+
+unsigned int DIR_EVENT_TYPE = 0;
 
 struct dirmonitor {
   SDL_Thread* thread;
   SDL_mutex* mutex;
+  SDL_cond* checked;
   char buffer[64512];
   volatile int length;
   struct dirmonitor_internal* internal;
 };
 
 
+/* what happened to an entry, for backends that can tell; the others only report which watch changed */
+enum { DIRMONITOR_CHANGE_CREATE, DIRMONITOR_CHANGE_DELETE, DIRMONITOR_CHANGE_MODIFY, DIRMONITOR_CHANGE_MOVE, DIRMONITOR_CHANGE_OVERFLOW };
+static const char* dirmonitor_change_names[] = { "create", "delete", "modify", "move", "overflow" };
+
+struct dirmonitor_change {
+  int kind;
+  const char* name;       /* in the watched directory, NULL for the watched path itself */
+  int from_watch_id;      /* for moves, where the entry was */
+  const char* from_name;
+};
+
+typedef int (*dirmonitor_callback)(int, const char*, const struct dirmonitor_change*, void*);
+
 struct dirmonitor_internal* init_dirmonitor();
 void deinit_dirmonitor(struct dirmonitor_internal*);
+void free_dirmonitor(struct dirmonitor_internal*);
 int get_changes_dirmonitor(struct dirmonitor_internal*, char*, int);
-int translate_changes_dirmonitor(struct dirmonitor_internal*, char*, int, int (*)(int, const char*, void*), void*);
+int translate_changes_dirmonitor(struct dirmonitor_internal*, char*, int, dirmonitor_callback, void*);
 int add_dirmonitor(struct dirmonitor_internal*, const char*);
 void remove_dirmonitor(struct dirmonitor_internal*, int);
 int get_mode_dirmonitor();
@@ -48,33 +66,57 @@ int get_mode_dirmonitor();
   #include "dirmonitor/dummy.c"
 #endif
 
-static int f_check_dir_callback(int watch_id, const char* path, void* L) {
+static int f_check_dir_callback(int watch_id, const char* path, const struct dirmonitor_change* change, void* L) {
   lua_pushvalue(L, -1);
   if (path)
     lua_pushlstring(L, path, watch_id);
   else
     lua_pushnumber(L, watch_id);
-  lua_call(L, 1, 1);
+  int nargs = 1;
+  if (change) {
+    if (change->name)
+      lua_pushstring(L, change->name);
+    else
+      lua_pushnil(L);
+    lua_pushstring(L, dirmonitor_change_names[change->kind]);
+    nargs += 2;
+    if (change->kind == DIRMONITOR_CHANGE_MOVE) {
+      lua_pushnumber(L, change->from_watch_id);
+      lua_pushstring(L, change->from_name);
+      nargs += 2;
+    }
+  }
+  lua_call(L, nargs, 1);
   int result = lua_toboolean(L, -1);
   lua_pop(L, 1);
   return !result;
 }
 
 
+/* waits in the backend for changes, and posts a single event for each batch of them; until
+   the batch is checked, new changes queue up in the backend and are reported together next */
 static int dirmonitor_check_thread(void* data) {
   struct dirmonitor* monitor = data;
+  SDL_LockMutex(monitor->mutex);
   while (monitor->length >= 0) {
-    if (monitor->length == 0) {
-      int result = get_changes_dirmonitor(monitor->internal, monitor->buffer, sizeof(monitor->buffer));
-      SDL_LockMutex(monitor->mutex);
-      if (monitor->length == 0)
-        monitor->length = result;
-      SDL_UnlockMutex(monitor->mutex);
+    if (monitor->length > 0) {
+      SDL_CondWait(monitor->checked, monitor->mutex);
+      continue;
+    }
+    SDL_UnlockMutex(monitor->mutex);
+    int result = get_changes_dirmonitor(monitor->internal, monitor->buffer, sizeof(monitor->buffer));
+    SDL_LockMutex(monitor->mutex);
+    if (monitor->length != 0)
+      continue;
+    monitor->length = result;
+    if (result > 0) {
+      SDL_Event event = { .type = DIR_EVENT_TYPE };
+      SDL_PushEvent(&event);
+    } else if (result == 0) {
+      SDL_CondWaitTimeout(monitor->checked, monitor->mutex, DIRMONITOR_IDLE_DELAY);
     }
-    SDL_Delay(1);
-    SDL_Event event = { .type = DIR_EVENT_TYPE };
-    SDL_PushEvent(&event);
   }
+  SDL_UnlockMutex(monitor->mutex);
   return 0;
 }
 
@@ -86,6 +128,7 @@ static int f_dirmonitor_new(lua_State* L) {
   luaL_setmetatable(L, API_TYPE_DIRMONITOR);
   memset(monitor, 0, sizeof(struct dirmonitor));
   monitor->mutex = SDL_CreateMutex();
+  monitor->checked = SDL_CreateCond();
   monitor->internal = init_dirmonitor();
   return 1;
 }
@@ -95,10 +138,12 @@ static int f_dirmonitor_gc(lua_State* L) {
   struct dirmonitor* monitor = luaL_checkudata(L, 1, API_TYPE_DIRMONITOR);
   SDL_LockMutex(monitor->mutex);
   monitor->length = -1;
+  SDL_CondSignal(monitor->checked);
   deinit_dirmonitor(monitor->internal);
   SDL_UnlockMutex(monitor->mutex);
   SDL_WaitThread(monitor->thread, NULL);
-  free(monitor->internal);
+  free_dirmonitor(monitor->internal);
+  SDL_DestroyCond(monitor->checked);
   SDL_DestroyMutex(monitor->mutex);
   return 0;
 }
@@ -125,8 +170,10 @@ static int f_dirmonitor_check(lua_State* L) {
   if (monitor->length < 0)
     lua_pushnil(L);
   else if (monitor->length > 0) {
-    if (translate_changes_dirmonitor(monitor->internal, monitor->buffer, monitor->length, f_check_dir_callback, L) == 0)
+    if (translate_changes_dirmonitor(monitor->internal, monitor->buffer, monitor->length, f_check_dir_callback, L) == 0) {
       monitor->length = 0;
+      SDL_CondSignal(monitor->checked);
+    }
     lua_pushboolean(L, 1);
   } else
     lua_pushboolean(L, 0);
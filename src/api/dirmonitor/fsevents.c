@@ -62,6 +62,11 @@ void deinit_dirmonitor(struct dirmonitor_internal* monitor) {
 }
 
 
+void free_dirmonitor(struct dirmonitor_internal* monitor) {
+  free(monitor);
+}
+
+
 static void stream_callback(
   ConstFSEventStreamRef streamRef,
   void* monitor_ptr,
@@ -124,13 +129,13 @@ int translate_changes_dirmonitor(
   struct dirmonitor_internal* monitor,
   char* buffer,
   int buffer_size,
-  int (*change_callback)(int, const char*, void*),
+  dirmonitor_callback change_callback,
   void* L
 ) {
   SDL_LockMutex(monitor->lock);
   if (monitor->count > 0) {
     for (size_t i = 0; i<monitor->count; i++) {
-      change_callback(strlen(monitor->changes[i]), monitor->changes[i], L);
+      change_callback(strlen(monitor->changes[i]), monitor->changes[i], NULL, L);
       free(monitor->changes[i]);
     }
     free(monitor->changes);
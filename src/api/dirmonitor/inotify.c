@@ -3,6 +3,13 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <stdbool.h>
+
+/* once changes arrive, more are waited for this long so that bursts are reported together */
+#define INOTIFY_COALESCE_MS 10
 
 
 struct dirmonitor_internal {
@@ -22,23 +29,141 @@ struct dirmonitor_internal* init_dirmonitor() {
 }
 
 
+// wakes the thread; the descriptors are only closed once it's done with them.
 void deinit_dirmonitor(struct dirmonitor_internal* monitor) {
+  while (write(monitor->sig[1], "", 1) < 0 && errno == EINTR);
+}
+
+
+void free_dirmonitor(struct dirmonitor_internal* monitor) {
   close(monitor->fd);
   close(monitor->sig[0]);
   close(monitor->sig[1]);
+  free(monitor);
 }
 
 
 int get_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int length) {
   struct pollfd fds[2] = { { .fd = monitor->fd, .events = POLLIN | POLLERR, .revents = 0 }, { .fd = monitor->sig[0], .events = POLLIN | POLLERR, .revents = 0 } };
-  poll(fds, 2, -1);
-  return read(monitor->fd, buffer, length);
+  int total = 0, timeout = -1;
+  while (length - total >= (int)(sizeof(struct inotify_event) + NAME_MAX + 1)) {
+    int ready = poll(fds, 2, timeout);
+    if (ready < 0 && errno == EINTR)
+      continue;
+    if (ready < 0 || fds[1].revents)
+      return -1;
+    if (ready == 0)
+      break;
+    int result = read(monitor->fd, buffer + total, length - total);
+    if (result < 0 && errno != EINTR)
+      return total > 0 ? total : -1;
+    if (result > 0)
+      total += result;
+    timeout = INOTIFY_COALESCE_MS;
+  }
+  return total;
+}
+
+
+#define next_event(info) ((struct inotify_event*)((char*)(info) + sizeof(struct inotify_event) + (info)->len))
+
+struct inotify_change {
+  struct dirmonitor_change change;
+  int watch_id;
+  bool merged;
+};
+
+/* latest change of each entry in a batch, so that the ones it supersedes can be dropped */
+struct inotify_latest {
+  int watch_id;
+  const char* name;
+  int change;
+};
+
+static int find_latest(struct inotify_latest* latest, int size, int watch_id, const char* name) {
+  unsigned int hash = 2166136261u ^ (unsigned int)watch_id;
+  for (const char* c = name; *c; c++)
+    hash = (hash ^ (unsigned char)*c) * 16777619u;
+  int i = hash & (size - 1);
+  while (latest[i].name && (latest[i].watch_id != watch_id || strcmp(latest[i].name, name) != 0))
+    i = (i + 1) & (size - 1);
+  return i;
+}
+
+static void add_change(struct inotify_change* changes, int* count, struct inotify_latest* latest, int size, int watch_id, const char* name, int kind) {
+  struct inotify_latest* entry = &latest[find_latest(latest, size, watch_id, name)];
+  /* a burst of changes to an entry is reported as the last one, except that modifying what was
+     just created is still a creation; moves are kept, so that what comes after them applies */
+  if (entry->name && changes[entry->change].change.kind != DIRMONITOR_CHANGE_MOVE) {
+    struct inotify_change* previous = &changes[entry->change];
+    previous->merged = true;
+    if (previous->change.kind == DIRMONITOR_CHANGE_CREATE && kind == DIRMONITOR_CHANGE_MODIFY)
+      kind = DIRMONITOR_CHANGE_CREATE;
+  }
+  changes[*count] = (struct inotify_change) { { kind, name, 0, NULL }, watch_id, false };
+  *entry = (struct inotify_latest) { watch_id, name, (*count)++ };
 }
 
 
-int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int length, int (*change_callback)(int, const char*, void*), void* data) {
-  for (struct inotify_event* info = (struct inotify_event*)buffer; (char*)info < buffer + length; info = (struct inotify_event*)((char*)info + sizeof(struct inotify_event)))
-    change_callback(info->wd, NULL, data);
+int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int length, dirmonitor_callback change_callback, void* data) {
+  struct inotify_event* end = (struct inotify_event*)(buffer + length);
+  int count = 0, size = 16;
+  for (struct inotify_event* info = (struct inotify_event*)buffer; info < end; info = next_event(info))
+    count++;
+  if (count == 0)
+    return 0;
+  while (size < count * 2)
+    size *= 2;
+  struct inotify_change* changes = malloc(count * sizeof(struct inotify_change));
+  struct inotify_latest* latest = calloc(size, sizeof(struct inotify_latest));
+  if (!changes || !latest) {
+    free(changes);
+    free(latest);
+    return -1;
+  }
+  count = 0;
+  bool overflow = false;
+  for (struct inotify_event* info = (struct inotify_event*)buffer; info < end; info = next_event(info)) {
+    const char* name = info->len ? info->name : "";
+    if (info->mask & IN_Q_OVERFLOW) {
+      overflow = true;
+    } else if (info->mask & IN_MOVED_FROM) {
+      /* the other half of a rename comes right after, unless it left the watched directories */
+      struct inotify_event* to = next_event(info);
+      while (to < end && !((to->mask & IN_MOVED_TO) && to->cookie == info->cookie))
+        to = next_event(to);
+      if (to < end) {
+        to->mask = 0;
+        changes[count] = (struct inotify_change) { { DIRMONITOR_CHANGE_MOVE, to->len ? to->name : "", info->wd, name }, to->wd, false };
+        latest[find_latest(latest, size, info->wd, name)] = (struct inotify_latest) { info->wd, name, count };
+        latest[find_latest(latest, size, to->wd, changes[count].change.name)] = (struct inotify_latest) { to->wd, changes[count].change.name, count };
+        count++;
+      } else {
+        add_change(changes, &count, latest, size, info->wd, name, DIRMONITOR_CHANGE_DELETE);
+      }
+    } else if (info->mask & (IN_CREATE | IN_MOVED_TO)) {
+      add_change(changes, &count, latest, size, info->wd, name, DIRMONITOR_CHANGE_CREATE);
+    } else if (info->mask & IN_DELETE) {
+      add_change(changes, &count, latest, size, info->wd, name, DIRMONITOR_CHANGE_DELETE);
+    } else if (info->mask & IN_MODIFY) {
+      add_change(changes, &count, latest, size, info->wd, name, DIRMONITOR_CHANGE_MODIFY);
+    }
+  }
+  if (overflow) {
+    /* events were dropped, everything has to be checked again */
+    struct dirmonitor_change change = { DIRMONITOR_CHANGE_OVERFLOW, NULL, 0, NULL };
+    change_callback(-1, NULL, &change, data);
+  } else {
+    for (int i = 0; i < count; i++) {
+      if (changes[i].merged)
+        continue;
+      if (!changes[i].change.name[0])
+        changes[i].change.name = NULL;
+      change_callback(changes[i].watch_id, NULL, &changes[i].change, data);
+    }
+  }
+  free(changes);
+  free(latest);
   return 0;
 }
 
@@ -22,6 +22,11 @@ void deinit_dirmonitor(struct dirmonitor_internal* monitor) {
 }
 
 
+void free_dirmonitor(struct dirmonitor_internal* monitor) {
+  free(monitor);
+}
+
+
 int get_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int buffer_size) {
   int nev = kevent(monitor->fd, NULL, 0, (struct kevent*)buffer, buffer_size / sizeof(kevent), NULL);
   if (nev == -1)
@@ -32,9 +37,9 @@ int get_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, in
 }
 
 
-int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int buffer_size, int (*change_callback)(int, const char*, void*), void* data) {
+int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int buffer_size, dirmonitor_callback change_callback, void* data) {
   for (struct kevent* info = (struct kevent*)buffer; (char*)info < buffer + buffer_size; info = (struct kevent*)(((char*)info) + sizeof(kevent)))
-    change_callback(info->ident, NULL, data);
+    change_callback(info->ident, NULL, NULL, data);
   return 0;
 }
 
@@ -38,11 +38,16 @@ void deinit_dirmonitor(struct dirmonitor_internal* monitor) {
 }
 
 
-int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int buffer_size, int (*change_callback)(int, const char*, void*), void* data) {
+void free_dirmonitor(struct dirmonitor_internal* monitor) {
+  free(monitor);
+}
+
+
+int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int buffer_size, dirmonitor_callback change_callback, void* data) {
   for (FILE_NOTIFY_INFORMATION* info = (FILE_NOTIFY_INFORMATION*)buffer; (char*)info < buffer + buffer_size; info = (FILE_NOTIFY_INFORMATION*)(((char*)info) + info->NextEntryOffset)) {
     char transform_buffer[PATH_MAX*4];
     int count = WideCharToMultiByte(CP_UTF8, 0, (WCHAR*)info->FileName, info->FileNameLength, transform_buffer, PATH_MAX*4 - 1, NULL, NULL);
-    change_callback(count, transform_buffer, data);
+    change_callback(count, transform_buffer, NULL, data);
     if (!info->NextEntryOffset)
       break;
   }
@@ -0,0 +1,928 @@
+#include "api.h"
+
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+  LPWSTR utfconv_utf8towc(const char *str);
+  #define PATHSEP '\\'
+#else
+  #define PATHSEP '/'
+#endif
+
+#ifndef PATH_MAX
+  #define PATH_MAX 4096
+#endif
+
+/* larger .gitignore and .ignore files are not read */
+#define IGNORE_FILE_MAX (4 * 1024 * 1024)
+
+/*
+** Ignore rules decide which entries of a project are left out. The Lua patterns of
+** config.ignore_files always apply. With vcs enabled, so do the .ignore and .gitignore files of
+** each directory, for what's below it: the nearest directory with a matching rule decides, .ignore
+** before .gitignore, and in a file the last matching rule wins, with git's glob syntax and '!'
+** rules to include entries back.
+** Rules are compiled once per set: those that are plain names or extensions go in hash tables,
+** so checking an entry costs two lookups and a pass over the remaining rules only.
+*/
+
+/* config.ignore_files are matched by a copy of Lua's matcher that scan workers can run */
+
+#define L_ESC '%'
+#define MAXCCALLS 200
+#define MAXCAPTURES 32
+#define CAP_UNFINISHED (-1)
+#define CAP_POSITION (-2)
+
+typedef struct {
+  const char *src_init, *src_end, *p_end;
+  int matchdepth, level;
+  bool error;
+  struct {
+    const char *init;
+    ptrdiff_t len;
+  } capture[MAXCAPTURES];
+} MatchState;
+
+static const char *match(MatchState *ms, const char *s, const char *p);
+
+static const char *match_error(MatchState *ms) {
+  ms->error = true;
+  return NULL;
+}
+
+static int check_capture(MatchState *ms, int l) {
+  l -= '1';
+  if (l < 0 || l >= ms->level || ms->capture[l].len == CAP_UNFINISHED) {
+    ms->error = true;
+    return -1;
+  }
+  return l;
+}
+
+static int capture_to_close(MatchState *ms) {
+  for (int level = ms->level - 1; level >= 0; level--)
+    if (ms->capture[level].len == CAP_UNFINISHED)
+      return level;
+  ms->error = true;
+  return -1;
+}
+
+static const char *class_end(MatchState *ms, const char *p) {
+  switch (*p++) {
+    case L_ESC:
+      return p == ms->p_end ? match_error(ms) : p + 1;
+    case '[':
+      if (*p == '^') p++;
+      do {
+        if (p == ms->p_end)
+          return match_error(ms);
+        if (*(p++) == L_ESC && p < ms->p_end)
+          p++;
+      } while (*p != ']');
+      return p + 1;
+    default:
+      return p;
+  }
+}
+
+static int match_class(int c, int cl) {
+  int res;
+  switch (tolower(cl)) {
+    case 'a': res = isalpha(c); break;
+    case 'c': res = iscntrl(c); break;
+    case 'd': res = isdigit(c); break;
+    case 'g': res = isgraph(c); break;
+    case 'l': res = islower(c); break;
+    case 'p': res = ispunct(c); break;
+    case 's': res = isspace(c); break;
+    case 'u': res = isupper(c); break;
+    case 'w': res = isalnum(c); break;
+    case 'x': res = isxdigit(c); break;
+    default: return cl == c;
+  }
+  return isupper(cl) ? !res : res;
+}
+
+static int match_bracket_class(int c, const char *p, const char *ec) {
+  int sig = 1;
+  if (*(p + 1) == '^') {
+    sig = 0;
+    p++;
+  }
+  while (++p < ec) {
+    if (*p == L_ESC) {
+      p++;
+      if (match_class(c, (unsigned char)*p))
+        return sig;
+    } else if (*(p + 1) == '-' && p + 2 < ec) {
+      p += 2;
+      if ((unsigned char)*(p - 2) <= c && c <= (unsigned char)*p)
+        return sig;
+    } else if ((unsigned char)*p == c) {
+      return sig;
+    }
+  }
+  return !sig;
+}
+
+static int single_match(MatchState *ms, const char *s, const char *p, const char *ep) {
+  if (s >= ms->src_end)
+    return 0;
+  int c = (unsigned char)*s;
+  switch (*p) {
+    case '.': return 1;
+    case L_ESC: return match_class(c, (unsigned char)*(p + 1));
+    case '[': return match_bracket_class(c, p, ep - 1);
+    default: return (unsigned char)*p == c;
+  }
+}
+
+static const char *match_balance(MatchState *ms, const char *s, const char *p) {
+  if (p >= ms->p_end - 1)
+    return match_error(ms);
+  if (s >= ms->src_end || *s != *p)
+    return NULL;
+  int b = *p, e = *(p + 1), cont = 1;
+  while (++s < ms->src_end) {
+    if (*s == e) {
+      if (--cont == 0)
+        return s + 1;
+    } else if (*s == b) {
+      cont++;
+    }
+  }
+  return NULL;
+}
+
+static const char *max_expand(MatchState *ms, const char *s, const char *p, const char *ep) {
+  ptrdiff_t i = 0;
+  while (single_match(ms, s + i, p, ep))
+    i++;
+  for (; i >= 0 && !ms->error; i--) {
+    const char *res = match(ms, s + i, ep + 1);
+    if (res)
+      return res;
+  }
+  return NULL;
+}
+
+static const char *min_expand(MatchState *ms, const char *s, const char *p, const char *ep) {
+  while (!ms->error) {
+    const char *res = match(ms, s, ep + 1);
+    if (res)
+      return res;
+    if (!single_match(ms, s, p, ep))
+      return NULL;
+    s++;
+  }
+  return NULL;
+}
+
+static const char *start_capture(MatchState *ms, const char *s, const char *p, int what) {
+  if (ms->level >= MAXCAPTURES)
+    return match_error(ms);
+  ms->capture[ms->level].init = s;
+  ms->capture[ms->level].len = what;
+  ms->level++;
+  const char *res = match(ms, s, p);
+  if (!res)
+    ms->level--;
+  return res;
+}
+
+static const char *end_capture(MatchState *ms, const char *s, const char *p) {
+  int l = capture_to_close(ms);
+  if (l < 0)
+    return NULL;
+  ms->capture[l].len = s - ms->capture[l].init;
+  const char *res = match(ms, s, p);
+  if (!res)
+    ms->capture[l].len = CAP_UNFINISHED;
+  return res;
+}
+
+static const char *match_capture(MatchState *ms, const char *s, int l) {
+  if ((l = check_capture(ms, l)) < 0)
+    return NULL;
+  size_t len = ms->capture[l].len;
+  if ((size_t)(ms->src_end - s) >= len && memcmp(ms->capture[l].init, s, len) == 0)
+    return s + len;
+  return NULL;
+}
+
+static const char *match(MatchState *ms, const char *s, const char *p) {
+  if (ms->error || ms->matchdepth-- == 0)
+    return match_error(ms);
+  init:
+  if (p != ms->p_end) {
+    switch (*p) {
+      case '(':
+        s = *(p + 1) == ')' ? start_capture(ms, s, p + 2, CAP_POSITION) : start_capture(ms, s, p + 1, CAP_UNFINISHED);
+        break;
+      case ')':
+        s = end_capture(ms, s, p + 1);
+        break;
+      case '$':
+        if (p + 1 != ms->p_end)
+          goto dflt;
+        s = s == ms->src_end ? s : NULL;
+        break;
+      case L_ESC:
+        switch (*(p + 1)) {
+          case 'b':
+            s = match_balance(ms, s, p + 2);
+            if (s) {
+              p += 4;
+              goto init;
+            }
+            break;
+          case 'f': {
+            p += 2;
+            if (*p != '[')
+              return match_error(ms);
+            const char *ep = class_end(ms, p);
+            if (!ep)
+              return NULL;
+            char previous = s == ms->src_init ? '\0' : *(s - 1);
+            if (!match_bracket_class((unsigned char)previous, p, ep - 1) && match_bracket_class((unsigned char)*s, p, ep - 1)) {
+              p = ep;
+              goto init;
+            }
+            s = NULL;
+            break;
+          }
+          case '0': case '1': case '2': case '3': case '4':
+          case '5': case '6': case '7': case '8': case '9':
+            s = match_capture(ms, s, (unsigned char)*(p + 1));
+            if (s) {
+              p += 2;
+              goto init;
+            }
+            break;
+          default:
+            goto dflt;
+        }
+        break;
+      default: dflt: {
+        const char *ep = class_end(ms, p);
+        if (!ep)
+          return NULL;
+        if (!single_match(ms, s, p, ep)) {
+          if (*ep == '*' || *ep == '?' || *ep == '-') {
+            p = ep + 1;
+            goto init;
+          }
+          s = NULL;
+        } else {
+          switch (*ep) {
+            case '?': {
+              const char *res = match(ms, s + 1, ep + 1);
+              if (res) {
+                s = res;
+              } else {
+                p = ep + 1;
+                goto init;
+              }
+              break;
+            }
+            case '+': s = max_expand(ms, s + 1, p, ep); break;
+            case '*': s = max_expand(ms, s, p, ep); break;
+            case '-': s = min_expand(ms, s, p, ep); break;
+            default:
+              s++;
+              p = ep;
+              goto init;
+          }
+        }
+        break;
+      }
+    }
+  }
+  ms->matchdepth++;
+  return s;
+}
+
+/* like string.find(s, pattern) ~= nil; s and pattern must be NUL terminated, malformed patterns never match */
+static bool pattern_find(const char *s, size_t len, const char *pattern, size_t pattern_len) {
+  bool anchor = *pattern == '^';
+  const char *p = pattern + anchor, *s1 = s;
+  MatchState ms = { s, s + len, pattern + pattern_len, MAXCCALLS, 0, false };
+  do {
+    ms.level = 0;
+    ms.matchdepth = MAXCCALLS;
+    if (match(&ms, s1, p))
+      return true;
+  } while (s1++ < ms.src_end && !anchor && !ms.error);
+  return false;
+}
+
+
+typedef struct {
+  char *pattern;
+  size_t len;
+  bool use_path, match_dir;
+  char *key;              /* the name or extension it's looked up by, if it's that simple */
+  bool extension;
+} IgnorePattern;
+
+typedef struct {
+  char *pattern;          /* without the leading '!' and '/', and the trailing '/' */
+  size_t len;
+  bool negate, dir_only, anchored;
+} IgnoreGlob;
+
+typedef struct {
+  const char *key;
+  size_t len;
+  int rule, dir_rule;     /* last rule with this key, and last one that only applies to directories */
+} IgnoreSlot;
+
+typedef struct {
+  IgnoreSlot *slots;
+  int size;               /* a power of two, at least twice the number of keys, or 0 */
+} IgnoreTable;
+
+typedef struct {
+  IgnoreGlob *rules;
+  int count;
+  IgnoreTable names, extensions;
+  int *globs;             /* rules that need the glob matcher, in order */
+  int glob_count;
+} IgnoreFile;
+
+struct IgnoreDir {
+  const IgnoreDir *parent;  /* nearest directory above with ignore files */
+  size_t base_len;          /* of the directory's path from the root */
+  IgnoreFile *files[2];     /* .ignore and .gitignore */
+  IgnoreDir *next;
+};
+
+struct IgnoreRules {
+  IgnorePattern *patterns;
+  int pattern_count;
+  IgnoreTable names, extensions;
+  bool vcs;
+  char *root;
+  IgnoreDir *dirs;          /* read for rules:match, cached by path in the cache_ref table */
+  int cache_ref;
+};
+
+static unsigned int hash_string(const char *s, size_t len) {
+  unsigned int hash = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    hash = (hash ^ (unsigned char)s[i]) * 16777619u;
+  return hash;
+}
+
+static bool table_init(IgnoreTable *table, int keys) {
+  table->size = 0;
+  table->slots = NULL;
+  if (keys == 0)
+    return true;
+  int size = 8;
+  while (size < keys * 2)
+    size *= 2;
+  if (!(table->slots = calloc(size, sizeof(IgnoreSlot))))
+    return false;
+  table->size = size;
+  return true;
+}
+
+/* the slot holding key, or the empty one where it would go */
+static IgnoreSlot *table_find(const IgnoreTable *table, const char *key, size_t len) {
+  if (table->size == 0)
+    return NULL;
+  unsigned int mask = table->size - 1;
+  for (unsigned int i = hash_string(key, len) & mask; ; i = (i + 1) & mask) {
+    IgnoreSlot *slot = &table->slots[i];
+    if (!slot->key || (slot->len == len && memcmp(slot->key, key, len) == 0))
+      return slot;
+  }
+}
+
+static void table_add(IgnoreTable *table, const char *key, size_t len, int rule, bool dir_only) {
+  IgnoreSlot *slot = table_find(table, key, len);
+  if (!slot->key)
+    *slot = (IgnoreSlot) { key, len, -1, -1 };
+  if (dir_only)
+    slot->dir_rule = rule;
+  else
+    slot->rule = rule;
+}
+
+/* the last rule with key that applies, or -1 */
+static int table_lookup(const IgnoreTable *table, const char *key, size_t len, bool dir) {
+  const IgnoreSlot *slot = table_find(table, key, len);
+  if (!slot || !slot->key)
+    return -1;
+  return dir && slot->dir_rule > slot->rule ? slot->dir_rule : slot->rule;
+}
+
+/* the extension of name with its dot, as "*.ext" rules see it */
+static const char *name_extension(const char *name, size_t len) {
+  for (size_t i = len; i > 0; i--)
+    if (name[i - 1] == '.')
+      return name + i - 1;
+  return NULL;
+}
+
+
+/* if a Lua pattern only matches s, returns s in buffer; patterns are like "^name$" */
+static bool pattern_literal(const char *p, size_t len, char *buffer) {
+  size_t n = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] == L_ESC) {
+      if (++i == len || isalnum((unsigned char)p[i]))
+        return false;
+    } else if (strchr("^$*+?.([%-", p[i])) {
+      return false;
+    }
+    buffer[n++] = p[i];
+  }
+  buffer[n] = '\0';
+  return n > 0;
+}
+
+/* finds the config patterns that are a plain name, directory name or extension */
+static char *pattern_key(const IgnorePattern *pattern, bool *extension) {
+  const char *p = pattern->pattern;
+  size_t len = pattern->len;
+  char buffer[PATH_MAX];
+  if (pattern->use_path || len + 1 > sizeof(buffer))
+    return NULL;
+  *extension = false;
+  if (!pattern->match_dir && len > 3 && p[0] == L_ESC && p[1] == '.' && p[len - 1] == '$') {
+    buffer[0] = '.';
+    if (pattern_literal(p + 2, len - 3, buffer + 1) && !strchr(buffer + 1, '.')) {
+      *extension = true;
+      return strdup(buffer);
+    }
+  } else if (p[0] == '^') {
+    if (pattern->match_dir && len > 2 && p[len - 1] == '$' && p[len - 2] == '/')
+      len--;
+    if (len > 2 && p[len - 1] == (pattern->match_dir ? '/' : '$') && pattern_literal(p + 1, len - 2, buffer))
+      return strdup(buffer);
+  }
+  return NULL;
+}
+
+static bool pattern_match(const IgnorePattern *pattern, const char *fullname, size_t fullname_len, const char *name, size_t name_len, bool dir) {
+  const char *s = pattern->use_path ? fullname : name;
+  size_t len = pattern->use_path ? fullname_len : name_len;
+  if (!pattern->match_dir)
+    return pattern_find(s, len, pattern->pattern, pattern->len);
+  char test[PATH_MAX + 2];
+  if (!dir || len + 2 > sizeof(test))
+    return false;
+  memcpy(test, s, len);
+  test[len] = '/';
+  test[len + 1] = '\0';
+  return pattern_find(test, len + 1, pattern->pattern, pattern->len);
+}
+
+
+/* git's wildmatch, mostly: '*' and '?' don't cross a '/', and a "**" component matches any
+   number of directories */
+static int class_match(const char *p, const char *pe, char c, const char **end) {
+  bool negate = ++p < pe && (*p == '!' || *p == '^');
+  bool matched = false;
+  p += negate;
+  for (const char *first = p; p < pe && (*p != ']' || p == first); p++) {
+    char lo = *p, hi;
+    if (lo == '\\' && p + 1 < pe)
+      lo = *++p;
+    hi = lo;
+    if (p + 2 < pe && p[1] == '-' && p[2] != ']') {
+      p += 2;
+      hi = *p == '\\' && p + 1 < pe ? *++p : *p;
+    }
+    if ((unsigned char)c >= (unsigned char)lo && (unsigned char)c <= (unsigned char)hi)
+      matched = true;
+  }
+  if (p >= pe)
+    return -1;
+  *end = p + 1;
+  return matched != negate;
+}
+
+static bool glob_match(const char *pattern, const char *p, const char *pe, const char *s, const char *se) {
+  while (p < pe) {
+    if (*p == '*') {
+      if (p + 1 < pe && p[1] == '*' && (p == pattern || p[-1] == '/') && (p + 2 == pe || p[2] == '/')) {
+        if (p + 2 == pe)
+          return true;
+        for (const char *t = s; t <= se; t++)
+          if ((t == s || t[-1] == '/') && glob_match(pattern, p + 3, pe, t, se))
+            return true;
+        return false;
+      }
+      while (p < pe && *p == '*')
+        p++;
+      for (const char *t = s; ; t++) {
+        if (glob_match(pattern, p, pe, t, se))
+          return true;
+        if (t == se || *t == '/')
+          return false;
+      }
+    }
+    if (s == se)
+      return false;
+    if (*p == '?') {
+      if (*s == '/')
+        return false;
+      p++, s++;
+      continue;
+    }
+    if (*p == '[') {
+      const char *end;
+      int matched = class_match(p, pe, *s, &end);
+      if (matched >= 0) {
+        if (!matched || *s == '/')
+          return false;
+        p = end, s++;
+        continue;
+      }
+    }
+    if (*p == '\\' && p + 1 < pe)
+      p++;
+    if (*p != *s)
+      return false;
+    p++, s++;
+  }
+  return s == se;
+}
+
+
+static void ignore_file_free(IgnoreFile *file) {
+  if (!file)
+    return;
+  for (int i = 0; i < file->count; i++)
+    free(file->rules[i].pattern);
+  free(file->rules);
+  free(file->names.slots);
+  free(file->extensions.slots);
+  free(file->globs);
+  free(file);
+}
+
+/* compiles the lines of a .gitignore file; text is modified */
+static IgnoreFile *ignore_file_parse(char *text, size_t len) {
+  IgnoreFile *file = calloc(1, sizeof(IgnoreFile));
+  int lines = 1;
+  for (size_t i = 0; i < len; i++)
+    lines += text[i] == '\n';
+  if (!file || !(file->rules = calloc(lines, sizeof(IgnoreGlob))) || !(file->globs = calloc(lines, sizeof(int)))) {
+    ignore_file_free(file);
+    return NULL;
+  }
+  int names = 0, extensions = 0;
+  for (char *line = text, *end; line < text + len; line = end + 1) {
+    end = memchr(line, '\n', text + len - line);
+    end = end ? end : text + len;
+    char *p = line, *pe = end;
+    if (pe > p && pe[-1] == '\r')
+      pe--;
+    while (pe > p && pe[-1] == ' ' && !(pe - 1 > p && pe[-2] == '\\'))
+      pe--;
+    if (p == pe || *p == '#')
+      continue;
+    IgnoreGlob rule = { 0 };
+    if (*p == '!')
+      rule.negate = true, p++;
+    if (pe > p && pe[-1] == '/')
+      rule.dir_only = true, pe--;
+    if (p < pe && *p == '/')
+      rule.anchored = true, p++;
+    else
+      rule.anchored = memchr(p, '/', pe - p) != NULL;
+    if (pe - p > 3 && memcmp(p, "**/", 3) == 0 && !memchr(p + 3, '/', pe - p - 3))
+      rule.anchored = false, p += 3;
+    if (p == pe || !(rule.pattern = malloc(pe - p + 1)))
+      continue;
+    memcpy(rule.pattern, p, pe - p);
+    rule.pattern[pe - p] = '\0';
+    rule.len = pe - p;
+    file->rules[file->count++] = rule;
+    if (!rule.anchored && !strpbrk(rule.pattern, "*?[\\"))
+      names++;
+    else if (!rule.anchored && rule.len > 2 && rule.pattern[0] == '*' && rule.pattern[1] == '.' && !strpbrk(rule.pattern + 2, "*?[\\."))
+      extensions++;
+  }
+  if (!table_init(&file->names, names) || !table_init(&file->extensions, extensions)) {
+    ignore_file_free(file);
+    return NULL;
+  }
+  for (int i = 0; i < file->count; i++) {
+    IgnoreGlob *rule = &file->rules[i];
+    if (!rule->anchored && !strpbrk(rule->pattern, "*?[\\"))
+      table_add(&file->names, rule->pattern, rule->len, i, rule->dir_only);
+    else if (!rule->anchored && rule->len > 2 && rule->pattern[0] == '*' && rule->pattern[1] == '.' && !strpbrk(rule->pattern + 2, "*?[\\."))
+      table_add(&file->extensions, rule->pattern + 1, rule->len - 1, i, rule->dir_only);
+    else
+      file->globs[file->glob_count++] = i;
+  }
+  return file;
+}
+
+/* the last rule of the file that matches, or -1; path is relative to the file's directory */
+static int ignore_file_match(const IgnoreFile *file, const char *path, size_t path_len, const char *name, size_t name_len, bool dir) {
+  int best = table_lookup(&file->names, name, name_len, dir);
+  const char *extension = name_extension(name, name_len);
+  if (extension) {
+    int rule = table_lookup(&file->extensions, extension, name + name_len - extension, dir);
+    best = rule > best ? rule : best;
+  }
+  for (int i = file->glob_count - 1; i >= 0 && file->globs[i] > best; i--) {
+    const IgnoreGlob *rule = &file->rules[file->globs[i]];
+    if (rule->dir_only && !dir)
+      continue;
+    const char *s = rule->anchored ? path : name;
+    size_t len = rule->anchored ? path_len : name_len;
+    if (glob_match(rule->pattern, rule->pattern, rule->pattern + rule->len, s, s + len))
+      return file->globs[i];
+  }
+  return best;
+}
+
+static IgnoreFile *ignore_file_read(const char *path) {
+#ifdef _WIN32
+  LPWSTR wpath = utfconv_utf8towc(path);
+  FILE *fp = wpath ? _wfopen(wpath, L"rb") : NULL;
+  free(wpath);
+#else
+  FILE *fp = fopen(path, "rb");
+#endif
+  if (!fp)
+    return NULL;
+  size_t len = 0, capacity = 4096;
+  char *text = malloc(capacity);
+  bool too_large = false;
+  while (text) {
+    len += fread(text + len, 1, capacity - len, fp);
+    if (len < capacity)
+      break;
+    if (capacity >= IGNORE_FILE_MAX) {
+      /* a truncated file would end with part of a rule */
+      too_large = fgetc(fp) != EOF;
+      break;
+    }
+    char *grown = realloc(text, capacity * 2);
+    if (!grown)
+      free(text);
+    text = grown, capacity *= 2;
+  }
+  fclose(fp);
+  IgnoreFile *file = text && !too_large ? ignore_file_parse(text, len) : NULL;
+  free(text);
+  return file;
+}
+
+
+/*
+** Reads the ignore files of a directory, given by its path from root with path_len > 0, or "" for
+** root itself. Returns NULL if there are none, or the directory to use for the entries below
+** it, which is to be added to a list with ignore_dirs_push. parent is the one for its own entry.
+*/
+IgnoreDir *ignore_dir_read(const IgnoreRules *rules, const IgnoreDir *parent, const char *root, const char *path, size_t path_len) {
+  static const char *names[] = { ".ignore", ".gitignore" };
+  if (!rules->vcs)
+    return NULL;
+  IgnoreFile *files[2] = { NULL, NULL };
+  char fullpath[PATH_MAX];
+  for (int i = 0; i < 2; i++) {
+    int len = path_len ? snprintf(fullpath, sizeof(fullpath), "%s%c%.*s%c%s", root, PATHSEP, (int)path_len, path, PATHSEP, names[i])
+                       : snprintf(fullpath, sizeof(fullpath), "%s%c%s", root, PATHSEP, names[i]);
+    if (len > 0 && len < (int)sizeof(fullpath))
+      files[i] = ignore_file_read(fullpath);
+  }
+  if (!files[0] && !files[1])
+    return NULL;
+  IgnoreDir *dir = malloc(sizeof(IgnoreDir));
+  if (!dir) {
+    ignore_file_free(files[0]);
+    ignore_file_free(files[1]);
+    return NULL;
+  }
+  *dir = (IgnoreDir) { parent, path_len, { files[0], files[1] }, NULL };
+  return dir;
+}
+
+void ignore_dirs_push(IgnoreDir **list, IgnoreDir *dir) {
+  dir->next = *list;
+  *list = dir;
+}
+
+void ignore_dirs_free(IgnoreDir *list) {
+  while (list) {
+    IgnoreDir *next = list->next;
+    ignore_file_free(list->files[0]);
+    ignore_file_free(list->files[1]);
+    free(list);
+    list = next;
+  }
+}
+
+/*
+** Whether an entry is left out. fullname is "/" followed by its path from the root, with '/' as
+** the separator; name is its last component, and dir the nearest directory above it with ignore
+** files, if any.
+*/
+int ignore_rules_match(const IgnoreRules *rules, const IgnoreDir *dir, const char *fullname, size_t fullname_len, const char *name, size_t name_len, int is_dir) {
+  if (table_lookup(&rules->names, name, name_len, is_dir) >= 0)
+    return true;
+  const char *extension = name_extension(name, name_len);
+  if (extension && table_lookup(&rules->extensions, extension, name + name_len - extension, is_dir) >= 0)
+    return true;
+  for (int i = 0; i < rules->pattern_count; i++) {
+    if (!rules->patterns[i].key && pattern_match(&rules->patterns[i], fullname, fullname_len, name, name_len, is_dir))
+      return true;
+  }
+  for (; dir; dir = dir->parent) {
+    size_t offset = dir->base_len ? dir->base_len + 2 : 1;
+    if (offset > fullname_len)
+      continue;
+    for (int i = 0; i < 2; i++) {
+      const IgnoreFile *file = dir->files[i];
+      int rule = file ? ignore_file_match(file, fullname + offset, fullname_len - offset, name, name_len, is_dir) : -1;
+      if (rule >= 0)
+        return !file->rules[rule].negate;
+    }
+  }
+  return false;
+}
+
+
+static int f_ignore_rules_gc(lua_State *L) {
+  IgnoreRules *rules = luaL_checkudata(L, 1, API_TYPE_IGNORE_RULES);
+  for (int i = 0; i < rules->pattern_count; i++) {
+    free(rules->patterns[i].pattern);
+    free(rules->patterns[i].key);
+  }
+  free(rules->patterns);
+  free(rules->names.slots);
+  free(rules->extensions.slots);
+  ignore_dirs_free(rules->dirs);
+  free(rules->root);
+  luaL_unref(L, LUA_REGISTRYINDEX, rules->cache_ref);
+  memset(rules, 0, sizeof(IgnoreRules));
+  rules->cache_ref = LUA_NOREF;
+  return 0;
+}
+
+/* the directory with the ignore files for the entries of path, which has length len */
+static const IgnoreDir *ignore_rules_dir(lua_State *L, IgnoreRules *rules, const char *path, size_t len, const IgnoreDir *parent) {
+  lua_rawgeti(L, LUA_REGISTRYINDEX, rules->cache_ref);
+  lua_pushlstring(L, path, len);
+  lua_rawget(L, -2);
+  const IgnoreDir *dir = parent;
+  if (lua_islightuserdata(L, -1)) {
+    dir = lua_touserdata(L, -1);
+  } else if (lua_isnil(L, -1)) {
+    IgnoreDir *read = ignore_dir_read(rules, parent, rules->root, path, len);
+    lua_pushlstring(L, path, len);
+    if (read) {
+      ignore_dirs_push(&rules->dirs, read);
+      lua_pushlightuserdata(L, read);
+      dir = read;
+    } else {
+      lua_pushboolean(L, 0);
+    }
+    lua_rawset(L, -4);
+  }
+  lua_pop(L, 2);
+  return dir;
+}
+
+static int f_ignore_rules_match(lua_State *L) {
+  IgnoreRules *rules = luaL_checkudata(L, 1, API_TYPE_IGNORE_RULES);
+  size_t len;
+  const char *path = luaL_checklstring(L, 2, &len);
+  bool is_dir = strcmp(luaL_optstring(L, 3, "file"), "dir") == 0;
+  char fullname[PATH_MAX + 1];
+  if (len == 0 || len + 1 >= sizeof(fullname))
+    return luaL_error(L, "invalid path");
+  fullname[0] = '/';
+  for (size_t i = 0; i < len; i++)
+    fullname[i + 1] = path[i] == '\\' ? '/' : path[i];
+  fullname[len + 1] = '\0';
+  /* an entry is also left out when a directory it's in is */
+  const IgnoreDir *dir = ignore_rules_dir(L, rules, "", 0, NULL);
+  size_t start = 1;
+  for (size_t i = 1; i <= len + 1; i++) {
+    bool last = i == len + 1;
+    if (!last && fullname[i] != '/')
+      continue;
+    if (ignore_rules_match(rules, dir, fullname, i, fullname + start, i - start, last ? is_dir : true)) {
+      lua_pushboolean(L, 1);
+      return 1;
+    }
+    if (!last)
+      dir = ignore_rules_dir(L, rules, path, i - 1, dir);
+    start = i + 1;
+  }
+  lua_pushboolean(L, 0);
+  return 1;
+}
+
+static const luaL_Reg ignore_rules_lib[] = {
+  { "match",   f_ignore_rules_match },
+  { "__gc",    f_ignore_rules_gc    },
+  { NULL, NULL }
+};
+
+/* compiles the rules, pushing them; spec is a list of { pattern, use_path, match_dir } */
+static IgnoreRules *ignore_rules_new(lua_State *L, const char *root, int spec, bool vcs) {
+  IgnoreRules *rules = lua_newuserdata(L, sizeof(IgnoreRules));
+  memset(rules, 0, sizeof(IgnoreRules));
+  rules->cache_ref = LUA_NOREF;
+  if (luaL_newmetatable(L, API_TYPE_IGNORE_RULES)) {
+    luaL_setfuncs(L, ignore_rules_lib, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+  lua_newtable(L);
+  rules->cache_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  rules->vcs = vcs;
+  if (!(rules->root = strdup(root)))
+    luaL_error(L, "can't create ignore rules: out of memory");
+
+  int count = lua_istable(L, spec) ? (int)lua_rawlen(L, spec) : 0;
+  if (count > 0 && !(rules->patterns = calloc(count, sizeof(IgnorePattern))))
+    luaL_error(L, "can't create ignore rules: out of memory");
+  int names = 0, extensions = 0;
+  for (int i = 1; i <= count; i++) {
+    lua_rawgeti(L, spec, i);
+    if (lua_istable(L, -1)) {
+      IgnorePattern *pattern = &rules->patterns[rules->pattern_count];
+      lua_getfield(L, -1, "pattern");
+      const char *s = lua_tolstring(L, -1, &pattern->len);
+      pattern->pattern = s ? strdup(s) : NULL;
+      lua_getfield(L, -2, "use_path");
+      pattern->use_path = lua_toboolean(L, -1);
+      lua_getfield(L, -3, "match_dir");
+      pattern->match_dir = lua_toboolean(L, -1);
+      lua_pop(L, 3);
+      if (pattern->pattern) {
+        if ((pattern->key = pattern_key(pattern, &pattern->extension)))
+          pattern->extension ? extensions++ : names++;
+        rules->pattern_count++;
+      }
+    }
+    lua_pop(L, 1);
+  }
+  if (!table_init(&rules->names, names) || !table_init(&rules->extensions, extensions))
+    luaL_error(L, "can't create ignore rules: out of memory");
+  for (int i = 0; i < rules->pattern_count; i++) {
+    IgnorePattern *pattern = &rules->patterns[i];
+    if (pattern->key && pattern->extension)
+      table_add(&rules->extensions, pattern->key, strlen(pattern->key), i, false);
+    else if (pattern->key)
+      table_add(&rules->names, pattern->key, strlen(pattern->key), i, pattern->match_dir);
+  }
+  return rules;
+}
+
+/*
+** Gets the rules at idx, compiling them if it's an ignore spec, and pushes them; a registry
+** reference to them keeps them alive as long as they're used.
+*/
+IgnoreRules *ignore_rules_arg(lua_State *L, int idx, const char *root) {
+  IgnoreRules *rules = luaL_testudata(L, idx, API_TYPE_IGNORE_RULES);
+  if (rules) {
+    lua_pushvalue(L, idx);
+    return rules;
+  }
+  if (!lua_isnoneornil(L, idx))
+    luaL_checktype(L, idx, LUA_TTABLE);
+  return ignore_rules_new(L, root, idx, false);
+}
+
+/*
+** system.ignore_rules(root, ignore_spec, opts) compiles ignore_spec, a list of
+** { pattern, use_path, match_dir } entries as dirwatch compiles them from config.ignore_files,
+** for the tree at root. With opts.vcs, the .ignore and .gitignore files in the tree apply too.
+** The rules can be given to system.scan_tree in place of ignore_spec, and
+** rules:match(path, type) tells whether an entry, given by its path from root, is left out;
+** it reads the ignore files it needs once.
+*/
+int f_ignore_rules(lua_State *L) {
+  const char *root = luaL_checkstring(L, 1);
+  if (!lua_isnoneornil(L, 2))
+    luaL_checktype(L, 2, LUA_TTABLE);
+  bool vcs = false;
+  if (lua_istable(L, 3)) {
+    lua_getfield(L, 3, "vcs");
+    vcs = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+  }
+  ignore_rules_new(L, root, 2, vcs);
+  return 1;
+}
@@ -0,0 +1,764 @@
+#include "api.h"
+
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+  #define PATHSEP '\\'
+#else
+  #define PATHSEP '/'
+#endif
+
+/*
+** A project tree keeps the entries of a project directory on the C side, one node per file or
+** directory. The entries of each directory are sorted in dir.files order, so that a path is
+** found with a binary search per component and an entry is inserted or removed without
+** touching the rest of the project; each directory also counts the entries below it. Lua only
+** gets tables for the entries it asks for, instead of one for every entry of the project.
+*/
+
+struct TreeNode {
+  TreeNode *parent;
+  TreeNode **children;      /* directories only, in dir.files order */
+  uint32_t child_count, child_capacity;
+  uint32_t count;           /* entries below a directory */
+  bool dir, symlink;
+  uint16_t name_len;
+  int64_t size, modified;
+  char name[];
+};
+
+struct ProjectTree {
+  TreeNode *root;
+  /* changed whenever entries are added, moved or removed */
+  uint64_t generation;
+  /* the directory entries were last added to, with its path */
+  TreeNode *last_dir;
+  char *last_path;
+  size_t last_len, last_capacity;
+  uint64_t last_generation;
+};
+
+typedef struct {
+  char *data;
+  size_t len, capacity;
+} TreePath;
+
+static TreeNode *node_new(const char *name, size_t name_len, bool dir, bool symlink, int64_t size, int64_t modified) {
+  if (name_len > UINT16_MAX)
+    return NULL;
+  TreeNode *node = malloc(sizeof(TreeNode) + name_len + 1);
+  if (!node)
+    return NULL;
+  memset(node, 0, sizeof(TreeNode));
+  node->dir = dir, node->symlink = symlink, node->size = size, node->modified = modified;
+  node->name_len = (uint16_t)name_len;
+  memcpy(node->name, name, name_len);
+  node->name[name_len] = '\0';
+  return node;
+}
+
+static void node_free(TreeNode *node) {
+  for (uint32_t i = 0; i < node->child_count; i++)
+    node_free(node->children[i]);
+  free(node->children);
+  free(node);
+}
+
+/* like compare_entries in scan.c, for an entry and a name */
+static int node_compare(const TreeNode *node, const char *name, size_t name_len, bool dir) {
+  if (node->dir != dir)
+    return node->dir ? -1 : 1;
+  if (path_compare(node->name, node->name_len, !node->dir, name, name_len, !dir))
+    return -1;
+  return path_compare(name, name_len, !dir, node->name, node->name_len, !node->dir) ? 1 : 0;
+}
+
+/* the index of the first entry of dir that doesn't come before name */
+static uint32_t node_lower_bound(const TreeNode *dir, const char *name, size_t name_len, bool is_dir) {
+  uint32_t lo = 0, hi = dir->child_count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (node_compare(dir->children[mid], name, name_len, is_dir) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* the index of the entry of dir named name, of any type if type is negative, or -1 */
+static int64_t node_find(const TreeNode *dir, const char *name, size_t name_len, int type) {
+  for (int is_dir = 1; is_dir >= 0; is_dir--) {
+    if (type >= 0 && type != is_dir)
+      continue;
+    /* entries that only differ in case can compare as equal */
+    for (uint32_t i = node_lower_bound(dir, name, name_len, is_dir); i < dir->child_count; i++) {
+      const TreeNode *child = dir->children[i];
+      if (node_compare(child, name, name_len, is_dir) != 0)
+        break;
+      if (child->name_len == name_len && memcmp(child->name, name, name_len) == 0)
+        return i;
+    }
+  }
+  return -1;
+}
+
+static void node_add_count(TreeNode *node, int64_t delta) {
+  for (; node; node = node->parent)
+    node->count += delta;
+}
+
+static bool node_insert(TreeNode *dir, uint32_t index, TreeNode *child) {
+  if (dir->child_count == dir->child_capacity) {
+    uint32_t capacity = dir->child_capacity ? dir->child_capacity * 2 : 8;
+    TreeNode **children = realloc(dir->children, capacity * sizeof(TreeNode*));
+    if (!children)
+      return false;
+    dir->children = children, dir->child_capacity = capacity;
+  }
+  memmove(&dir->children[index + 1], &dir->children[index], (dir->child_count - index) * sizeof(TreeNode*));
+  dir->children[index] = child;
+  dir->child_count++;
+  child->parent = dir;
+  node_add_count(dir, 1 + (int64_t)child->count);
+  return true;
+}
+
+static TreeNode *node_detach(TreeNode *dir, uint32_t index) {
+  TreeNode *child = dir->children[index];
+  memmove(&dir->children[index], &dir->children[index + 1], (dir->child_count - index - 1) * sizeof(TreeNode*));
+  dir->child_count--;
+  node_add_count(dir, -1 - (int64_t)child->count);
+  child->parent = NULL;
+  return child;
+}
+
+/* the directory at path, "" for the root, or its parent when parent is set; NULL if it's not there */
+static TreeNode *tree_find(const ProjectTree *tree, const char *path, size_t len, bool parent, const char **name, size_t *name_len) {
+  TreeNode *node = tree->root;
+  size_t start = 0;
+  while (start < len) {
+    size_t end = start;
+    while (end < len && path[end] != PATHSEP)
+      end++;
+    if (parent && end == len) {
+      *name = path + start, *name_len = end - start;
+      return node;
+    }
+    int64_t i = node_find(node, path + start, end - start, 1);
+    if (i < 0)
+      return NULL;
+    node = node->children[i];
+    start = end + 1;
+  }
+  if (parent)
+    return NULL;
+  return node;
+}
+
+static TreeNode *tree_find_entry(const ProjectTree *tree, const char *path, size_t len) {
+  const char *name;
+  size_t name_len;
+  TreeNode *dir = tree_find(tree, path, len, true, &name, &name_len);
+  int64_t i = dir ? node_find(dir, name, name_len, -1) : -1;
+  return i >= 0 ? dir->children[i] : NULL;
+}
+
+static bool path_reserve(TreePath *path, size_t len) {
+  if (len <= path->capacity)
+    return true;
+  size_t capacity = path->capacity ? path->capacity : 256;
+  while (capacity < len)
+    capacity *= 2;
+  char *data = realloc(path->data, capacity);
+  if (!data)
+    return false;
+  path->data = data, path->capacity = capacity;
+  return true;
+}
+
+/* appends name to path and returns the previous length, to go back to */
+static size_t path_push(TreePath *path, const char *name, size_t name_len) {
+  size_t len = path->len;
+  if (path_reserve(path, len + name_len + 2)) {
+    if (len)
+      path->data[path->len++] = PATHSEP;
+    memcpy(path->data + path->len, name, name_len);
+    path->len += name_len;
+  }
+  return len;
+}
+
+/* the directory at path, creating the missing ones */
+static TreeNode *tree_make_dir(ProjectTree *tree, const char *path, size_t len) {
+  if (tree->last_dir && tree->last_generation == tree->generation && tree->last_len == len && memcmp(tree->last_path, path, len) == 0)
+    return tree->last_dir;
+  TreeNode *node = tree->root;
+  size_t start = 0;
+  while (start < len) {
+    size_t end = start;
+    while (end < len && path[end] != PATHSEP)
+      end++;
+    int64_t i = node_find(node, path + start, end - start, 1);
+    if (i >= 0) {
+      node = node->children[i];
+    } else {
+      TreeNode *dir = node_new(path + start, end - start, true, false, 0, 0);
+      if (!dir || !node_insert(node, node_lower_bound(node, path + start, end - start, true), dir)) {
+        free(dir);
+        return NULL;
+      }
+      tree->generation++;
+      node = dir;
+    }
+    start = end + 1;
+  }
+  if (len + 1 > tree->last_capacity) {
+    char *last_path = realloc(tree->last_path, len + 1);
+    if (!last_path)
+      return node;
+    tree->last_path = last_path, tree->last_capacity = len + 1;
+  }
+  memcpy(tree->last_path, path, len);
+  tree->last_len = len;
+  tree->last_dir = node;
+  tree->last_generation = tree->generation;
+  return node;
+}
+
+bool project_tree_add(ProjectTree *tree, const char *dir, size_t dir_len, const char *name, size_t name_len, bool is_dir, bool symlink, int64_t size, int64_t modified) {
+  TreeNode *parent = tree_make_dir(tree, dir, dir_len);
+  if (!parent)
+    return false;
+  int64_t i = node_find(parent, name, name_len, is_dir);
+  if (i >= 0) {
+    TreeNode *node = parent->children[i];
+    node->symlink = symlink, node->size = size, node->modified = modified;
+    return true;
+  }
+  /* entries come in order, so they're usually added at the end */
+  uint32_t index = parent->child_count;
+  if (index > 0 && node_compare(parent->children[index - 1], name, name_len, is_dir) >= 0)
+    index = node_lower_bound(parent, name, name_len, is_dir);
+  TreeNode *node = node_new(name, name_len, is_dir, symlink, size, modified);
+  if (!node || !node_insert(parent, index, node)) {
+    free(node);
+    return false;
+  }
+  tree->generation++;
+  tree->last_generation = tree->generation;
+  return true;
+}
+
+static void walk_node(const TreeNode *node, int depth, project_tree_visitor visit, void *data) {
+  for (uint32_t i = 0; i < node->child_count; i++) {
+    const TreeNode *child = node->children[i];
+    visit(data, depth, child->name, child->name_len, child->dir, child->symlink, child->size, child->modified);
+    if (child->dir)
+      walk_node(child, depth + 1, visit, data);
+  }
+}
+
+void project_tree_walk(const ProjectTree *tree, project_tree_visitor visit, void *data) {
+  walk_node(tree->root, 0, visit, data);
+}
+
+uint32_t project_tree_count(const ProjectTree *tree) {
+  return tree->root->count;
+}
+
+static void push_item(lua_State *L, const TreePath *path, const TreeNode *node) {
+  lua_createtable(L, 0, 5);
+  lua_pushlstring(L, path->data, path->len);
+  lua_setfield(L, -2, "filename");
+  lua_pushstring(L, node->dir ? "dir" : "file");
+  lua_setfield(L, -2, "type");
+  lua_pushinteger(L, node->size);
+  lua_setfield(L, -2, "size");
+  lua_pushinteger(L, node->modified);
+  lua_setfield(L, -2, "modified");
+#if __linux__
+  if (node->dir) {
+    lua_pushboolean(L, node->symlink);
+    lua_setfield(L, -2, "symlink");
+  }
+#endif
+}
+
+/* appends the filenames of node, if it's a directory, and of the directories below it to the table at the top of the stack */
+static void push_dirs(lua_State *L, TreePath *path, const TreeNode *node) {
+  if (!node->dir)
+    return;
+  size_t len = path_push(path, node->name, node->name_len);
+  lua_pushlstring(L, path->data, path->len);
+  lua_rawseti(L, -2, lua_rawlen(L, -2) + 1);
+  for (uint32_t i = 0; i < node->child_count; i++)
+    push_dirs(L, path, node->children[i]);
+  path->len = len;
+}
+
+/*
+** makes the entries of dst those of src, moving over the nodes of new entries and keeping
+** the others; the directories that came and went are appended to the tables at idx and idx + 1.
+** Only the counts of dst and src themselves are updated.
+*/
+static bool merge_children(lua_State *L, int idx, TreePath *path, TreeNode *dst, TreeNode *src) {
+  uint32_t capacity = dst->child_count + src->child_count, count = 0, i = 0, j = 0;
+  TreeNode **children = malloc((capacity ? capacity : 1) * sizeof(TreeNode*));
+  if (!children)
+    return false;
+  bool ok = true;
+  while (ok && (i < dst->child_count || j < src->child_count)) {
+    TreeNode *old = i < dst->child_count ? dst->children[i] : NULL, *new = j < src->child_count ? src->children[j] : NULL;
+    int cmp = !old ? 1 : !new ? -1 : node_compare(old, new->name, new->name_len, new->dir);
+    if (cmp == 0 && (old->name_len != new->name_len || memcmp(old->name, new->name, new->name_len) != 0))
+      cmp = -1;
+    if (cmp < 0) {
+      lua_pushvalue(L, idx + 1);
+      push_dirs(L, path, old);
+      lua_pop(L, 1);
+      node_free(old);
+      i++;
+    } else if (cmp > 0) {
+      lua_pushvalue(L, idx);
+      push_dirs(L, path, new);
+      lua_pop(L, 1);
+      new->parent = dst;
+      children[count++] = new;
+      j++;
+    } else {
+      old->symlink = new->symlink, old->size = new->size, old->modified = new->modified;
+      if (old->dir) {
+        size_t len = path_push(path, old->name, old->name_len);
+        ok = merge_children(L, idx, path, old, new);
+        path->len = len;
+      }
+      /* if that failed, what's left of both is kept, in their own directories */
+      children[count++] = old;
+      i++;
+      if (ok) {
+        node_free(new);
+        j++;
+      }
+    }
+  }
+  for (; i < dst->child_count; i++)
+    children[count++] = dst->children[i];
+  for (uint32_t k = j; k < src->child_count; k++)
+    src->children[k - j] = src->children[k];
+  src->child_count -= j;
+  free(dst->children);
+  dst->children = children, dst->child_count = count, dst->child_capacity = capacity ? capacity : 1;
+  dst->count = src->count = 0;
+  for (uint32_t k = 0; k < dst->child_count; k++)
+    dst->count += 1 + dst->children[k]->count;
+  for (uint32_t k = 0; k < src->child_count; k++)
+    src->count += 1 + src->children[k]->count;
+  return ok;
+}
+
+static ProjectTree *check_tree(lua_State *L, int idx) {
+  ProjectTree *tree = luaL_checkudata(L, idx, API_TYPE_PROJECT_TREE);
+  if (!tree->root)
+    luaL_error(L, "the project tree was freed");
+  return tree;
+}
+
+static int f_tree_gc(lua_State *L) {
+  ProjectTree *tree = luaL_checkudata(L, 1, API_TYPE_PROJECT_TREE);
+  if (tree->root)
+    node_free(tree->root);
+  free(tree->last_path);
+  memset(tree, 0, sizeof(*tree));
+  return 0;
+}
+
+/* tree:get(filename) returns the entry like a dir.files item, or nil */
+static int f_tree_get(lua_State *L) {
+  ProjectTree *tree = check_tree(L, 1);
+  size_t len;
+  const char *filename = luaL_checklstring(L, 2, &len);
+  TreeNode *node = tree_find_entry(tree, filename, len);
+  if (!node)
+    return 0;
+  TreePath path = { (char*)filename, len, len };
+  push_item(L, &path, node);
+  return 1;
+}
+
+/* tree:list(dirpath) returns the entries directly in a directory ("" for the root), or nil */
+static int f_tree_list(lua_State *L) {
+  ProjectTree *tree = check_tree(L, 1);
+  size_t len;
+  const char *dirpath = luaL_checklstring(L, 2, &len);
+  TreeNode *dir = tree_find(tree, dirpath, len, false, NULL, NULL);
+  if (!dir)
+    return 0;
+  TreePath path = { 0 };
+  if (!path_reserve(&path, len + 1))
+    return luaL_error(L, "out of memory");
+  memcpy(path.data, dirpath, len);
+  path.len = len;
+  lua_createtable(L, dir->child_count, 0);
+  for (uint32_t i = 0; i < dir->child_count; i++) {
+    size_t prev = path_push(&path, dir->children[i]->name, dir->children[i]->name_len);
+    push_item(L, &path, dir->children[i]);
+    lua_rawseti(L, -2, i + 1);
+    path.len = prev;
+  }
+  free(path.data);
+  return 1;
+}
+
+/* tree:count(dirpath?) returns the number of entries below a directory, the root by default */
+static int f_tree_count(lua_State *L) {
+  ProjectTree *tree = check_tree(L, 1);
+  size_t len;
+  const char *dirpath = luaL_optlstring(L, 2, "", &len);
+  TreeNode *dir = tree_find(tree, dirpath, len, false, NULL, NULL);
+  lua_pushinteger(L, dir ? dir->count : 0);
+  return 1;
+}
+
+static ProjectTree *check_source(lua_State *L, int idx) {
+  if (lua_isnoneornil(L, idx))
+    return NULL;
+  return check_tree(L, idx);
+}
+
+static int push_changes(lua_State *L, TreePath *path, bool ok) {
+  free(path->data);
+  if (!ok)
+    return luaL_error(L, "out of memory");
+  return 2;
+}
+
+/*
+** tree:replace(filename, src) makes the entry filename, and what's below it, what it is in the
+** tree src, or removes it if src is nil or doesn't have it. The entries are moved out of src.
+** Returns the filenames of the directories that were added and of those that were removed, or
+** nothing if the directory of filename isn't in the tree.
+*/
+static int f_tree_replace(lua_State *L) {
+  ProjectTree *tree = check_tree(L, 1);
+  size_t len;
+  const char *filename = luaL_checklstring(L, 2, &len);
+  ProjectTree *src = check_source(L, 3);
+  const char *name;
+  size_t name_len;
+  TreeNode *dir = tree_find(tree, filename, len, true, &name, &name_len);
+  if (!dir)
+    return 0;
+  TreeNode *new = src ? tree_find_entry(src, filename, len) : NULL;
+  int64_t i = node_find(dir, name, name_len, -1);
+  TreeNode *old = i >= 0 ? dir->children[i] : NULL;
+  bool same_type = old && new && old->dir == new->dir;
+  lua_settop(L, 3);
+  lua_newtable(L);
+  lua_newtable(L);
+  TreePath path = { 0 };
+  bool ok = path_reserve(&path, len + 1);
+  if (ok) {
+    memcpy(path.data, filename, len - name_len);
+    path.len = len > name_len ? len - name_len - 1 : 0;
+  }
+  tree->generation++;
+  if (ok && same_type) {
+    old->symlink = new->symlink, old->size = new->size, old->modified = new->modified;
+    if (old->dir) {
+      int64_t count = old->count, new_count = new->count;
+      path_push(&path, old->name, old->name_len);
+      ok = merge_children(L, 4, &path, old, new);
+      node_add_count(old->parent, (int64_t)old->count - count);
+      node_add_count(new->parent, (int64_t)new->count - new_count);
+      src->generation++;
+    }
+    return push_changes(L, &path, ok);
+  }
+  if (ok && old) {
+    lua_pushvalue(L, 5);
+    push_dirs(L, &path, old);
+    lua_pop(L, 1);
+    node_free(node_detach(dir, (uint32_t)i));
+  }
+  if (ok && new) {
+    TreeNode *parent = new->parent;
+    int64_t j = node_find(parent, new->name, new->name_len, new->dir);
+    node_detach(parent, (uint32_t)j);
+    ok = node_insert(dir, node_lower_bound(dir, new->name, new->name_len, new->dir), new);
+    if (ok) {
+      lua_pushvalue(L, 4);
+      push_dirs(L, &path, new);
+      lua_pop(L, 1);
+      src->generation++;
+    } else {
+      node_free(new);
+    }
+  }
+  return push_changes(L, &path, ok);
+}
+
+/*
+** tree:replace_children(dirpath, src) makes the entries below the directory dirpath those
+** below it in the tree src, like tree:replace but keeping the directory itself.
+*/
+static int f_tree_replace_children(lua_State *L) {
+  ProjectTree *tree = check_tree(L, 1);
+  size_t len;
+  const char *dirpath = luaL_checklstring(L, 2, &len);
+  ProjectTree *src = check_tree(L, 3);
+  TreeNode *dir = tree_find(tree, dirpath, len, false, NULL, NULL);
+  TreeNode *new = tree_find(src, dirpath, len, false, NULL, NULL);
+  if (!dir || !new)
+    return 0;
+  lua_settop(L, 3);
+  lua_newtable(L);
+  lua_newtable(L);
+  TreePath path = { 0 };
+  bool ok = path_reserve(&path, len + 1);
+  if (ok) {
+    memcpy(path.data, dirpath, len);
+    path.len = len;
+  }
+  int64_t count = dir->count, new_count = new->count;
+  ok = ok && merge_children(L, 4, &path, dir, new);
+  node_add_count(dir->parent, (int64_t)dir->count - count);
+  node_add_count(new->parent, (int64_t)new->count - new_count);
+  tree->generation++;
+  src->generation++;
+  return push_changes(L, &path, ok);
+}
+
+static bool path_is_inside(const char *path, size_t len, const char *dir, size_t dir_len) {
+  return len > dir_len && memcmp(path, dir, dir_len) == 0 && path[dir_len] == PATHSEP;
+}
+
+/*
+** tree:move(from, to) renames the entry from, along with what's below it, replacing what was at
+** to. Returns the filenames of the directories that were replaced, or nothing if either from or
+** the directory of to isn't in the tree, or if one is inside the other.
+*/
+static int f_tree_move(lua_State *L) {
+  ProjectTree *tree = check_tree(L, 1);
+  size_t from_len, to_len;
+  const char *from = luaL_checklstring(L, 2, &from_len);
+  const char *to = luaL_checklstring(L, 3, &to_len);
+  const char *from_name, *to_name;
+  size_t from_name_len, to_name_len;
+  TreeNode *from_dir = tree_find(tree, from, from_len, true, &from_name, &from_name_len);
+  TreeNode *to_dir = tree_find(tree, to, to_len, true, &to_name, &to_name_len);
+  int64_t i = from_dir ? node_find(from_dir, from_name, from_name_len, -1) : -1;
+  if (i < 0 || !to_dir || to_name_len > UINT16_MAX || path_is_inside(to, to_len, from, from_len) || path_is_inside(from, from_len, to, to_len))
+    return 0;
+  lua_newtable(L);
+  if (from_len == to_len && memcmp(from, to, from_len) == 0)
+    return 1;
+  TreeNode *node = node_detach(from_dir, (uint32_t)i);
+  tree->generation++;
+  int64_t j = node_find(to_dir, to_name, to_name_len, -1);
+  TreePath path = { 0 };
+  if (j >= 0 && path_reserve(&path, to_len + 1)) {
+    memcpy(path.data, to, to_len - to_name_len);
+    path.len = to_len > to_name_len ? to_len - to_name_len - 1 : 0;
+    push_dirs(L, &path, to_dir->children[j]);
+    node_free(node_detach(to_dir, (uint32_t)j));
+  }
+  free(path.data);
+  TreeNode *renamed = realloc(node, sizeof(TreeNode) + to_name_len + 1);
+  if (renamed) {
+    node = renamed;
+    memcpy(node->name, to_name, to_name_len);
+    node->name[to_name_len] = '\0';
+    node->name_len = (uint16_t)to_name_len;
+    for (uint32_t k = 0; k < node->child_count; k++)
+      node->children[k]->parent = node;
+  }
+  if (!renamed || !node_insert(to_dir, node_lower_bound(to_dir, node->name, node->name_len, node->dir), node)) {
+    node_free(node);
+    return luaL_error(L, "out of memory");
+  }
+  return 1;
+}
+
+/* tree:remove(filename) removes an entry and what's below it, and returns the filenames of the directories that were removed */
+static int f_tree_remove(lua_State *L) {
+  lua_settop(L, 2);
+  lua_pushnil(L);
+  f_tree_replace(L);
+  return 1;
+}
+
+typedef struct {
+  uint64_t generation;
+  bool started, done;
+  /* the walked directories, with the index of their next entry and their path length */
+  TreeNode **nodes;
+  uint32_t *indexes;
+  size_t *lens;
+  int depth, capacity;
+  /* the last entry returned */
+  TreePath path;
+  bool last_dir;
+  size_t root_len;
+} TreeCursor;
+
+static bool cursor_push(TreeCursor *cursor, TreeNode *node, uint32_t index) {
+  if (cursor->depth == cursor->capacity) {
+    int capacity = cursor->capacity ? cursor->capacity * 2 : 16;
+    TreeNode **nodes = realloc(cursor->nodes, capacity * sizeof(TreeNode*));
+    if (nodes)
+      cursor->nodes = nodes;
+    uint32_t *indexes = realloc(cursor->indexes, capacity * sizeof(uint32_t));
+    if (indexes)
+      cursor->indexes = indexes;
+    size_t *lens = realloc(cursor->lens, capacity * sizeof(size_t));
+    if (lens)
+      cursor->lens = lens;
+    if (!nodes || !indexes || !lens)
+      return false;
+    cursor->capacity = capacity;
+  }
+  cursor->nodes[cursor->depth] = node;
+  cursor->indexes[cursor->depth] = index;
+  cursor->lens[cursor->depth] = cursor->path.len;
+  cursor->depth++;
+  return true;
+}
+
+/* walks down to the entry that comes after the last one returned, after the tree changed */
+static bool cursor_seek(TreeCursor *cursor, ProjectTree *tree) {
+  const char *path = cursor->path.data;
+  size_t len = cursor->path.len;
+  cursor->depth = 0;
+  cursor->path.len = 0;
+  TreeNode *node = tree_find(tree, path, cursor->root_len, false, NULL, NULL);
+  if (!node)
+    return false;
+  cursor->path.len = cursor->root_len;
+  if (!cursor->started)
+    return cursor_push(cursor, node, 0);
+  size_t start = cursor->root_len ? cursor->root_len + 1 : 0;
+  while (true) {
+    size_t end = start;
+    while (end < len && path[end] != PATHSEP)
+      end++;
+    bool last = end == len, is_dir = !last || cursor->last_dir;
+    int64_t i = node_find(node, path + start, end - start, is_dir);
+    if (i < 0)
+      return cursor_push(cursor, node, node_lower_bound(node, path + start, end - start, is_dir));
+    if (!cursor_push(cursor, node, (uint32_t)i + 1))
+      return false;
+    node = node->children[i];
+    cursor->path.len = end;
+    if (last)
+      return !node->dir || cursor_push(cursor, node, 0);
+    start = end + 1;
+  }
+}
+
+static int f_cursor_gc(lua_State *L) {
+  TreeCursor *cursor = lua_touserdata(L, 1);
+  free(cursor->nodes);
+  free(cursor->indexes);
+  free(cursor->lens);
+  free(cursor->path.data);
+  memset(cursor, 0, sizeof(*cursor));
+  return 0;
+}
+
+static int f_cursor_next(lua_State *L) {
+  ProjectTree *tree = check_tree(L, lua_upvalueindex(1));
+  TreeCursor *cursor = lua_touserdata(L, lua_upvalueindex(2));
+  if (cursor->done)
+    return 0;
+  if (cursor->generation != tree->generation || !cursor->started) {
+    if (!cursor_seek(cursor, tree)) {
+      cursor->done = true;
+      return 0;
+    }
+    cursor->generation = tree->generation;
+  }
+  while (cursor->depth > 0) {
+    int top = cursor->depth - 1;
+    TreeNode *dir = cursor->nodes[top];
+    if (cursor->indexes[top] == dir->child_count) {
+      cursor->depth--;
+      continue;
+    }
+    TreeNode *node = dir->children[cursor->indexes[top]++];
+    cursor->path.len = cursor->lens[top];
+    path_push(&cursor->path, node->name, node->name_len);
+    push_item(L, &cursor->path, node);
+    cursor->started = true;
+    cursor->last_dir = node->dir;
+    if (node->dir && node->child_count > 0 && !cursor_push(cursor, node, 0))
+      return luaL_error(L, "out of memory");
+    return 1;
+  }
+  cursor->done = true;
+  return 0;
+}
+
+/*
+** tree:entries(dirpath?) returns an iterator over the entries below a directory, the root by
+** default, in dir.files order; the tree can change while it's being iterated.
+*/
+static int f_tree_entries(lua_State *L) {
+  check_tree(L, 1);
+  size_t len;
+  const char *dirpath = luaL_optlstring(L, 2, "", &len);
+  lua_settop(L, 1);
+  TreeCursor *cursor = lua_newuserdata(L, sizeof(TreeCursor));
+  memset(cursor, 0, sizeof(TreeCursor));
+  if (luaL_newmetatable(L, "ProjectTreeCursor")) {
+    lua_pushcfunction(L, f_cursor_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  if (!path_reserve(&cursor->path, len + 1))
+    return luaL_error(L, "out of memory");
+  memcpy(cursor->path.data, dirpath, len);
+  cursor->path.len = cursor->root_len = len;
+  lua_pushcclosure(L, f_cursor_next, 2);
+  return 1;
+}
+
+static const luaL_Reg tree_lib[] = {
+  { "get",              f_tree_get              },
+  { "list",             f_tree_list             },
+  { "count",            f_tree_count            },
+  { "entries",          f_tree_entries          },
+  { "replace",          f_tree_replace          },
+  { "replace_children", f_tree_replace_children },
+  { "move",             f_tree_move             },
+  { "remove",           f_tree_remove           },
+  { "__gc",             f_tree_gc               },
+  { NULL, NULL }
+};
+
+ProjectTree *project_tree_new(lua_State *L) {
+  ProjectTree *tree = lua_newuserdata(L, sizeof(ProjectTree));
+  memset(tree, 0, sizeof(ProjectTree));
+  if (luaL_newmetatable(L, API_TYPE_PROJECT_TREE)) {
+    luaL_setfuncs(L, tree_lib, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+  if (!(tree->root = node_new("", 0, true, false, 0, 0)))
+    luaL_error(L, "can't create project tree: out of memory");
+  return tree;
+}
+
+ProjectTree *project_tree_check(lua_State *L, int idx) {
+  return check_tree(L, idx);
+}
+
+/* system.project_tree() returns an empty tree, that scan:read can add entries to */
+int f_project_tree(lua_State *L) {
+  project_tree_new(L);
+  return 1;
+}
@@ -1,4 +1,5 @@
 #include <string.h>
+#include <math.h>
 #include "api.h"
 #include "../renderer.h"
 #include "../rencache.h"
@@ -6,6 +7,10 @@
 
 // a reference index to a table that stores the fonts
 static int RENDERER_FONT_REF = LUA_NOREF;
+// a reference index to a table that stores the fonts of each display list, by id
+static int RENDERER_LIST_REF = LUA_NOREF;
+// a reference to the font table of the display list being recorded
+static int RENDERER_RECORDING_REF = LUA_NOREF;
 
 static int font_get_options(
   lua_State *L,
@@ -180,7 +185,10 @@ static int f_font_get_path(lua_State *L) {
 static int f_font_set_tab_size(lua_State *L) {
   RenFont* fonts[FONT_FALLBACK_MAX]; font_retrieve(L, fonts, 1);
   int n = luaL_checknumber(L, 2);
-  ren_font_group_set_tab_size(fonts, n);
+  // display lists hold text measured with the old tab size; docviews set it on
+  // every draw, so only drop them when it actually changes
+  if (ren_font_group_set_tab_size(fonts, n))
+    rencache_drop_lists();
   return 0;
 }
 
@@ -202,6 +210,36 @@ static int f_font_get_width(lua_State *L) {
   return 1;
 }
 
+static bool is_ascii(const char *text, size_t len) {
+  for (size_t i = 0; i < len; ++i)
+    if ((unsigned char)text[i] >= 0x80) return false;
+  return true;
+}
+
+// takes either a string or a table of lines, of which only the first `max_lines` are read.
+static int f_font_warm(lua_State *L) {
+  RenFont* fonts[FONT_FALLBACK_MAX]; font_retrieve(L, fonts, 1);
+  size_t len;
+  if (lua_type(L, 2) != LUA_TTABLE) {
+    const char *text = luaL_checklstring(L, 2, &len);
+    ren_font_group_warm(fonts, text, len);
+    return 0;
+  }
+  lua_Integer count = luaL_len(L, 2);
+  lua_Integer max_lines = luaL_optinteger(L, 3, count);
+  if (max_lines < count) count = max_lines;
+  for (lua_Integer i = 1; i <= count; ++i) {
+    // ASCII is always queued when the font is loaded, so most lines need no decoding
+    if (lua_rawgeti(L, 2, i) == LUA_TSTRING) {
+      const char *text = lua_tolstring(L, -1, &len);
+      if (!is_ascii(text, len))
+        ren_font_group_warm(fonts, text, len);
+    }
+    lua_pop(L, 1);
+  }
+  return 0;
+}
+
 static int f_font_get_height(lua_State *L) {
   RenFont* fonts[FONT_FALLBACK_MAX]; font_retrieve(L, fonts, 1);
   lua_pushnumber(L, ren_font_group_get_height(fonts));
@@ -218,9 +256,40 @@ static int f_font_set_size(lua_State *L) {
   RenFont* fonts[FONT_FALLBACK_MAX]; font_retrieve(L, fonts, 1);
   float size = luaL_checknumber(L, 2);
   ren_font_group_set_size(&window_renderer, fonts, size);
+  rencache_drop_lists();
   return 0;
 }
 
+static int f_font_get_atlas_stats(lua_State *L) {
+  RenFont* fonts[FONT_FALLBACK_MAX]; font_retrieve(L, fonts, 1);
+  RenAtlasStats stats;
+  ren_font_group_get_atlas_stats(fonts, &stats);
+  lua_newtable(L);
+  lua_pushinteger(L, stats.size);
+  lua_setfield(L, -2, "size");
+  lua_pushinteger(L, stats.capacity);
+  lua_setfield(L, -2, "capacity");
+  lua_pushinteger(L, stats.used);
+  lua_setfield(L, -2, "used");
+  lua_pushinteger(L, stats.glyphs);
+  lua_setfield(L, -2, "glyphs");
+  lua_pushinteger(L, stats.evictions);
+  lua_setfield(L, -2, "evictions");
+  return 1;
+}
+
+static int f_font_get_width_cache_stats(lua_State *L) {
+  RenFont* fonts[FONT_FALLBACK_MAX]; font_retrieve(L, fonts, 1);
+  unsigned int hits, misses;
+  ren_font_group_get_width_cache_stats(fonts, &hits, &misses);
+  lua_newtable(L);
+  lua_pushinteger(L, hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushinteger(L, misses);
+  lua_setfield(L, -2, "misses");
+  return 1;
+}
+
 static int color_value_error(lua_State *L, int idx, int table_idx) {
   const char *type, *msg;
   // generate an appropriate error message
@@ -274,6 +343,51 @@ static int f_show_debug(lua_State *L) {
 }
 
 
+static int f_record_commands(lua_State *L) {
+  const char *path = luaL_optstring(L, 1, NULL);
+  if (!rencache_record_commands(path)) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "can't open %s for recording", path);
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+static int f_get_stats(lua_State *L) {
+  RenCacheStats stats;
+  rencache_get_stats(&stats);
+  lua_createtable(L, 0, 13);
+  lua_pushinteger(L, stats.commands); lua_setfield(L, -2, "commands");
+  lua_pushinteger(L, stats.command_bytes); lua_setfield(L, -2, "command_bytes");
+  lua_pushinteger(L, stats.lists_replayed); lua_setfield(L, -2, "lists_replayed");
+  lua_pushinteger(L, stats.culled); lua_setfield(L, -2, "culled");
+  lua_pushinteger(L, stats.cells); lua_setfield(L, -2, "cells");
+  lua_pushinteger(L, stats.cells_dirty); lua_setfield(L, -2, "cells_dirty");
+  lua_pushinteger(L, stats.rects); lua_setfield(L, -2, "rects");
+  lua_pushinteger(L, stats.pixels); lua_setfield(L, -2, "pixels");
+  lua_pushinteger(L, stats.pixels_saved); lua_setfield(L, -2, "pixels_saved");
+  lua_pushinteger(L, stats.moved_pixels); lua_setfield(L, -2, "moved_pixels");
+  lua_pushnumber(L, stats.lua_time); lua_setfield(L, -2, "lua_time");
+  lua_pushnumber(L, stats.end_frame_time); lua_setfield(L, -2, "end_frame_time");
+  lua_pushnumber(L, stats.update_rects_time); lua_setfield(L, -2, "update_rects_time");
+  return 1;
+}
+
+
+static int f_set_render_threads(lua_State *L) {
+  rencache_set_thread_count(luaL_checkinteger(L, 1));
+  return 0;
+}
+
+
+static int f_set_glyph_cache_dir(lua_State *L) {
+  ren_set_glyph_cache_dir(luaL_optstring(L, 1, NULL));
+  return 0;
+}
+
+
 static int f_get_size(lua_State *L) {
   int w, h;
   ren_get_size(&window_renderer, &w, &h);
@@ -283,17 +397,68 @@ static int f_get_size(lua_State *L) {
 }
 
 
+static void stop_recording(lua_State *L) {
+  luaL_unref(L, LUA_REGISTRYINDEX, RENDERER_RECORDING_REF);
+  RENDERER_RECORDING_REF = LUA_NOREF;
+}
+
+
 static int f_begin_frame(UNUSED lua_State *L) {
   rencache_begin_frame(&window_renderer);
+  stop_recording(L);
   return 0;
 }
 
 
 static int f_end_frame(UNUSED lua_State *L) {
   rencache_end_frame(&window_renderer);
+  stop_recording(L);
   // clear the font reference table
   lua_newtable(L);
   lua_rawseti(L, LUA_REGISTRYINDEX, RENDERER_FONT_REF);
+  // release the fonts of the display lists that were dropped
+  lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_LIST_REF);
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    lua_pop(L, 1);
+    size_t len;
+    const char *id = lua_tolstring(L, -1, &len);
+    if (!rencache_has_list(id, len)) {
+      lua_pushvalue(L, -1);
+      lua_pushnil(L);
+      lua_rawset(L, -4);
+    }
+  }
+  lua_pop(L, 1);
+  return 0;
+}
+
+
+static int f_begin_list(lua_State *L) {
+  size_t id_len, version_len;
+  const char *id = luaL_checklstring(L, 1, &id_len);
+  const char *version = luaL_checklstring(L, 2, &version_len);
+  bool nested = RENDERER_RECORDING_REF != LUA_NOREF;
+  bool draw = rencache_begin_list(id, id_len, version, version_len);
+  if (draw && !nested) {
+    // the fonts of a list are kept alive for as long as it may be replayed
+    lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_LIST_REF);
+    lua_pushlstring(L, id, id_len);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    RENDERER_RECORDING_REF = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+  }
+  lua_pushboolean(L, draw);
+  return 1;
+}
+
+
+static int f_end_list(lua_State *L) {
+  rencache_end_list();
+  if (!rencache_is_recording())
+    stop_recording(L);
   return 0;
 }
 
@@ -327,21 +492,33 @@ static int f_draw_rect(lua_State *L) {
   return 0;
 }
 
-static int f_draw_text(lua_State *L) {
-  RenFont* fonts[FONT_FALLBACK_MAX];
-  font_retrieve(L, fonts, 1);
-
+// keeps the font at idx alive until the commands using it have been drawn
+static void reference_font(lua_State *L, int idx) {
+  idx = lua_absindex(L, idx);
   // stores a reference to this font to the reference table
   lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_FONT_REF);
   if (lua_istable(L, -1))
   {
-    lua_pushvalue(L, 1);
+    lua_pushvalue(L, idx);
     lua_pushboolean(L, 1);
     lua_rawset(L, -3);
   } else {
     fprintf(stderr, "warning: failed to reference count fonts\n");
   }
   lua_pop(L, 1);
+  if (RENDERER_RECORDING_REF != LUA_NOREF) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_RECORDING_REF);
+    lua_pushvalue(L, idx);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+  }
+}
+
+static int f_draw_text(lua_State *L) {
+  RenFont* fonts[FONT_FALLBACK_MAX];
+  font_retrieve(L, fonts, 1);
+  reference_font(L, 1);
 
   size_t len;
   const char *text = luaL_checklstring(L, 2, &len);
@@ -353,14 +530,69 @@ static int f_draw_text(lua_State *L) {
   return 1;
 }
 
+/* draws a line of highlighter tokens, an array of alternating types and texts.
+** fonts and colors are looked up by token type, types without a font use the
+** default one. the newline ending the line is not drawn, and drawing stops as
+** soon as a token ends past max_x */
+static int f_draw_tokens(lua_State *L) {
+  RenFont* default_fonts[FONT_FALLBACK_MAX];
+  RenFont* fonts[FONT_FALLBACK_MAX];
+  font_retrieve(L, default_fonts, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  luaL_checktype(L, 3, LUA_TTABLE);
+  luaL_checktype(L, 4, LUA_TTABLE);
+  double x = luaL_checknumber(L, 5);
+  int y = luaL_checknumber(L, 6);
+  double max_x = luaL_optnumber(L, 7, HUGE_VAL);
+  reference_font(L, 1);
+
+  const void *last_font = NULL;
+  int count = lua_rawlen(L, 3);
+  for (int i = 1; i + 1 <= count && x <= max_x; i += 2) {
+    lua_rawgeti(L, 3, i);
+    lua_rawgeti(L, 3, i + 1);
+    size_t len;
+    const char *text = luaL_checklstring(L, -1, &len);
+    if (i + 1 == count && len > 0 && text[len - 1] == '\n')
+      len--;
+    if (len > 0) {
+      lua_pushvalue(L, -2);
+      lua_rawget(L, 2);
+      if (lua_isnil(L, -1)) {
+        memcpy(fonts, default_fonts, sizeof(fonts));
+        last_font = NULL;
+      } else if (lua_topointer(L, -1) != last_font) {
+        font_retrieve(L, fonts, lua_gettop(L));
+        reference_font(L, -1);
+        last_font = lua_topointer(L, -1);
+      }
+      lua_pushvalue(L, -3);
+      lua_rawget(L, 4);
+      RenColor color = checkcolor(L, lua_gettop(L), 255);
+      x = rencache_draw_text(&window_renderer, fonts, text, len, x, y, color);
+      lua_pop(L, 2);
+    }
+    lua_pop(L, 2);
+  }
+  lua_pushnumber(L, x);
+  return 1;
+}
+
 static const luaL_Reg lib[] = {
   { "show_debug",         f_show_debug         },
+  { "get_stats",          f_get_stats          },
+  { "record_commands",    f_record_commands    },
+  { "set_glyph_cache_dir", f_set_glyph_cache_dir },
+  { "set_render_threads", f_set_render_threads },
   { "get_size",           f_get_size           },
   { "begin_frame",        f_begin_frame        },
   { "end_frame",          f_end_frame          },
   { "set_clip_rect",      f_set_clip_rect      },
   { "draw_rect",          f_draw_rect          },
   { "draw_text",          f_draw_text          },
+  { "draw_tokens",        f_draw_tokens        },
+  { "begin_list",         f_begin_list         },
+  { "end_list",           f_end_list           },
   { NULL,                 NULL                 }
 };
 
@@ -371,10 +603,13 @@ static const luaL_Reg fontLib[] = {
   { "group",              f_font_group              },
   { "set_tab_size",       f_font_set_tab_size       },
   { "get_width",          f_font_get_width          },
+  { "warm",               f_font_warm               },
   { "get_height",         f_font_get_height         },
   { "get_size",           f_font_get_size           },
   { "set_size",           f_font_set_size           },
   { "get_path",           f_font_get_path           },
+  { "get_atlas_stats",    f_font_get_atlas_stats    },
+  { "get_width_cache_stats", f_font_get_width_cache_stats },
   { NULL, NULL }
 };
 
@@ -382,6 +617,8 @@ int luaopen_renderer(lua_State *L) {
   // gets a reference on the registry to store font data
   lua_newtable(L);
   RENDERER_FONT_REF = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_newtable(L);
+  RENDERER_LIST_REF = luaL_ref(L, LUA_REGISTRYINDEX);
 
   luaL_newlib(L, lib);
   luaL_newmetatable(L, API_TYPE_FONT);
@@ -0,0 +1,1246 @@
+#include "api.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+  LPWSTR utfconv_utf8towc(const char *str);
+  #define PATHSEP '\\'
+#else
+  #include <dirent.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/types.h>
+  #include <sys/stat.h>
+  #define PATHSEP '/'
+#endif
+
+#ifndef PATH_MAX
+  #define PATH_MAX 4096
+#endif
+
+#define SCAN_THREADS_MAX 8
+#define SCAN_BATCH_SIZE 4096
+#define INDEX_MAGIC "LXPI"
+#define INDEX_VERSION 1
+#define INDEX_DIR 1
+#define INDEX_SYMLINK 2
+
+/*
+** system.scan_tree walks a project directory on worker threads: each directory is read,
+** filtered with the ignore rules and sorted by a worker, which then queues its subdirectories.
+** The reading thread walks the resulting tree depth first, in system.path_compare order, and
+** hands out the entries in batches as soon as the directories they're in have been read.
+*/
+
+typedef struct ScanNode ScanNode;
+
+typedef struct {
+  char *name;
+  size_t name_len;
+  bool dir, symlink;
+  int64_t size, modified;
+  ScanNode *child;
+} ScanEntry;
+
+struct ScanNode {
+  char *path;               /* relative to the root, "" for the root */
+  size_t path_len;
+  ScanEntry *entries;
+  char *names;
+  int count;
+  bool ready;
+  const IgnoreDir *ignore;  /* nearest directory with ignore files for the entries */
+  bool index_stale;         /* ignore files changed since the index was made, here or above */
+  bool has_modified;        /* whether modified was already stat'ed with the entry for the directory */
+  int64_t modified;
+  ScanNode *next_job, *next_node;
+};
+
+typedef struct {
+  ScanNode *node;
+  int index;
+  bool opened;
+} ScanFrame;
+
+typedef struct {
+  const char *name;         /* in the index data, not terminated */
+  uint32_t name_len, parent;
+  bool dir, symlink;
+  int64_t size, modified;
+} IndexEntry;
+
+typedef struct {
+  char *path;               /* relative to the root, "" for the root */
+  size_t path_len;
+  int64_t modified;
+  uint32_t first, count;    /* its entries, in ProjectIndex.children */
+} IndexDir;
+
+typedef struct {
+  char *data;
+  IndexEntry *entries;
+  uint32_t entry_count;
+  IndexDir *dirs;
+  uint32_t dir_count;
+  uint32_t *children;
+  uint32_t *table;          /* directories by path, as their index + 1 */
+  uint32_t table_size;
+  int64_t time;
+} ProjectIndex;
+
+typedef struct {
+  char *root;
+  size_t root_len;
+  IgnoreRules *rules;
+  int rules_ref;
+  IgnoreDir *ignore_dirs;
+  const ProjectIndex *index;
+  int index_ref;
+  int64_t size_limit;
+  bool recurse;
+  /* when listing given entries, the node they're looked up in instead of reading it */
+  ScanNode *named;
+  char **names;
+  int name_count;
+  SDL_mutex *mutex;
+  SDL_cond *has_jobs, *node_ready;
+  ScanNode *jobs, *nodes;
+  bool quit;
+  SDL_Thread *threads[SCAN_THREADS_MAX];
+  int thread_count;
+  /* only used by the thread reading the results */
+  ScanFrame *frames;
+  int frame_count, frame_capacity;
+  int listed, max_entries, batch;
+  uint32_t deadline;
+  bool has_deadline, complete, done;
+} Scan;
+
+static int compare_entries(const void *a, const void *b) {
+  const ScanEntry *e1 = a, *e2 = b;
+  if (e1->dir != e2->dir)
+    return e1->dir ? -1 : 1;
+  if (path_compare(e1->name, e1->name_len, !e1->dir, e2->name, e2->name_len, !e2->dir))
+    return -1;
+  return path_compare(e2->name, e2->name_len, !e2->dir, e1->name, e1->name_len, !e1->dir) ? 1 : 0;
+}
+
+typedef struct {
+  ScanEntry *entries;
+  int count, capacity;
+  char *names;
+  size_t names_len, names_capacity;
+  char fullname[PATH_MAX + 1];
+  size_t prefix_len;
+  const IgnoreDir *ignore;
+} ScanListing;
+
+static bool listing_init(ScanListing *listing, const ScanNode *node) {
+  memset(listing, 0, sizeof(*listing));
+  if (node->path_len + 2 >= sizeof(listing->fullname))
+    return false;
+  listing->ignore = node->ignore;
+  listing->fullname[0] = '/';
+  memcpy(listing->fullname + 1, node->path, node->path_len);
+  listing->prefix_len = node->path_len + 1;
+  if (node->path_len > 0)
+    listing->fullname[listing->prefix_len++] = '/';
+  for (size_t i = 0; i < listing->prefix_len; i++)
+    if (listing->fullname[i] == '\\')
+      listing->fullname[i] = '/';
+  return true;
+}
+
+/* checks an entry against the ignore rules; dir is only a guess when stat is false */
+static bool listing_filter(Scan *scan, ScanListing *listing, const char *name, size_t name_len, bool dir) {
+  if (listing->prefix_len + name_len >= sizeof(listing->fullname))
+    return false;
+  memcpy(listing->fullname + listing->prefix_len, name, name_len + 1);
+  return !ignore_rules_match(scan->rules, listing->ignore, listing->fullname, listing->prefix_len + name_len, name, name_len, dir);
+}
+
+static bool listing_add(ScanListing *listing, const char *name, size_t name_len, bool dir, bool symlink, int64_t size, int64_t modified) {
+  if (listing->count == listing->capacity) {
+    int capacity = listing->capacity ? listing->capacity * 2 : 64;
+    ScanEntry *entries = realloc(listing->entries, capacity * sizeof(ScanEntry));
+    if (!entries)
+      return false;
+    listing->entries = entries, listing->capacity = capacity;
+  }
+  if (listing->names_len + name_len + 1 > listing->names_capacity) {
+    size_t capacity = listing->names_capacity ? listing->names_capacity * 2 : 1024;
+    while (capacity < listing->names_len + name_len + 1)
+      capacity *= 2;
+    char *names = realloc(listing->names, capacity);
+    if (!names)
+      return false;
+    listing->names = names, listing->names_capacity = capacity;
+  }
+  /* names are stored as offsets until the buffer stops moving */
+  listing->entries[listing->count++] = (ScanEntry) { (char*)(uintptr_t)listing->names_len, name_len, dir, symlink, size, modified, NULL };
+  memcpy(listing->names + listing->names_len, name, name_len);
+  listing->names[listing->names_len + name_len] = '\0';
+  listing->names_len += name_len + 1;
+  return true;
+}
+
+#ifdef _WIN32
+static int64_t filetime_to_unix(FILETIME time) {
+  return ((((int64_t)time.dwHighDateTime << 32) | time.dwLowDateTime) / 10000000) - 11644473600LL;
+}
+
+static bool listing_add_entry(Scan *scan, ScanListing *listing, const char *name, size_t name_len, DWORD attributes, DWORD size_high, DWORD size_low, FILETIME time) {
+  bool dir = attributes & FILE_ATTRIBUTE_DIRECTORY;
+  if (!listing_filter(scan, listing, name, name_len, dir))
+    return true;
+  int64_t size = ((int64_t)size_high << 32) | size_low;
+  return size >= scan->size_limit || listing_add(listing, name, name_len, dir, false, size, filetime_to_unix(time));
+}
+
+static int scan_list_names(Scan *scan, ScanNode *node, ScanListing *listing) {
+  for (int i = 0; i < scan->name_count; i++) {
+    const char *name = scan->names[i];
+    size_t len = scan->root_len + node->path_len + strlen(name) + 3;
+    char *path = malloc(len);
+    if (!path)
+      return ENOMEM;
+    snprintf(path, len, node->path_len ? "%s\\%s\\%s" : "%s\\%s%s", scan->root, node->path, name);
+    LPWSTR wpath = utfconv_utf8towc(path);
+    free(path);
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    bool found = wpath && GetFileAttributesExW(wpath, GetFileExInfoStandard, &data);
+    free(wpath);
+    if (found && !listing_add_entry(scan, listing, name, strlen(name), data.dwFileAttributes, data.nFileSizeHigh, data.nFileSizeLow, data.ftLastWriteTime))
+      break;
+  }
+  return 0;
+}
+
+static int scan_list_dir(Scan *scan, ScanNode *node, ScanListing *listing) {
+  if (node == scan->named)
+    return scan_list_names(scan, node, listing);
+  size_t len = scan->root_len + node->path_len + 3;
+  char *pattern = malloc(len);
+  if (!pattern)
+    return ENOMEM;
+  snprintf(pattern, len, node->path_len ? "%s\\%s\\*" : "%s\\*", scan->root, node->path);
+  LPWSTR wpattern = utfconv_utf8towc(pattern);
+  free(pattern);
+  if (!wpattern)
+    return EINVAL;
+  WIN32_FIND_DATAW fd;
+  HANDLE find_handle = FindFirstFileExW(wpattern, FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, 0);
+  free(wpattern);
+  if (find_handle == INVALID_HANDLE_VALUE)
+    return ENOENT;
+  char name[MAX_PATH * 4];
+  do {
+    if (wcscmp(fd.cFileName, L".") == 0 || wcscmp(fd.cFileName, L"..") == 0)
+      continue;
+    int name_len = WideCharToMultiByte(CP_UTF8, 0, fd.cFileName, -1, name, sizeof(name), NULL, NULL) - 1;
+    if (name_len > 0 && !listing_add_entry(scan, listing, name, name_len, fd.dwFileAttributes, fd.nFileSizeHigh, fd.nFileSizeLow, fd.ftLastWriteTime))
+      break;
+  } while (FindNextFileW(find_handle, &fd));
+  FindClose(find_handle);
+  return 0;
+}
+#else
+/* type is the one read from the directory, or DT_UNKNOWN; returns false when out of memory */
+static bool listing_add_entry(Scan *scan, ScanListing *listing, int dir_fd, const char *name, size_t name_len, int type) {
+  /* the type from the directory saves a stat on ignored entries; links and unknown types need one first */
+  bool known = type == DT_DIR || type == DT_REG;
+  if (known && !listing_filter(scan, listing, name, name_len, type == DT_DIR))
+    return true;
+  struct stat s;
+  if (fstatat(dir_fd, name, &s, 0) != 0 || !(S_ISDIR(s.st_mode) || S_ISREG(s.st_mode)))
+    return true;
+  bool is_dir = S_ISDIR(s.st_mode);
+  if (!known && !listing_filter(scan, listing, name, name_len, is_dir))
+    return true;
+  bool symlink = false;
+  struct stat ls;
+  if (is_dir)
+    symlink = type == DT_LNK || (type == DT_UNKNOWN && fstatat(dir_fd, name, &ls, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(ls.st_mode));
+  return s.st_size >= scan->size_limit || listing_add(listing, name, name_len, is_dir, symlink, s.st_size, s.st_mtime);
+}
+
+static int scan_list_dir(Scan *scan, ScanNode *node, ScanListing *listing) {
+  size_t len = scan->root_len + node->path_len + 2;
+  char *path = malloc(len);
+  if (!path)
+    return ENOMEM;
+  snprintf(path, len, node->path_len ? "%s/%s" : "%s", scan->root, node->path);
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  free(path);
+  DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+  if (!dir) {
+    int err = errno;
+    if (fd >= 0)
+      close(fd);
+    return err;
+  }
+  if (node == scan->named) {
+    for (int i = 0; i < scan->name_count; i++)
+      if (!listing_add_entry(scan, listing, dirfd(dir), scan->names[i], strlen(scan->names[i]), DT_UNKNOWN))
+        break;
+    closedir(dir);
+    return 0;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    const char *name = entry->d_name;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+      continue;
+    if (!listing_add_entry(scan, listing, dirfd(dir), name, strlen(name), entry->d_type))
+      break;
+  }
+  closedir(dir);
+  return 0;
+}
+#endif
+
+static uint32_t index_hash(const char *path, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    hash = (hash ^ (uint8_t)path[i]) * 16777619u;
+  return hash;
+}
+
+static const IndexDir *index_find_dir(const ProjectIndex *index, const char *path, size_t len) {
+  uint32_t mask = index->table_size - 1;
+  for (uint32_t i = index_hash(path, len) & mask; index->table[i]; i = (i + 1) & mask) {
+    const IndexDir *dir = &index->dirs[index->table[i] - 1];
+    if (dir->path_len == len && memcmp(dir->path, path, len) == 0)
+      return dir;
+  }
+  return NULL;
+}
+
+static const IndexEntry *index_find_entry(const ProjectIndex *index, const IndexDir *dir, const char *name) {
+  size_t name_len = strlen(name);
+  for (uint32_t i = 0; i < dir->count; i++) {
+    const IndexEntry *entry = &index->entries[index->children[dir->first + i]];
+    if (entry->name_len == name_len && memcmp(entry->name, name, name_len) == 0)
+      return entry;
+  }
+  return NULL;
+}
+
+/* modification time and size of root/path/name, or of root/path without a name; false if it doesn't exist */
+static bool scan_stat(Scan *scan, const char *path, size_t path_len, const char *name, size_t name_len, int64_t *modified, int64_t *size) {
+  size_t len = scan->root_len + path_len + name_len + 3;
+  char *fullname = malloc(len);
+  if (!fullname)
+    return false;
+  int n = snprintf(fullname, len, "%s", scan->root);
+  if (path_len)
+    n += snprintf(fullname + n, len - n, "%c%s", PATHSEP, path);
+  if (name)
+    snprintf(fullname + n, len - n, "%c%.*s", PATHSEP, (int)name_len, name);
+#ifdef _WIN32
+  LPWSTR wpath = utfconv_utf8towc(fullname);
+  free(fullname);
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  bool found = wpath && GetFileAttributesExW(wpath, GetFileExInfoStandard, &data);
+  free(wpath);
+  if (found) {
+    *modified = filetime_to_unix(data.ftLastWriteTime);
+    *size = ((int64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+  }
+  return found;
+#else
+  struct stat s;
+  bool found = stat(fullname, &s) == 0;
+  free(fullname);
+  if (found) {
+    *modified = s.st_mtime;
+    *size = s.st_size;
+  }
+  return found;
+#endif
+}
+
+/* modification time and size of an entry of node, stat'ed relative to dir_fd when it's open */
+static bool scan_stat_entry(Scan *scan, ScanNode *node, int dir_fd, const IndexEntry *entry, int64_t *modified, int64_t *size) {
+#ifndef _WIN32
+  char name[FILENAME_MAX];
+  if (dir_fd >= 0 && entry->name_len < sizeof(name)) {
+    memcpy(name, entry->name, entry->name_len);
+    name[entry->name_len] = '\0';
+    struct stat s;
+    if (fstatat(dir_fd, name, &s, 0) != 0)
+      return false;
+    *modified = s.st_mtime, *size = s.st_size;
+    return true;
+  }
+#endif
+  return scan_stat(scan, node->path, node->path_len, entry->name, entry->name_len, modified, size);
+}
+
+/*
+** lists a directory from the index when it didn't change since the index was made, and returns
+** false when it has to be read; has_ignore tells whether it has ignore files of its own.
+** the entries are still stat'ed, since writing to a file doesn't change its directory; a file that
+** was over the size limit when the index was made isn't in it, and shows up once its directory
+** changes.
+*/
+static bool scan_list_indexed(Scan *scan, ScanNode *node, ScanListing *listing, bool has_ignore) {
+  const ProjectIndex *index = scan->index;
+  if (!index || node->index_stale || node == scan->named)
+    return false;
+  const IndexDir *dir = index_find_dir(index, node->path, node->path_len);
+  if (!dir)
+    return false;
+  /* its entries were filtered with the ignore files it had then; editing one doesn't change the directory */
+  static const char *ignore_files[] = { ".ignore", ".gitignore" };
+  int64_t modified, size;
+  for (size_t i = 0; i < sizeof(ignore_files) / sizeof(ignore_files[0]); i++) {
+    const IndexEntry *entry = index_find_entry(index, dir, ignore_files[i]);
+    if (!entry && !has_ignore)
+      continue;
+    bool found = scan_stat(scan, node->path, node->path_len, ignore_files[i], strlen(ignore_files[i]), &modified, &size);
+    if (found != (entry != NULL) || (entry && (entry->modified != modified || entry->size != size))) {
+      node->index_stale = true;
+      return false;
+    }
+  }
+  /* entries changed in the second the index was made in may not be in it */
+  modified = node->modified;
+  if ((!node->has_modified && !scan_stat(scan, node->path, node->path_len, NULL, 0, &modified, &size)) || modified != dir->modified || modified >= index->time)
+    return false;
+  int dir_fd = -1;
+#ifndef _WIN32
+  size_t len = scan->root_len + node->path_len + 2;
+  char *path = malloc(len);
+  if (path) {
+    snprintf(path, len, node->path_len ? "%s/%s" : "%s", scan->root, node->path);
+    dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(path);
+  }
+#endif
+  bool listed = true;
+  for (uint32_t i = 0; i < dir->count; i++) {
+    const IndexEntry *entry = &index->entries[index->children[dir->first + i]];
+    /* subdirectories are stat'ed here rather than when they're processed, to keep their entries up to date */
+    if (!scan_stat_entry(scan, node, dir_fd, entry, &modified, &size)) {
+      /* it was removed since, this one has to be read after all */
+      listing->count = 0, listing->names_len = 0;
+      listed = false;
+      break;
+    }
+    if (size >= scan->size_limit)
+      continue;
+    if (!listing_add(listing, entry->name, entry->name_len, entry->dir, entry->symlink, size, modified))
+      break;
+  }
+#ifndef _WIN32
+  if (dir_fd >= 0)
+    close(dir_fd);
+#endif
+  return listed;
+}
+
+static ScanNode *scan_node_new(const char *parent, size_t parent_len, const char *name, size_t name_len) {
+  ScanNode *node = calloc(1, sizeof(ScanNode));
+  if (!node)
+    return NULL;
+  node->path_len = parent_len ? parent_len + 1 + name_len : name_len;
+  if (!(node->path = malloc(node->path_len + 1))) {
+    free(node);
+    return NULL;
+  }
+  if (parent_len) {
+    memcpy(node->path, parent, parent_len);
+    node->path[parent_len] = PATHSEP;
+    memcpy(node->path + parent_len + 1, name, name_len + 1);
+  } else {
+    memcpy(node->path, name, name_len + 1);
+  }
+  return node;
+}
+
+#ifndef _WIN32
+/* whether a linked directory is the one it's in or one above it, which the scan would never get out of */
+static bool scan_is_loop(Scan *scan, const ScanNode *node, const char *name) {
+  size_t dir_len = scan->root_len + (node->path_len ? node->path_len + 1 : 0);
+  size_t len = dir_len + strlen(name) + 2;
+  char *path = malloc(len);
+  if (!path)
+    return true;
+  snprintf(path, len, node->path_len ? "%s/%s" : "%s", scan->root, node->path);
+  snprintf(path + dir_len, len - dir_len, "/%s", name);
+  struct stat target, s;
+  bool loop = stat(path, &target) != 0;
+  /* the directories from the root down to this one */
+  for (size_t i = scan->root_len; !loop && i <= dir_len; i++) {
+    if (path[i] != '/')
+      continue;
+    path[i] = '\0';
+    loop = stat(path, &s) != 0 || (s.st_dev == target.st_dev && s.st_ino == target.st_ino);
+    path[i] = '/';
+  }
+  free(path);
+  return loop;
+}
+#endif
+
+/* reads a directory into its node, queues its subdirectories and marks it as ready */
+static int scan_process(Scan *scan, ScanNode *node) {
+  IgnoreDir *ignore = ignore_dir_read(scan->rules, node->ignore, scan->root, node->path, node->path_len);
+  if (ignore) {
+    SDL_LockMutex(scan->mutex);
+    ignore_dirs_push(&scan->ignore_dirs, ignore);
+    SDL_UnlockMutex(scan->mutex);
+    node->ignore = ignore;
+  }
+  ScanListing listing;
+  int err = ENAMETOOLONG;
+  if (listing_init(&listing, node))
+    err = scan_list_indexed(scan, node, &listing, ignore != NULL) ? 0 : scan_list_dir(scan, node, &listing);
+  for (int i = 0; i < listing.count; i++)
+    listing.entries[i].name = listing.names + (uintptr_t)listing.entries[i].name;
+  if (listing.count > 0)
+    qsort(listing.entries, listing.count, sizeof(ScanEntry), compare_entries);
+  if (scan->recurse) {
+    for (int i = 0; i < listing.count && listing.entries[i].dir; i++) {
+#ifndef _WIN32
+      if (listing.entries[i].symlink && scan_is_loop(scan, node, listing.entries[i].name))
+        continue;
+#endif
+      ScanNode *child = scan_node_new(node->path, node->path_len, listing.entries[i].name, listing.entries[i].name_len);
+      if (child) {
+        child->ignore = node->ignore;
+        child->index_stale = node->index_stale;
+        child->modified = listing.entries[i].modified;
+        child->has_modified = true;
+      }
+      listing.entries[i].child = child;
+    }
+  }
+  SDL_LockMutex(scan->mutex);
+  /* queued last to first, so that workers pick directories up roughly in the order they're read back */
+  for (int i = listing.count - 1; i >= 0; i--) {
+    ScanNode *child = listing.entries[i].child;
+    if (child) {
+      child->next_job = scan->jobs;
+      scan->jobs = child;
+      child->next_node = scan->nodes;
+      scan->nodes = child;
+    }
+  }
+  node->entries = listing.entries;
+  node->names = listing.names;
+  node->count = listing.count;
+  node->ready = true;
+  SDL_CondBroadcast(scan->has_jobs);
+  SDL_CondBroadcast(scan->node_ready);
+  SDL_UnlockMutex(scan->mutex);
+  return err;
+}
+
+static int scan_worker(void *data) {
+  Scan *scan = data;
+  SDL_LockMutex(scan->mutex);
+  while (true) {
+    while (!scan->quit && !scan->jobs)
+      SDL_CondWait(scan->has_jobs, scan->mutex);
+    if (scan->quit)
+      break;
+    ScanNode *node = scan->jobs;
+    scan->jobs = node->next_job;
+    SDL_UnlockMutex(scan->mutex);
+    scan_process(scan, node);
+    SDL_LockMutex(scan->mutex);
+  }
+  SDL_UnlockMutex(scan->mutex);
+  return 0;
+}
+
+/* stops workers once they're done with their current directory, leaving the remaining jobs */
+static void scan_quit(Scan *scan) {
+  if (scan->mutex) {
+    SDL_LockMutex(scan->mutex);
+    scan->quit = true;
+    SDL_CondBroadcast(scan->has_jobs);
+    SDL_UnlockMutex(scan->mutex);
+  }
+}
+
+static void scan_stop(Scan *scan) {
+  scan_quit(scan);
+  for (int i = 0; i < scan->thread_count; i++)
+    SDL_WaitThread(scan->threads[i], NULL);
+  scan->thread_count = 0;
+}
+
+static void scan_push_frame(Scan *scan, ScanNode *node) {
+  if (scan->frame_count == scan->frame_capacity) {
+    int capacity = scan->frame_capacity ? scan->frame_capacity * 2 : 32;
+    ScanFrame *frames = realloc(scan->frames, capacity * sizeof(ScanFrame));
+    if (!frames) {
+      scan->complete = false;
+      return;
+    }
+    scan->frames = frames, scan->frame_capacity = capacity;
+  }
+  scan->frames[scan->frame_count++] = (ScanFrame) { node, 0, false };
+}
+
+static bool scan_past_deadline(Scan *scan) {
+  return scan->has_deadline && SDL_TICKS_PASSED(SDL_GetTicks(), scan->deadline);
+}
+
+/* pushes an item like those of dir.files, for the entry name of the directory path */
+static void push_entry_filename(lua_State *L, const char *path, size_t path_len, const char *name, size_t name_len) {
+  if (path_len) {
+    lua_pushlstring(L, path, path_len);
+    lua_pushlstring(L, (char[]) { PATHSEP }, 1);
+    lua_pushlstring(L, name, name_len);
+    lua_concat(L, 3);
+  } else {
+    lua_pushlstring(L, name, name_len);
+  }
+}
+
+static void push_entry(lua_State *L, const char *path, size_t path_len, const char *name, size_t name_len, bool dir, bool symlink, int64_t size, int64_t modified) {
+  lua_createtable(L, 0, 5);
+  push_entry_filename(L, path, path_len, name, name_len);
+  lua_setfield(L, -2, "filename");
+  lua_pushstring(L, dir ? "dir" : "file");
+  lua_setfield(L, -2, "type");
+  lua_pushinteger(L, size);
+  lua_setfield(L, -2, "size");
+  lua_pushinteger(L, modified);
+  lua_setfield(L, -2, "modified");
+#if __linux__
+  if (dir) {
+    lua_pushboolean(L, symlink);
+    lua_setfield(L, -2, "symlink");
+  }
+#else
+  (void)symlink;
+#endif
+}
+
+static int f_scan_read(lua_State *L) {
+  Scan *scan = luaL_checkudata(L, 1, API_TYPE_SCAN);
+  double timeout = luaL_optnumber(L, 2, -1);
+  ProjectTree *tree = lua_isnoneornil(L, 3) ? NULL : project_tree_check(L, 3);
+  if (scan->done) {
+    lua_pushnil(L);
+    lua_pushboolean(L, scan->complete);
+    lua_pushinteger(L, scan->listed);
+    return 3;
+  }
+  uint32_t wait_deadline = SDL_GetTicks() + (uint32_t)(timeout * 1000);
+  int count = 0, dir_count = 0;
+  lua_createtable(L, tree ? 0 : scan->batch, 0);
+  while (count < scan->batch && scan->frame_count > 0) {
+    ScanFrame *frame = &scan->frames[scan->frame_count - 1];
+    ScanNode *node = frame->node;
+    if (!frame->opened) {
+      /* without workers, directories are read here, from the top of the job stack down to this one */
+      while (scan->thread_count == 0 && !node->ready && scan->jobs) {
+        ScanNode *job = scan->jobs;
+        scan->jobs = job->next_job;
+        scan_process(scan, job);
+      }
+      SDL_LockMutex(scan->mutex);
+      while (!node->ready) {
+        uint32_t now = SDL_GetTicks(), wait = SDL_MUTEX_MAXWAIT;
+        if (scan->has_deadline) {
+          if (SDL_TICKS_PASSED(now, scan->deadline))
+            break;
+          wait = scan->deadline - now;
+        }
+        if (timeout >= 0) {
+          if (SDL_TICKS_PASSED(now, wait_deadline))
+            break;
+          wait = wait_deadline - now < wait ? wait_deadline - now : wait;
+        }
+        if (wait == SDL_MUTEX_MAXWAIT)
+          SDL_CondWait(scan->node_ready, scan->mutex);
+        else
+          SDL_CondWaitTimeout(scan->node_ready, scan->mutex, wait);
+      }
+      bool ready = node->ready;
+      SDL_UnlockMutex(scan->mutex);
+      if (!ready) {
+        /* a directory that can't be read before the deadline is left out, like the ones we don't descend into */
+        if (scan_past_deadline(scan)) {
+          scan->complete = false;
+          scan->frame_count--;
+          continue;
+        }
+        break;
+      }
+      frame->opened = true;
+      scan->listed += node->count;
+      /* no more directories will be descended into, the workers can stop */
+      if (scan->max_entries && scan->listed > scan->max_entries)
+        scan_quit(scan);
+    }
+    if (frame->index == node->count) {
+      free(node->entries);
+      free(node->names);
+      node->entries = NULL, node->names = NULL;
+      scan->frame_count--;
+      continue;
+    }
+    ScanEntry *entry = &node->entries[frame->index++];
+    if (!tree) {
+      push_entry(L, node->path, node->path_len, entry->name, entry->name_len, entry->dir, entry->symlink, entry->size, entry->modified);
+      lua_rawseti(L, -2, ++count);
+    } else {
+      if (!project_tree_add(tree, node->path, node->path_len, entry->name, entry->name_len, entry->dir, entry->symlink, entry->size, entry->modified))
+        return luaL_error(L, "can't add to project tree: out of memory");
+      count++;
+      if (entry->dir) {
+        push_entry_filename(L, node->path, node->path_len, entry->name, entry->name_len);
+        lua_rawseti(L, -2, ++dir_count);
+      }
+    }
+    if (entry->dir) {
+      if (entry->child && (!scan->max_entries || scan->listed <= scan->max_entries) && !scan_past_deadline(scan))
+        scan_push_frame(scan, entry->child);
+      else
+        scan->complete = false;
+    }
+  }
+  if (scan_past_deadline(scan))
+    scan_quit(scan);
+  if (scan->frame_count == 0) {
+    scan->done = true;
+    scan_stop(scan);
+  }
+  if (count == 0 && scan->done) {
+    lua_pop(L, 1);
+    return f_scan_read(L);
+  }
+  return 1;
+}
+
+static int f_scan_gc(lua_State *L) {
+  Scan *scan = luaL_checkudata(L, 1, API_TYPE_SCAN);
+  scan_stop(scan);
+  ScanNode *node = scan->nodes;
+  while (node) {
+    ScanNode *next = node->next_node;
+    free(node->entries);
+    free(node->names);
+    free(node->path);
+    free(node);
+    node = next;
+  }
+  ignore_dirs_free(scan->ignore_dirs);
+  luaL_unref(L, LUA_REGISTRYINDEX, scan->rules_ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, scan->index_ref);
+  for (int i = 0; i < scan->name_count; i++)
+    free(scan->names[i]);
+  free(scan->names);
+  free(scan->frames);
+  free(scan->root);
+  if (scan->has_jobs) SDL_DestroyCond(scan->has_jobs);
+  if (scan->node_ready) SDL_DestroyCond(scan->node_ready);
+  if (scan->mutex) SDL_DestroyMutex(scan->mutex);
+  memset(scan, 0, sizeof(*scan));
+  scan->rules_ref = scan->index_ref = LUA_NOREF;
+  return 0;
+}
+
+static const luaL_Reg scan_lib[] = {
+  { "read",    f_scan_read },
+  { "__gc",    f_scan_gc   },
+  { NULL, NULL }
+};
+
+/*
+** A project index keeps the complete listing of a project, so that it can be shown right away
+** when the project is opened again; a scan given the index then only reads the directories that
+** changed since it was made. The file starts with INDEX_MAGIC, INDEX_VERSION, the key it was made
+** with, the time it was made at, the modification time of the root and the number of entries; then
+** come the entries in dir.files order, each as its depth below the root, INDEX_DIR and INDEX_SYMLINK
+** flags, its name, size and modification time. Numbers are varints, zigzag encoded when signed.
+*/
+
+static FILE *index_open(const char *path, const char *mode) {
+#ifdef _WIN32
+  LPWSTR wpath = utfconv_utf8towc(path), wmode = utfconv_utf8towc(mode);
+  FILE *file = wpath && wmode ? _wfopen(wpath, wmode) : NULL;
+  free(wpath);
+  free(wmode);
+  return file;
+#else
+  return fopen(path, mode);
+#endif
+}
+
+typedef struct {
+  const uint8_t *p, *end;
+  bool ok;
+} IndexReader;
+
+static uint64_t index_read_varint(IndexReader *r) {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+    uint8_t byte = *r->p++;
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return value;
+  }
+  r->ok = false;
+  return 0;
+}
+
+static int64_t index_read_signed(IndexReader *r) {
+  uint64_t value = index_read_varint(r);
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static const char *index_read_bytes(IndexReader *r, uint64_t len) {
+  if ((uint64_t)(r->end - r->p) < len) {
+    r->ok = false;
+    return NULL;
+  }
+  const char *bytes = (const char*)r->p;
+  r->p += len;
+  return bytes;
+}
+
+/* adds a directory to the index, below the directory parent if it's not the root */
+static bool index_add_dir(ProjectIndex *index, uint32_t *capacity, int64_t parent_index, const char *name, size_t name_len, int64_t modified) {
+  if (index->dir_count == *capacity) {
+    *capacity = *capacity ? *capacity * 2 : 64;
+    IndexDir *dirs = realloc(index->dirs, *capacity * sizeof(IndexDir));
+    if (!dirs)
+      return false;
+    index->dirs = dirs;
+  }
+  const IndexDir *parent = parent_index >= 0 ? &index->dirs[parent_index] : NULL;
+  IndexDir *dir = &index->dirs[index->dir_count];
+  dir->path_len = parent && parent->path_len ? parent->path_len + 1 + name_len : name_len;
+  if (!(dir->path = malloc(dir->path_len + 1)))
+    return false;
+  if (parent && parent->path_len) {
+    memcpy(dir->path, parent->path, parent->path_len);
+    dir->path[parent->path_len] = PATHSEP;
+  }
+  memcpy(dir->path + dir->path_len - name_len, name, name_len);
+  dir->path[dir->path_len] = '\0';
+  dir->modified = modified;
+  dir->first = dir->count = 0;
+  index->dir_count++;
+  return true;
+}
+
+/* reads the entries of the index data, returning an error message if it can't be used */
+static const char *index_parse(ProjectIndex *index, size_t size, const char *key, size_t key_len) {
+  IndexReader r = { (const uint8_t*)index->data, (const uint8_t*)index->data + size, true };
+  const char *magic = index_read_bytes(&r, sizeof(INDEX_MAGIC));
+  if (!magic || memcmp(magic, INDEX_MAGIC, sizeof(INDEX_MAGIC) - 1) != 0 || magic[sizeof(INDEX_MAGIC) - 1] != INDEX_VERSION)
+    return "not a project index";
+  uint64_t stored_key_len = index_read_varint(&r);
+  const char *stored_key = index_read_bytes(&r, stored_key_len);
+  if (!r.ok || stored_key_len != key_len || memcmp(stored_key, key, key_len) != 0)
+    return "index was made with other settings";
+  index->time = index_read_signed(&r);
+  int64_t root_modified = index_read_signed(&r);
+  uint64_t count = index_read_varint(&r);
+  /* an entry takes at least 5 bytes */
+  if (!r.ok || count > (uint64_t)(r.end - r.p) / 5)
+    return "index is corrupted";
+  uint32_t dir_capacity = 0, *stack = malloc((count + 1) * sizeof(uint32_t));
+  index->entries = malloc((count + 1) * sizeof(IndexEntry));
+  if (!stack || !index->entries || !index_add_dir(index, &dir_capacity, -1, "", 0, root_modified)) {
+    free(stack);
+    return "out of memory";
+  }
+  /* the directories the last entry is in, from the root down */
+  uint64_t stack_len = 1;
+  stack[0] = 0;
+  const char *err = NULL;
+  for (uint64_t i = 0; i < count && !err; i++) {
+    uint64_t depth = index_read_varint(&r);
+    const char *flags = index_read_bytes(&r, 1);
+    uint64_t name_len = index_read_varint(&r);
+    const char *name = index_read_bytes(&r, name_len);
+    int64_t entry_size = index_read_signed(&r), modified = index_read_signed(&r);
+    if (!r.ok || depth >= stack_len || name_len == 0 || name_len > UINT32_MAX) {
+      err = "index is corrupted";
+      break;
+    }
+    IndexEntry *entry = &index->entries[index->entry_count++];
+    *entry = (IndexEntry) { name, (uint32_t)name_len, stack[depth], *flags & INDEX_DIR, *flags & INDEX_SYMLINK, entry_size, modified };
+    index->dirs[entry->parent].count++;
+    stack_len = depth + 1;
+    if (entry->dir) {
+      if (!index_add_dir(index, &dir_capacity, entry->parent, name, name_len, modified))
+        err = "out of memory";
+      stack[stack_len++] = index->dir_count - 1;
+    }
+  }
+  free(stack);
+  if (err)
+    return err;
+
+  uint32_t first = 0;
+  for (uint32_t i = 0; i < index->dir_count; i++) {
+    index->dirs[i].first = first;
+    first += index->dirs[i].count;
+    index->dirs[i].count = 0;
+  }
+  for (index->table_size = 16; index->table_size < index->dir_count * 2; index->table_size *= 2);
+  index->children = malloc((index->entry_count + 1) * sizeof(uint32_t));
+  index->table = calloc(index->table_size, sizeof(uint32_t));
+  if (!index->children || !index->table)
+    return "out of memory";
+  for (uint32_t i = 0; i < index->entry_count; i++) {
+    IndexDir *dir = &index->dirs[index->entries[i].parent];
+    index->children[dir->first + dir->count++] = i;
+  }
+  uint32_t mask = index->table_size - 1;
+  for (uint32_t i = 0; i < index->dir_count; i++) {
+    uint32_t slot = index_hash(index->dirs[i].path, index->dirs[i].path_len) & mask;
+    while (index->table[slot])
+      slot = (slot + 1) & mask;
+    index->table[slot] = i + 1;
+  }
+  return NULL;
+}
+
+static int f_index_gc(lua_State *L) {
+  ProjectIndex *index = luaL_checkudata(L, 1, API_TYPE_PROJECT_INDEX);
+  for (uint32_t i = 0; i < index->dir_count; i++)
+    free(index->dirs[i].path);
+  free(index->dirs);
+  free(index->entries);
+  free(index->children);
+  free(index->table);
+  free(index->data);
+  memset(index, 0, sizeof(*index));
+  return 0;
+}
+
+/* index:get_tree() returns the indexed entries, in a new project tree */
+static int f_index_get_tree(lua_State *L) {
+  ProjectIndex *index = luaL_checkudata(L, 1, API_TYPE_PROJECT_INDEX);
+  ProjectTree *tree = project_tree_new(L);
+  for (uint32_t i = 0; i < index->entry_count; i++) {
+    const IndexEntry *entry = &index->entries[i];
+    const IndexDir *dir = &index->dirs[entry->parent];
+    if (!project_tree_add(tree, dir->path, dir->path_len, entry->name, entry->name_len, entry->dir, entry->symlink, entry->size, entry->modified))
+      return luaL_error(L, "can't read project index: out of memory");
+  }
+  return 1;
+}
+
+static const luaL_Reg index_lib[] = {
+  { "get_tree", f_index_get_tree },
+  { "__gc",     f_index_gc       },
+  { NULL, NULL }
+};
+
+/*
+** system.load_project_index(filename, key) reads an index saved with the same key, or returns nil
+** and an error message.
+*/
+int f_load_project_index(lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+  size_t key_len;
+  const char *key = luaL_checklstring(L, 2, &key_len);
+  ProjectIndex *index = lua_newuserdata(L, sizeof(ProjectIndex));
+  memset(index, 0, sizeof(ProjectIndex));
+  if (luaL_newmetatable(L, API_TYPE_PROJECT_INDEX)) {
+    luaL_setfuncs(L, index_lib, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+
+  FILE *file = index_open(filename, "rb");
+  if (!file) {
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(errno));
+    return 2;
+  }
+  size_t size = 0, capacity = 1 << 16;
+  const char *err = NULL;
+  while (!err) {
+    char *data = realloc(index->data, capacity);
+    if (!data) {
+      err = "out of memory";
+      break;
+    }
+    index->data = data;
+    size += fread(index->data + size, 1, capacity - size, file);
+    if (size < capacity)
+      break;
+    capacity *= 2;
+  }
+  if (!err && ferror(file))
+    err = strerror(errno);
+  fclose(file);
+  if (!err)
+    err = index_parse(index, size, key, key_len);
+  if (err) {
+    lua_pushnil(L);
+    lua_pushstring(L, err);
+    return 2;
+  }
+  return 1;
+}
+
+typedef struct {
+  char *data;
+  size_t len, capacity;
+  bool failed;
+} IndexBuffer;
+
+static void index_write_bytes(IndexBuffer *b, const void *bytes, size_t len) {
+  if (b->len + len > b->capacity) {
+    size_t capacity = b->capacity ? b->capacity : 1 << 16;
+    while (capacity < b->len + len)
+      capacity *= 2;
+    char *data = b->failed ? NULL : realloc(b->data, capacity);
+    if (!data) {
+      b->failed = true;
+      return;
+    }
+    b->data = data, b->capacity = capacity;
+  }
+  memcpy(b->data + b->len, bytes, len);
+  b->len += len;
+}
+
+static void index_write_varint(IndexBuffer *b, uint64_t value) {
+  uint8_t bytes[10];
+  size_t len = 0;
+  do {
+    bytes[len] = value & 0x7F;
+    value >>= 7;
+    bytes[len++] |= value ? 0x80 : 0;
+  } while (value);
+  index_write_bytes(b, bytes, len);
+}
+
+static void index_write_signed(IndexBuffer *b, int64_t value) {
+  index_write_varint(b, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static void index_write_entry(void *data, int depth, const char *name, size_t name_len, bool dir, bool symlink, int64_t size, int64_t modified) {
+  IndexBuffer *b = data;
+  uint8_t flags = (dir ? INDEX_DIR : 0) | (symlink ? INDEX_SYMLINK : 0);
+  index_write_varint(b, depth);
+  index_write_bytes(b, &flags, 1);
+  index_write_varint(b, name_len);
+  index_write_bytes(b, name, name_len);
+  index_write_signed(b, size);
+  index_write_signed(b, modified);
+}
+
+/*
+** system.save_project_index(filename, key, tree, time, root_modified) saves a project tree with
+** the complete listing of a project as an index; time is when the listing was started, and
+** root_modified the modification time of the root then. Returns true, or nil and an error message.
+*/
+int f_save_project_index(lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+  size_t key_len;
+  const char *key = luaL_checklstring(L, 2, &key_len);
+  ProjectTree *tree = project_tree_check(L, 3);
+  int64_t time = luaL_checkinteger(L, 4), root_modified = luaL_checkinteger(L, 5);
+
+  IndexBuffer b = { 0 };
+  index_write_bytes(&b, INDEX_MAGIC, sizeof(INDEX_MAGIC) - 1);
+  index_write_bytes(&b, (uint8_t[]) { INDEX_VERSION }, 1);
+  index_write_varint(&b, key_len);
+  index_write_bytes(&b, key, key_len);
+  index_write_signed(&b, time);
+  index_write_signed(&b, root_modified);
+  index_write_varint(&b, project_tree_count(tree));
+  project_tree_walk(tree, index_write_entry, &b);
+  const char *err = b.failed ? "out of memory" : NULL;
+
+  size_t temporary_len = strlen(filename) + 5;
+  char *temporary = err ? NULL : malloc(temporary_len);
+  if (!err && !temporary)
+    err = "out of memory";
+  if (!err) {
+    snprintf(temporary, temporary_len, "%s.tmp", filename);
+    FILE *file = index_open(temporary, "wb");
+    if (!file) {
+      err = strerror(errno);
+    } else {
+      bool written = fwrite(b.data, 1, b.len, file) == b.len;
+      if (fclose(file) != 0 || !written)
+        err = strerror(errno);
+#ifdef _WIN32
+      LPWSTR wtemporary = utfconv_utf8towc(temporary), wpath = utfconv_utf8towc(filename);
+      if (!err && (!wtemporary || !wpath || !MoveFileExW(wtemporary, wpath, MOVEFILE_REPLACE_EXISTING)))
+        err = "can't replace the index";
+      if (err && wtemporary)
+        _wremove(wtemporary);
+      free(wtemporary);
+      free(wpath);
+#else
+      if (!err && rename(temporary, filename) != 0)
+        err = strerror(errno);
+      if (err)
+        remove(temporary);
+#endif
+    }
+  }
+  free(temporary);
+  free(b.data);
+  if (err) {
+    lua_pushnil(L);
+    lua_pushstring(L, err);
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+static int get_option_integer(lua_State *L, int idx, const char *key, lua_Integer def) {
+  lua_getfield(L, idx, key);
+  lua_Integer value = luaL_optinteger(L, -1, def);
+  lua_pop(L, 1);
+  return (int)value;
+}
+
+/*
+** system.scan_tree(root, ignore_spec, opts) starts listing root and the directories below it.
+** ignore_spec is a list of { pattern, use_path, match_dir } entries as dirwatch compiles them from
+** config.ignore_files, or rules from system.ignore_rules. opts can set path (a subdirectory of root
+** to list), names (to list only these entries of path, if they exist), recurse (false to list a
+** single directory), max_entries and timeout (in seconds; no directory is descended into once
+** either is exceeded), file_size_limit (in bytes), index (from system.load_project_index, to list
+** the directories that didn't change from it), threads and batch.
+** scan:read(timeout?, tree?) returns the next batch of entries, like dir.files items, waiting at
+** most timeout seconds for them; given a project tree, it adds them to it instead and returns the
+** filenames of the directories among them. Once all were read, it returns nil, whether every
+** directory was descended into, and the number of entries listed.
+*/
+int f_scan_tree(lua_State *L) {
+  size_t root_len;
+  const char *root = luaL_checklstring(L, 1, &root_len);
+  if (!lua_isnoneornil(L, 3))
+    luaL_checktype(L, 3, LUA_TTABLE);
+  else {
+    lua_settop(L, 2);
+    lua_newtable(L);
+  }
+
+  Scan *scan = lua_newuserdata(L, sizeof(Scan));
+  memset(scan, 0, sizeof(Scan));
+  scan->rules_ref = scan->index_ref = LUA_NOREF;
+  if (luaL_newmetatable(L, API_TYPE_SCAN)) {
+    luaL_setfuncs(L, scan_lib, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+
+  scan->root = strdup(root);
+  scan->root_len = root_len;
+  scan->mutex = SDL_CreateMutex();
+  scan->has_jobs = SDL_CreateCond();
+  scan->node_ready = SDL_CreateCond();
+  scan->complete = true;
+  if (!scan->root || !scan->mutex || !scan->has_jobs || !scan->node_ready)
+    return luaL_error(L, "can't create scan: %s", scan->root ? SDL_GetError() : "out of memory");
+
+  scan->rules = ignore_rules_arg(L, 2, root);
+  scan->rules_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+  lua_getfield(L, 3, "recurse");
+  scan->recurse = lua_isnil(L, -1) || lua_toboolean(L, -1);
+  lua_getfield(L, 3, "file_size_limit");
+  lua_Number size_limit = luaL_optnumber(L, -1, -1);
+  scan->size_limit = size_limit < 0 || size_limit >= 9e18 ? INT64_MAX : (int64_t)size_limit;
+  lua_getfield(L, 3, "timeout");
+  if (!lua_isnil(L, -1)) {
+    scan->has_deadline = true;
+    scan->deadline = SDL_GetTicks() + (uint32_t)(luaL_checknumber(L, -1) * 1000);
+  }
+  lua_getfield(L, 3, "path");
+  size_t path_len;
+  const char *path = luaL_optlstring(L, -1, "", &path_len);
+  lua_pop(L, 4);
+  scan->max_entries = get_option_integer(L, 3, "max_entries", 0);
+  scan->batch = get_option_integer(L, 3, "batch", SCAN_BATCH_SIZE);
+  scan->batch = scan->batch > 0 ? scan->batch : SCAN_BATCH_SIZE;
+  int threads = get_option_integer(L, 3, "threads", SDL_GetCPUCount());
+  threads = threads < 1 ? 1 : threads > SCAN_THREADS_MAX ? SCAN_THREADS_MAX : threads;
+
+  lua_getfield(L, 3, "index");
+  if (!lua_isnil(L, -1)) {
+    scan->index = luaL_checkudata(L, -1, API_TYPE_PROJECT_INDEX);
+    scan->index_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  } else {
+    lua_pop(L, 1);
+  }
+
+  lua_getfield(L, 3, "names");
+  bool named = !lua_isnil(L, -1);
+  if (named) {
+    luaL_checktype(L, -1, LUA_TTABLE);
+    int name_count = (int)lua_rawlen(L, -1);
+    if (name_count > 0 && !(scan->names = calloc(name_count, sizeof(char*))))
+      return luaL_error(L, "can't create scan: out of memory");
+    for (int i = 1; i <= name_count; i++) {
+      lua_rawgeti(L, -1, i);
+      const char *name = luaL_checkstring(L, -1);
+      /* only entries directly in path */
+      if (name[0] && strcmp(name, ".") != 0 && strcmp(name, "..") != 0 && !strchr(name, '/') && !strchr(name, PATHSEP)) {
+        if (!(scan->names[scan->name_count] = strdup(name)))
+          return luaL_error(L, "can't create scan: out of memory");
+        scan->name_count++;
+      }
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 1);
+
+  /* the top directory is read right away, so that errors can be reported */
+  ScanNode *top = scan_node_new("", 0, path, path_len);
+  if (!top)
+    return luaL_error(L, "can't create scan: out of memory");
+  scan->nodes = top;
+  if (named)
+    scan->named = top;
+  /* the ignore files of the directories above path apply to it too */
+  for (size_t len = 0; len < path_len; len++) {
+    if (len > 0 && path[len] != '/' && path[len] != PATHSEP)
+      continue;
+    IgnoreDir *ignore = ignore_dir_read(scan->rules, top->ignore, scan->root, path, len);
+    if (ignore) {
+      ignore_dirs_push(&scan->ignore_dirs, ignore);
+      top->ignore = ignore;
+    }
+  }
+  int err = scan_process(scan, top);
+  if (err) {
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(err));
+    return 2;
+  }
+  scan_push_frame(scan, top);
+  if (!scan->jobs)
+    threads = 0;
+  for (int i = 0; i < threads; i++) {
+    if (!(scan->threads[i] = SDL_CreateThread(scan_worker, "scan", scan)))
+      break;
+    scan->thread_count++;
+  }
+  return 1;
+}
@@ -0,0 +1,694 @@
+#ifndef _WIN32
+  #define _GNU_SOURCE
+#endif
+#include "api.h"
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pcre2.h>
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+  LPWSTR utfconv_utf8towc(const char *str);
+  #define PATHSEP '\\'
+#else
+  #define PATHSEP '/'
+#endif
+
+#define SEARCH_THREADS_MAX 8
+/* files with a NUL byte in their first bytes are taken as binary and skipped */
+#define SEARCH_BINARY_CHECK 8192
+/* like the Lua search did, a match keeps 257 bytes of its line, from 80 bytes before it */
+#define SEARCH_SNIPPET_BEFORE 80
+#define SEARCH_SNIPPET_LENGTH 257
+
+/*
+** system.search_files looks for a string or a regex in the files of project trees on worker
+** threads. The files are taken from the trees when the search starts; each worker then reads
+** a whole file at a time and finds the lines that match in the buffer, with memmem for plain
+** strings, on a lowercased copy of the buffer for case insensitive ones, and with the JIT
+** compiled regex line by line. The reading thread takes the matches in, in the order of the
+** files, as soon as the files they're in have been searched. Results only keep where the
+** match is, the text shown for them is read back from the file when they're asked for.
+*/
+
+typedef struct {
+  uint32_t line, col;
+  int64_t offset;           /* of the start of the line */
+} SearchMatch;
+
+typedef struct {
+  uint32_t file, line, col;
+  int64_t offset;
+} SearchResult;
+
+typedef struct {
+  int root;                 /* in Search.roots */
+  size_t name, name_len;    /* in Search.names, relative to the root */
+  int64_t size;
+  SearchMatch *matches;     /* until they're taken in the results */
+  uint32_t match_count;
+  bool done, failed;        /* failed if its matches couldn't all be kept */
+} SearchFile;
+
+typedef struct {
+  char *path, *prefix;      /* prefix is put before the filenames of the matches, in place of path */
+  size_t path_len, prefix_len;
+} SearchRoot;
+
+typedef struct {
+  SearchRoot *roots;
+  int root_count;
+  char *names;
+  size_t names_len, names_capacity;
+  SearchFile *files;
+  uint32_t file_count, file_capacity;
+  char *needle;
+  size_t needle_len;
+  bool insensitive;
+  pcre2_code *re;
+  SDL_mutex *mutex;
+  SDL_cond *file_done;
+  uint32_t next_job;
+  bool quit;
+  SDL_Thread *threads[SEARCH_THREADS_MAX];
+  int thread_count;
+  /* only used by the thread reading the results */
+  uint32_t next_file;
+  SearchResult *results;
+  uint32_t result_count, result_capacity;
+  bool done;
+} Search;
+
+/* what a worker keeps from one file to the next */
+typedef struct {
+  char *data, *folded, *path;
+  size_t capacity, folded_capacity, path_capacity;
+  pcre2_match_data *match_data;
+  SearchMatch *matches;
+  uint32_t match_count, match_capacity;
+  bool failed;              /* ran out of memory for the file it's searching */
+} SearchWorker;
+
+static FILE *search_open(const char *path) {
+#ifdef _WIN32
+  LPWSTR wpath = utfconv_utf8towc(path);
+  FILE *file = wpath ? _wfopen(wpath, L"rb") : NULL;
+  free(wpath);
+  return file;
+#else
+  return fopen(path, "rb");
+#endif
+}
+
+static bool search_reserve(char **data, size_t *capacity, size_t len) {
+  if (len <= *capacity)
+    return true;
+  size_t new_capacity = *capacity ? *capacity : 65536;
+  while (new_capacity < len)
+    new_capacity *= 2;
+  char *new_data = realloc(*data, new_capacity);
+  if (!new_data)
+    return false;
+  *data = new_data, *capacity = new_capacity;
+  return true;
+}
+
+/*
+** reads the whole file into the worker's buffer, trusting the size from the tree only as a hint.
+** The buffer is reused from one file to the next rather than mapping each file, as a mapped file
+** that is truncated while it's being searched faults the whole process.
+*/
+static bool search_read(SearchWorker *w, const char *path, int64_t size, size_t *len) {
+  FILE *file = search_open(path);
+  if (!file)
+    return false;
+  *len = 0;
+  size_t want = size > 0 ? (size_t)size + 1 : 65536;
+  while (search_reserve(&w->data, &w->capacity, *len + want)) {
+    size_t n = fread(w->data + *len, 1, w->capacity - *len, file);
+    *len += n;
+    if (n == 0 || feof(file) || ferror(file))
+      break;
+    want = w->capacity;
+  }
+  bool ok = !ferror(file) && feof(file);
+  fclose(file);
+  return ok;
+}
+
+static const char *search_memmem(const char *haystack, size_t len, const char *needle, size_t needle_len) {
+#ifdef __GLIBC__
+  return memmem(haystack, len, needle, needle_len);
+#else
+  const char *end = haystack + len;
+  while ((size_t)(end - haystack) >= needle_len) {
+    const char *found = memchr(haystack, needle[0], end - haystack - needle_len + 1);
+    if (!found)
+      return NULL;
+    if (memcmp(found, needle, needle_len) == 0)
+      return found;
+    haystack = found + 1;
+  }
+  return NULL;
+#endif
+}
+
+/* lowercases ASCII letters only, like string.lower in the C locale */
+static void search_fold(char *dst, const char *src, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)src[i];
+    dst[i] = (char)(c + ((unsigned char)(c - 'A') < 26 ? 32 : 0));
+  }
+}
+
+static bool search_add_match(SearchWorker *w, size_t line_start, uint32_t line, size_t col) {
+  if (w->match_count == w->match_capacity) {
+    uint32_t capacity = w->match_capacity ? w->match_capacity * 2 : 16;
+    SearchMatch *matches = realloc(w->matches, capacity * sizeof(SearchMatch));
+    if (!matches) {
+      w->failed = true;
+      return false;
+    }
+    w->matches = matches, w->match_capacity = capacity;
+  }
+  w->matches[w->match_count++] = (SearchMatch) { line, (uint32_t)col + 1, (int64_t)line_start };
+  return true;
+}
+
+/* finds the first match of every line in data; matches never span lines, as with the line by line search */
+static void search_plain(const Search *search, SearchWorker *w, const char *data, size_t len) {
+  const char *haystack = data;
+  if (search->insensitive) {
+    if (!search_reserve(&w->folded, &w->folded_capacity, len)) {
+      w->failed = true;
+      return;
+    }
+    search_fold(w->folded, data, len);
+    haystack = w->folded;
+  }
+  size_t pos = 0, line_start = 0;
+  uint32_t line = 1;
+  while (pos < len) {
+    const char *found = search_memmem(haystack + pos, len - pos, search->needle, search->needle_len);
+    if (!found)
+      break;
+    size_t offset = found - haystack;
+    const char *newline;
+    while ((newline = memchr(data + line_start, '\n', offset - line_start))) {
+      line++;
+      line_start = newline - data + 1;
+    }
+    const char *end = memchr(data + offset, '\n', len - offset);
+    size_t line_end = end ? (size_t)(end - data) : len;
+    if (!search_add_match(w, line_start, line, offset - line_start))
+      return;
+    line++;
+    line_start = pos = line_end + 1;
+  }
+}
+
+static void search_regex(const Search *search, SearchWorker *w, const char *data, size_t len) {
+  size_t line_start = 0;
+  for (uint32_t line = 1; line_start < len; line++) {
+    const char *end = memchr(data + line_start, '\n', len - line_start);
+    size_t line_end = end ? (size_t)(end - data) : len;
+    int rc = pcre2_match(search->re, (PCRE2_SPTR)data + line_start, line_end - line_start, 0, 0, w->match_data, NULL);
+    if (rc >= 0) {
+      PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(w->match_data);
+      if (ovector[0] <= line_end - line_start && !search_add_match(w, line_start, line, ovector[0]))
+        return;
+    }
+    line_start = line_end + 1;
+  }
+}
+
+/* puts the full path of the file in path */
+static bool search_file_path(const Search *search, const SearchFile *file, char **path, size_t *capacity) {
+  const SearchRoot *root = &search->roots[file->root];
+  size_t path_len = root->path_len + 1 + file->name_len;
+  if (!search_reserve(path, capacity, path_len + 1))
+    return false;
+  memcpy(*path, root->path, root->path_len);
+  (*path)[root->path_len] = PATHSEP;
+  memcpy(*path + root->path_len + 1, search->names + file->name, file->name_len);
+  (*path)[path_len] = '\0';
+  return true;
+}
+
+static void search_file(const Search *search, SearchWorker *w, const SearchFile *file) {
+  if (search->re && !w->match_data)
+    return;
+  if (!search_file_path(search, file, &w->path, &w->path_capacity))
+    return;
+  size_t len;
+  if (!search_read(w, w->path, file->size, &len))
+    return;
+  if (memchr(w->data, '\0', len < SEARCH_BINARY_CHECK ? len : SEARCH_BINARY_CHECK))
+    return;
+  if (search->re)
+    search_regex(search, w, w->data, len);
+  else if (search->needle)
+    search_plain(search, w, w->data, len);
+}
+
+/* searches the file and hands its matches over to it, to be read back */
+static void search_process(Search *search, SearchWorker *w, SearchFile *file) {
+  w->matches = NULL;
+  w->match_count = w->match_capacity = 0;
+  w->failed = false;
+  search_file(search, w, file);
+  SDL_LockMutex(search->mutex);
+  file->matches = w->matches;
+  file->match_count = w->match_count;
+  file->failed = w->failed;
+  file->done = true;
+  SDL_CondBroadcast(search->file_done);
+  SDL_UnlockMutex(search->mutex);
+}
+
+/* a worker that can't get match data doesn't find anything */
+static void search_worker_init(const Search *search, SearchWorker *w) {
+  memset(w, 0, sizeof(SearchWorker));
+  if (search->re)
+    w->match_data = pcre2_match_data_create_from_pattern(search->re, NULL);
+}
+
+static void search_worker_free(SearchWorker *w) {
+  free(w->data);
+  free(w->folded);
+  free(w->path);
+  if (w->match_data)
+    pcre2_match_data_free(w->match_data);
+}
+
+static int search_worker(void *data) {
+  Search *search = data;
+  SearchWorker w;
+  search_worker_init(search, &w);
+  SDL_LockMutex(search->mutex);
+  while (!search->quit && search->next_job < search->file_count) {
+    SearchFile *file = &search->files[search->next_job++];
+    SDL_UnlockMutex(search->mutex);
+    search_process(search, &w, file);
+    SDL_LockMutex(search->mutex);
+  }
+  SDL_UnlockMutex(search->mutex);
+  search_worker_free(&w);
+  return 0;
+}
+
+/* stops workers once they're done with their current file */
+static void search_stop(Search *search) {
+  if (search->mutex) {
+    SDL_LockMutex(search->mutex);
+    search->quit = true;
+    SDL_UnlockMutex(search->mutex);
+  }
+  for (int i = 0; i < search->thread_count; i++)
+    SDL_WaitThread(search->threads[i], NULL);
+  search->thread_count = 0;
+}
+
+/* moves the matches of a searched file to the results */
+static bool search_take_matches(Search *search, SearchFile *file) {
+  uint32_t file_index = (uint32_t)(file - search->files);
+  if (search->result_count + file->match_count > search->result_capacity) {
+    uint32_t capacity = search->result_capacity ? search->result_capacity : 1024;
+    while (capacity < search->result_count + file->match_count)
+      capacity *= 2;
+    SearchResult *results = realloc(search->results, capacity * sizeof(SearchResult));
+    if (!results)
+      return false;
+    search->results = results, search->result_capacity = capacity;
+  }
+  for (uint32_t i = 0; i < file->match_count; i++) {
+    const SearchMatch *match = &file->matches[i];
+    search->results[search->result_count++] = (SearchResult) { file_index, match->line, match->col, match->offset };
+  }
+  free(file->matches);
+  file->matches = NULL;
+  file->match_count = 0;
+  return true;
+}
+
+static int f_search_read(lua_State *L) {
+  Search *search = luaL_checkudata(L, 1, API_TYPE_SEARCH);
+  double timeout = luaL_optnumber(L, 2, -1);
+  if (search->done) {
+    lua_pushnil(L);
+    lua_pushinteger(L, search->next_file);
+    lua_pushinteger(L, search->file_count);
+    return 3;
+  }
+  uint32_t deadline = SDL_GetTicks() + (uint32_t)(timeout * 1000);
+  uint32_t first_file = search->next_file, first_result = search->result_count;
+  while (search->next_file < search->file_count) {
+    SearchFile *file = &search->files[search->next_file];
+    if (search->thread_count == 0 && !file->done) {
+      /* without workers, files are searched here until the timeout */
+      if (search->next_file > first_file && timeout >= 0 && SDL_TICKS_PASSED(SDL_GetTicks(), deadline))
+        break;
+      SearchWorker w;
+      search_worker_init(search, &w);
+      search_process(search, &w, file);
+      search_worker_free(&w);
+    }
+    SDL_LockMutex(search->mutex);
+    /* only wait as long as nothing was taken in */
+    while (!file->done && search->next_file == first_file) {
+      uint32_t now = SDL_GetTicks();
+      if (timeout < 0)
+        SDL_CondWait(search->file_done, search->mutex);
+      else if (SDL_TICKS_PASSED(now, deadline))
+        break;
+      else
+        SDL_CondWaitTimeout(search->file_done, search->mutex, deadline - now);
+    }
+    bool done = file->done;
+    SDL_UnlockMutex(search->mutex);
+    if (!done)
+      break;
+    if (file->failed || !search_take_matches(search, file))
+      return luaL_error(L, "can't keep search results: out of memory");
+    search->next_file++;
+  }
+  if (search->next_file == search->file_count) {
+    search->done = true;
+    search_stop(search);
+  }
+  if (search->next_file == first_file && search->done)
+    return f_search_read(L);
+  lua_pushinteger(L, search->result_count - first_result);
+  lua_pushinteger(L, search->next_file);
+  lua_pushinteger(L, search->file_count);
+  return 3;
+}
+
+static int f_search_count(lua_State *L) {
+  Search *search = luaL_checkudata(L, 1, API_TYPE_SEARCH);
+  lua_pushinteger(L, search->result_count);
+  return 1;
+}
+
+/* reads the text shown for a result, the same part of its line the Lua search kept */
+static void push_result_text(lua_State *L, FILE *file, const SearchResult *result) {
+  char buffer[3 + SEARCH_SNIPPET_LENGTH];
+  size_t col = result->col - 1, len = 0;
+  size_t start = col > SEARCH_SNIPPET_BEFORE ? col - SEARCH_SNIPPET_BEFORE : 0;
+  size_t ellipsis = start > 0 ? 3 : 0;
+  memcpy(buffer, "...", ellipsis);
+  if (file && fseek(file, (long)(result->offset + start), SEEK_SET) == 0) {
+    len = fread(buffer + ellipsis, 1, SEARCH_SNIPPET_LENGTH, file);
+    const char *newline = memchr(buffer + ellipsis, '\n', len);
+    if (newline)
+      len = newline - (buffer + ellipsis);
+  }
+  lua_pushlstring(L, buffer, ellipsis + len);
+}
+
+static int f_search_get(lua_State *L) {
+  Search *search = luaL_checkudata(L, 1, API_TYPE_SEARCH);
+  lua_Integer first = luaL_checkinteger(L, 2);
+  lua_Integer last = luaL_optinteger(L, 3, first);
+  first = first < 1 ? 1 : first;
+  last = last > search->result_count ? search->result_count : last;
+  lua_createtable(L, last >= first ? (int)(last - first + 1) : 0, 0);
+  char *path = NULL;
+  size_t path_capacity = 0;
+  FILE *file = NULL;
+  uint32_t file_index = UINT32_MAX;
+  for (lua_Integer i = first; i <= last; i++) {
+    const SearchResult *result = &search->results[i - 1];
+    const SearchFile *search_file = &search->files[result->file];
+    const SearchRoot *root = &search->roots[search_file->root];
+    /* results of the same file are next to each other, it's only opened once */
+    if (result->file != file_index) {
+      if (file)
+        fclose(file);
+      file = search_file_path(search, search_file, &path, &path_capacity) ? search_open(path) : NULL;
+      file_index = result->file;
+    }
+    lua_createtable(L, 0, 4);
+    lua_pushlstring(L, root->prefix, root->prefix_len);
+    lua_pushlstring(L, search->names + search_file->name, search_file->name_len);
+    lua_concat(L, 2);
+    lua_setfield(L, -2, "file");
+    push_result_text(L, file, result);
+    lua_setfield(L, -2, "text");
+    lua_pushinteger(L, result->line);
+    lua_setfield(L, -2, "line");
+    lua_pushinteger(L, result->col);
+    lua_setfield(L, -2, "col");
+    lua_rawseti(L, -2, (int)(i - first + 1));
+  }
+  if (file)
+    fclose(file);
+  free(path);
+  return 1;
+}
+
+static int f_search_cancel(lua_State *L) {
+  Search *search = luaL_checkudata(L, 1, API_TYPE_SEARCH);
+  search_stop(search);
+  search->done = true;
+  return 0;
+}
+
+static int f_search_gc(lua_State *L) {
+  Search *search = luaL_checkudata(L, 1, API_TYPE_SEARCH);
+  search_stop(search);
+  for (uint32_t i = 0; i < search->file_count; i++)
+    free(search->files[i].matches);
+  for (int i = 0; i < search->root_count; i++) {
+    free(search->roots[i].path);
+    free(search->roots[i].prefix);
+  }
+  free(search->roots);
+  free(search->results);
+  free(search->files);
+  free(search->names);
+  free(search->needle);
+  if (search->re) pcre2_code_free(search->re);
+  if (search->file_done) SDL_DestroyCond(search->file_done);
+  if (search->mutex) SDL_DestroyMutex(search->mutex);
+  memset(search, 0, sizeof(*search));
+  return 0;
+}
+
+static const luaL_Reg search_lib[] = {
+  { "read",    f_search_read   },
+  { "count",   f_search_count  },
+  { "get",     f_search_get    },
+  { "cancel",  f_search_cancel },
+  { "__gc",    f_search_gc     },
+  { NULL, NULL }
+};
+
+/* collects the files of a tree as it's walked, keeping the path of the directory being walked */
+typedef struct {
+  Search *search;
+  int root;
+  const char *filter;       /* only files whose full path starts with it */
+  size_t filter_len;
+  char *path;
+  size_t path_len, path_capacity;
+  size_t *depths;           /* where the path of each depth starts */
+  int depth_capacity;
+  bool failed;
+} SearchWalk;
+
+static void search_add_file(void *data, int depth, const char *name, size_t name_len, bool dir, bool symlink, int64_t size, int64_t modified) {
+  (void)symlink, (void)modified;
+  SearchWalk *walk = data;
+  Search *search = walk->search;
+  if (walk->failed)
+    return;
+  if (depth + 1 >= walk->depth_capacity) {
+    int capacity = walk->depth_capacity ? walk->depth_capacity * 2 : 32;
+    size_t *depths = realloc(walk->depths, capacity * sizeof(size_t));
+    if (!depths) {
+      walk->failed = true;
+      return;
+    }
+    if (!walk->depth_capacity)
+      depths[0] = 0;
+    walk->depths = depths, walk->depth_capacity = capacity;
+  }
+  walk->path_len = walk->depths[depth];
+  if (!search_reserve(&walk->path, &walk->path_capacity, walk->path_len + name_len + 1)) {
+    walk->failed = true;
+    return;
+  }
+  memcpy(walk->path + walk->path_len, name, name_len);
+  walk->path_len += name_len;
+  if (dir) {
+    walk->path[walk->path_len] = PATHSEP;
+    walk->depths[depth + 1] = walk->path_len + 1;
+    return;
+  }
+  if (walk->filter) {
+    const SearchRoot *root = &search->roots[walk->root];
+    size_t n = walk->filter_len < root->path_len ? walk->filter_len : root->path_len;
+    if (memcmp(walk->filter, root->path, n) != 0)
+      return;
+    if (walk->filter_len > root->path_len) {
+      const char *rest = walk->filter + root->path_len + 1;
+      size_t rest_len = walk->filter_len - root->path_len - 1;
+      if (walk->filter[root->path_len] != '/' || rest_len > walk->path_len || memcmp(rest, walk->path, rest_len) != 0)
+        return;
+    }
+  }
+  if (search->file_count == search->file_capacity) {
+    uint32_t capacity = search->file_capacity ? search->file_capacity * 2 : 1024;
+    SearchFile *files = realloc(search->files, capacity * sizeof(SearchFile));
+    if (!files) {
+      walk->failed = true;
+      return;
+    }
+    search->files = files, search->file_capacity = capacity;
+  }
+  if (!search_reserve(&search->names, &search->names_capacity, search->names_len + walk->path_len)) {
+    walk->failed = true;
+    return;
+  }
+  memcpy(search->names + search->names_len, walk->path, walk->path_len);
+  search->files[search->file_count++] = (SearchFile) { walk->root, search->names_len, walk->path_len, size, NULL, 0, false };
+  search->names_len += walk->path_len;
+}
+
+static char *search_strdup(const char *str, size_t len) {
+  char *copy = malloc(len + 1);
+  if (copy) {
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+  }
+  return copy;
+}
+
+/*
+** system.search_files(dirs, text, opts) starts searching the files of the project trees in dirs,
+** a list of { path, tree, prefix } tables; prefix goes before the filenames of the results, in
+** place of path and PATHSEP. opts can set regex (to take text as a regex), insensitive, path (to
+** search only the files whose path, as dir.path .. "/" .. filename, starts with it) and threads.
+** Lines with a match are reported once, with the column of their first match; binary files are
+** skipped. Returns the search, or nil and an error message if the regex doesn't compile.
+** search:read(timeout?) takes in the matches of the files searched since, waiting at most timeout
+** seconds for one, and returns how many there were, the number of files searched so far and the
+** number of files to search; once all files were searched or search:cancel() was called, it
+** returns nil and these numbers. search:count() is the number of results taken in, and
+** search:get(first, last?) returns results first to last as { file, text, line, col } tables.
+*/
+int f_search_files(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  size_t text_len;
+  const char *text = luaL_checklstring(L, 2, &text_len);
+  if (!lua_isnoneornil(L, 3))
+    luaL_checktype(L, 3, LUA_TTABLE);
+  else {
+    lua_settop(L, 2);
+    lua_newtable(L);
+  }
+
+  Search *search = lua_newuserdata(L, sizeof(Search));
+  memset(search, 0, sizeof(Search));
+  if (luaL_newmetatable(L, API_TYPE_SEARCH)) {
+    luaL_setfuncs(L, search_lib, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+  int search_idx = lua_gettop(L);
+
+  search->mutex = SDL_CreateMutex();
+  search->file_done = SDL_CreateCond();
+  if (!search->mutex || !search->file_done)
+    return luaL_error(L, "can't create search: %s", SDL_GetError());
+
+  lua_getfield(L, 3, "regex");
+  bool is_regex = lua_toboolean(L, -1);
+  lua_getfield(L, 3, "insensitive");
+  search->insensitive = lua_toboolean(L, -1);
+  lua_pop(L, 2);
+  lua_getfield(L, 3, "threads");
+  int threads = (int)luaL_optinteger(L, -1, SDL_GetCPUCount());
+  threads = threads < 1 ? 1 : threads > SEARCH_THREADS_MAX ? SEARCH_THREADS_MAX : threads;
+  lua_pop(L, 1);
+
+  if (is_regex) {
+    int error_number;
+    PCRE2_SIZE error_offset;
+    uint32_t options = PCRE2_UTF | (search->insensitive ? PCRE2_CASELESS : 0);
+#ifdef PCRE2_MATCH_INVALID_UTF
+    options |= PCRE2_MATCH_INVALID_UTF;
+#endif
+    search->re = pcre2_compile((PCRE2_SPTR)text, text_len, options, &error_number, &error_offset, NULL);
+    if (!search->re) {
+      PCRE2_UCHAR buffer[256];
+      pcre2_get_error_message(error_number, buffer, sizeof(buffer));
+      lua_pushnil(L);
+      lua_pushfstring(L, "regex compilation failed at offset %d: %s", (int)error_offset, (const char*)buffer);
+      return 2;
+    }
+    pcre2_jit_compile(search->re, PCRE2_JIT_COMPLETE);
+  } else if (text_len > 0 && !memchr(text, '\n', text_len)) {
+    /* a needle with a newline can't match within a line: there's nothing to look for */
+    if (!(search->needle = search_strdup(text, text_len)))
+      return luaL_error(L, "can't create search: out of memory");
+    search->needle_len = text_len;
+    if (search->insensitive) {
+      bool has_letters = false;
+      for (size_t i = 0; i < text_len; i++)
+        has_letters = has_letters || (unsigned char)((text[i] | 32) - 'a') < 26;
+      search_fold(search->needle, text, text_len);
+      search->insensitive = has_letters;
+    }
+  }
+
+  lua_getfield(L, 3, "path");
+  SearchWalk walk = { .search = search };
+  walk.filter = luaL_optlstring(L, -1, NULL, &walk.filter_len);
+  int root_count = (int)lua_rawlen(L, 1);
+  if (root_count > 0 && !(search->roots = calloc(root_count, sizeof(SearchRoot))))
+    return luaL_error(L, "can't create search: out of memory");
+  for (int i = 1; i <= root_count; i++) {
+    lua_rawgeti(L, 1, i);
+    luaL_checktype(L, -1, LUA_TTABLE);
+    lua_getfield(L, -1, "path");
+    lua_getfield(L, -2, "tree");
+    lua_getfield(L, -3, "prefix");
+    size_t path_len, prefix_len;
+    const char *path = luaL_checklstring(L, -3, &path_len);
+    ProjectTree *tree = project_tree_check(L, -2);
+    const char *prefix = luaL_optlstring(L, -1, "", &prefix_len);
+    SearchRoot *root = &search->roots[search->root_count++];
+    root->path = search_strdup(path, path_len), root->path_len = path_len;
+    root->prefix = search_strdup(prefix, prefix_len), root->prefix_len = prefix_len;
+    if (!root->path || !root->prefix)
+      return luaL_error(L, "can't create search: out of memory");
+    walk.root = i - 1;
+    project_tree_walk(tree, search_add_file, &walk);
+    lua_pop(L, 4);
+  }
+  free(walk.path);
+  free(walk.depths);
+  if (walk.failed)
+    return luaL_error(L, "can't create search: out of memory");
+
+  lua_settop(L, search_idx);
+  if (search->file_count == 0)
+    threads = 0;
+  for (int i = 0; i < threads; i++) {
+    if (!(search->threads[i] = SDL_CreateThread(search_worker, "search", search)))
+      break;
+    search->thread_count++;
+  }
+  return 1;
+}
@@ -37,6 +37,7 @@
 #endif
 
 extern SDL_Window *window;
+extern unsigned int DIR_EVENT_TYPE;
 
 #ifdef _WIN32
 #define PATHSEP '\\'
@@ -396,6 +397,11 @@ top:
       return 1;
 
     default:
+      /* posted by directory monitors when they have changes to check */
+      if (DIR_EVENT_TYPE && e.type == DIR_EVENT_TYPE) {
+        lua_pushstring(L, "dirchange");
+        return 1;
+      }
       goto top;
   }
 
@@ -1181,15 +1187,9 @@ static int f_load_native_plugin(lua_State *L) {
 
 /* Special purpose filepath compare function. Corresponds to the
    order used in the TreeView view of the project's files. Returns true iff
-   path1 < path2 in the TreeView order. */
-static int f_path_compare(lua_State *L) {
-  size_t len1, len2;
-  const char *path1 = luaL_checklstring(L, 1, &len1);
-  const char *type1_s = luaL_checkstring(L, 2);
-  const char *path2 = luaL_checklstring(L, 3, &len2);
-  const char *type2_s = luaL_checkstring(L, 4);
-  int type1 = strcmp(type1_s, "dir") != 0;
-  int type2 = strcmp(type2_s, "dir") != 0;
+   path1 < path2 in the TreeView order. Types are 0 for "dir", 1 otherwise.
+   The paths don't need to be NUL-terminated. */
+int path_compare(const char *path1, size_t len1, int type1, const char *path2, size_t len2, int type2) {
   /* Find the index of the common part of the path. */
   size_t offset = 0, i, j;
   for (i = 0; i < len1 && i < len2; i++) {
@@ -1201,30 +1201,29 @@ static int f_path_compare(lua_State *L) {
   }
   /* If a path separator is present in the name after the common part we consider
      the entry like a directory. */
-  if (strchr(path1 + offset, PATHSEP)) {
+  if (memchr(path1 + offset, PATHSEP, len1 - offset)) {
     type1 = 0;
   }
-  if (strchr(path2 + offset, PATHSEP)) {
+  if (memchr(path2 + offset, PATHSEP, len2 - offset)) {
     type2 = 0;
   }
   /* If types are different "dir" types comes before "file" types. */
   if (type1 != type2) {
-    lua_pushboolean(L, type1 < type2);
-    return 1;
+    return type1 < type2;
   }
   /* If types are the same compare the files' path alphabetically. */
   int cfr = -1;
   bool same_len = len1 == len2;
   for (i = offset, j = offset; i <= len1 && j <= len2; i++, j++) {
-    if (path1[i] == 0 || path2[j] == 0) {
+    if (i == len1 || j == len2) {
       if (cfr < 0) cfr = 0; // The strings are equal
       if (!same_len) {
-        cfr = (path1[i] == 0);
+        cfr = (i == len1);
       }
     } else if (isdigit(path1[i]) && isdigit(path2[j])) {
       size_t ii = 0, ij = 0;
-      while (isdigit(path1[i+ii])) { ii++; }
-      while (isdigit(path2[j+ij])) { ij++; }
+      while (i+ii < len1 && isdigit(path1[i+ii])) { ii++; }
+      while (j+ij < len2 && isdigit(path2[j+ij])) { ij++; }
 
       size_t di = 0, dj = 0;
       for (size_t ai = 0; ai < ii; ++ai) {
@@ -1260,7 +1259,17 @@ static int f_path_compare(lua_State *L) {
     }
     break;
   }
-  lua_pushboolean(L, cfr);
+  return cfr;
+}
+
+
+static int f_path_compare(lua_State *L) {
+  size_t len1, len2;
+  const char *path1 = luaL_checklstring(L, 1, &len1);
+  const char *type1 = luaL_checkstring(L, 2);
+  const char *path2 = luaL_checklstring(L, 3, &len2);
+  const char *type2 = luaL_checkstring(L, 4);
+  lua_pushboolean(L, path_compare(path1, len1, strcmp(type1, "dir") != 0, path2, len2, strcmp(type2, "dir") != 0));
   return 1;
 }
 
@@ -1307,6 +1316,12 @@ static const luaL_Reg lib[] = {
   { "set_window_opacity",  f_set_window_opacity  },
   { "load_native_plugin",  f_load_native_plugin  },
   { "path_compare",        f_path_compare        },
+  { "scan_tree",           f_scan_tree           },
+  { "ignore_rules",        f_ignore_rules        },
+  { "load_project_index",  f_load_project_index  },
+  { "save_project_index",  f_save_project_index  },
+  { "project_tree",        f_project_tree        },
+  { "search_files",        f_search_files        },
   { "get_fs_type",         f_get_fs_type         },
   { "text_input",          f_text_input          },
   { NULL, NULL }
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <SDL.h>
 #include "api/api.h"
 #include "rencache.h"
@@ -147,6 +148,21 @@ int main(int argc, char **argv) {
   signal(SIGPIPE, SIG_IGN);
 #endif
 
+  /* benchmark scenarios run without a display, on SDL's dummy video driver */
+  const char *benchmark_env = getenv("LITE_XL_BENCHMARK");
+  bool headless = benchmark_env && *benchmark_env;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--benchmark") == 0) {
+      if (i + 1 >= argc || !*argv[i + 1]) {
+        fprintf(stderr, "Error: --benchmark needs the path of a scenario\n");
+        exit(1);
+      }
+      headless = true;
+    }
+  }
+  if (headless)
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+
   if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) != 0) {
     fprintf(stderr, "Error initializing sdl: %s", SDL_GetError());
     exit(1);
@@ -293,6 +309,7 @@ init_lua:
 
   // This allows the window to be destroyed before lite-xl is done with
   // reaping child processes
+  rencache_stop_threads();
   ren_free_window_resources(&window_renderer);
   lua_close(L);
 
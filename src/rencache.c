@@ -1,6 +1,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 
@@ -22,20 +23,44 @@
 /* a cache over the software renderer -- all drawing operations are stored as
 ** commands when issued. At the end of the frame we write the commands to a grid
 ** of hash values, take the cells that have changed since the previous frame,
-** merge them into dirty rectangles and redraw only those regions */
+** merge them into dirty rectangles and redraw only those regions. a region whose content only
+** moved vertically (e.g. a scrolled document) is moved on the surface instead of redrawn */
 
-#define CELLS_X 80
-#define CELLS_Y 50
-#define CELL_SIZE 96
+/* cells are about two lines of text high, so a blinking cursor or a single edited line only redraws
+** a strip of the screen; on very large screens they grow to keep the number of cells bounded.
+** smaller cells redraw even less, but every command then hashes into many more of them */
+#define CELL_LINES 2
+#define CELL_SIZE_MIN 16
+#define CELL_SIZE_MAX 96
+#define CELL_SIZE_STEP 8
+/* the line height follows the smallest text of the last frames with text, so that text drawn
+** for a few frames (e.g. a tooltip) doesn't change the cell size and invalidate the screen twice */
+#define LINE_HEIGHT_FRAMES 60
+#define CELLS_MAX (160 * 100)
+#define TEXT_OVERHANG_DIV 4
+#define OCCLUDERS_MAX 8
+#define SCROLL_CANDIDATES 16
+#define SCROLL_MAX_MATCHES 4
+#define SCROLL_MIN_VOTES 3
 #define CMD_BUF_RESIZE_RATE 1.2
 #define CMD_BUF_INIT_SIZE (1024 * 512)
 #define COMMAND_BARE_SIZE offsetof(Command, command)
+#define RENDER_THREADS_MAX 16
+#define RENDER_BANDS_PER_THREAD 4
+#define RENDER_BAND_MIN_HEIGHT 16
+/* frames with fewer dirty pixels than this aren't worth waking the render threads for */
+#define RENDER_CONCURRENT_MIN_AREA (256 * 256)
 
 enum CommandType { SET_CLIP, DRAW_TEXT, DRAW_RECT };
 
 typedef struct {
   enum CommandType type;
   uint32_t size;
+  /* hash of everything but the rect, filled in at the end of the frame the
+  ** command was issued in; display lists keep it for the commands they replay */
+  unsigned hash;
+  /* keeps the command after the header aligned for its pointers */
+  uint32_t padding;
   /* Commands *must* always begin with a RenRect
   ** This is done to ensure alignment */
   RenRect command[];
@@ -60,11 +85,85 @@ typedef struct {
   RenColor color;
 } DrawRectCommand;
 
-static unsigned cells_buf1[CELLS_X * CELLS_Y];
-static unsigned cells_buf2[CELLS_X * CELLS_Y];
-static unsigned *cells_prev = cells_buf1;
-static unsigned *cells = cells_buf2;
-static RenRect rect_buf[CELLS_X * CELLS_Y / 2];
+/* commands are binned into the cells they touch, so that a dirty rect only replays the commands
+** overlapping it. every drawing command gets an entry with its offset and the offset of the
+** SET_CLIP in effect for it (-1 for the screen); each cell links the entries touching it in draw order */
+typedef struct {
+  int command, clip;
+} BinnedCommand;
+
+typedef struct {
+  int binned, next;
+} CellCommand;
+
+/* what a command adds to the hash of a cell: the part of the cell it may draw to, and for text its
+** baseline, both relative to the cell. content that only moved vertically thus hashes the same
+** in a grid moved along with it, which is how scrolled regions are recognized */
+typedef struct {
+  unsigned content;
+  RenRect footprint;
+  int y;
+} CellHash;
+
+/* where each text command of the previous frame was drawn, to guess how far a region scrolled */
+typedef struct {
+  unsigned content;
+  int y;
+  RenRect clip;
+} TextPosition;
+
+typedef struct {
+  RenRect clip;
+  int dy, votes;
+} ScrollCandidate;
+
+/* the commands a view issued in a previous frame, replayed as long as it reports the same version.
+** the clip rects in effect when the list begins and ends are part of it */
+typedef struct {
+  char *id, *version;
+  size_t id_len, version_len;
+  RenRect clip_begin, clip_end;
+  uint8_t *commands;
+  int size;
+  /* where the list is in command_buf while it's recorded, until the end of the frame */
+  int record_begin, record_end;
+  bool used;
+} DisplayList;
+
+static int cells_x, cells_y, cell_size;
+static int line_height;
+static unsigned *cells_prev;
+static unsigned *cells;
+static unsigned *cells_moved;
+static bool *cells_dirty;
+/* the grid of the largest cells, to compare the dirty area with in the stats */
+static bool *cells_coarse;
+static int cells_coarse_x, cells_coarse_y;
+static RenRect *rect_buf;
+static int *cell_commands_head;
+static int *cell_commands_tail;
+static CellCommand *cell_commands;
+static int cell_commands_count, cell_commands_capacity;
+static BinnedCommand *binned_commands;
+static int binned_commands_count, binned_commands_capacity;
+/* the commands of rect_buf[i] are rect_commands[rect_commands_start[i]..rect_commands_start[i + 1]] */
+static BinnedCommand *rect_commands;
+static int rect_commands_count, rect_commands_capacity;
+static int *rect_commands_start;
+static uint64_t *rect_mask;
+static int rect_mask_capacity;
+static bool binning_issue;
+static int frame_line_height;
+static int line_heights[LINE_HEIGHT_FRAMES];
+static int line_heights_count, line_heights_next;
+static TextPosition *texts, *texts_prev;
+static int texts_count, texts_capacity, texts_prev_count, texts_prev_capacity;
+static int *texts_table;
+static int texts_table_size;
+static DisplayList *display_lists;
+static int display_lists_count, display_lists_capacity;
+static int recording_list = -1;
+static int list_depth;
 size_t command_buf_size = 0;
 uint8_t *command_buf = NULL;
 static bool resize_issue;
@@ -72,6 +171,26 @@ static int command_buf_idx;
 static RenRect screen_rect;
 static RenRect last_clip_rect;
 static bool show_debug;
+static RenCacheStats stats, frame_stats;
+static Uint64 frame_begin;
+/* the file commands are recorded to, and the fonts defined in it this frame, with their tab sizes */
+static FILE *record_file;
+static struct { RenFont *font; int tab_size; } *record_fonts;
+static int record_fonts_count, record_fonts_capacity;
+
+/* a pool of render threads that redraw the dirty rects concurrently. the dirty region is cut into
+** horizontal bands which the threads (and the main thread) take in turn; each band replays the
+** commands for every dirty rect, clipped to the band, so no two threads ever touch the same pixel */
+static struct {
+  SDL_Thread *threads[RENDER_THREADS_MAX];
+  int thread_count;
+  bool initialized, quit;
+  SDL_sem *start, *done;
+  SDL_atomic_t next_band;
+  int band_count, band_y, band_height;
+  int rect_count;
+  RenSurface surface;
+} render_pool;
 
 static inline int rencache_min(int a, int b) { return a < b ? a : b; }
 static inline int rencache_max(int a, int b) { return a > b ? a : b; }
@@ -89,7 +208,7 @@ static void hash(unsigned *h, const void *data, int size) {
 
 
 static inline int cell_idx(int x, int y) {
-  return x + y * CELLS_X;
+  return x + y * cells_x;
 }
 
 
@@ -108,14 +227,6 @@ static RenRect intersect_rects(RenRect a, RenRect b) {
 }
 
 
-static RenRect merge_rects(RenRect a, RenRect b) {
-  int x1 = rencache_min(a.x, b.x);
-  int y1 = rencache_min(a.y, b.y);
-  int x2 = rencache_max(a.x + a.width, b.x + b.width);
-  int y2 = rencache_max(a.y + a.height, b.y + b.height);
-  return (RenRect) { x1, y1, x2 - x1, y2 - y1 };
-}
-
 static bool expand_command_buffer() {
   size_t new_size = command_buf_size * CMD_BUF_RESIZE_RATE;
   if (new_size == 0) {
@@ -130,6 +241,25 @@ static bool expand_command_buffer() {
   return true;
 }
 
+static bool grow_buffer(void **buf, int *capacity, int count, size_t item_size) {
+  if (count < *capacity) {
+    return true;
+  }
+  int new_capacity = *capacity ? *capacity : 4096;
+  while (new_capacity <= count) {
+    new_capacity *= 2;
+  }
+  void *new_buf = realloc(*buf, new_capacity * item_size);
+  if (!new_buf) {
+    fprintf(stderr, "Warning: (" __FILE__ "): unable to resize command bins (%d)\n", new_capacity);
+    return false;
+  }
+  *buf = new_buf;
+  *capacity = new_capacity;
+  return true;
+}
+
+
 static void* push_command(enum CommandType type, int size) {
   if (resize_issue) {
     // Don't push new commands as we had problems resizing the command buffer.
@@ -157,6 +287,25 @@ static void* push_command(enum CommandType type, int size) {
 }
 
 
+/* appends already issued commands, as recorded in a display list */
+static bool push_commands(const uint8_t *commands, int size) {
+  if (resize_issue) {
+    return false;
+  }
+  while (command_buf_idx + size > command_buf_size) {
+    if (!expand_command_buffer()) {
+      fprintf(stderr, "Warning: (" __FILE__ "): unable to resize command buffer (%ld)\n",
+              (size_t)(command_buf_size * CMD_BUF_RESIZE_RATE));
+      resize_issue = true;
+      return false;
+    }
+  }
+  memcpy(command_buf + command_buf_idx, commands, size);
+  command_buf_idx += size;
+  return true;
+}
+
+
 static bool next_command(Command **prev) {
   if (*prev == NULL) {
     *prev = (Command*) command_buf;
@@ -172,6 +321,32 @@ void rencache_show_debug(bool enable) {
 }
 
 
+bool rencache_record_commands(const char *path) {
+  if (record_file) {
+    fclose(record_file);
+    record_file = NULL;
+  }
+  if (!path) {
+    return true;
+  }
+  record_file = fopen(path, "wb");
+  if (!record_file) {
+    return false;
+  }
+  if (fwrite(RENCACHE_RECORD_MAGIC, 1, strlen(RENCACHE_RECORD_MAGIC), record_file) != strlen(RENCACHE_RECORD_MAGIC)) {
+    fclose(record_file);
+    record_file = NULL;
+    return false;
+  }
+  return true;
+}
+
+
+void rencache_get_stats(RenCacheStats *out) {
+  *out = stats;
+}
+
+
 void rencache_set_clip_rect(RenRect rect) {
   SetClipCommand *cmd = push_command(SET_CLIP, sizeof(SetClipCommand));
   if (cmd) {
@@ -213,46 +388,361 @@ double rencache_draw_text(RenWindow *window_renderer, RenFont **fonts, const cha
 }
 
 
+static int find_display_list(const char *id, size_t id_len) {
+  for (int i = 0; i < display_lists_count; i++) {
+    if (display_lists[i].id_len == id_len && memcmp(display_lists[i].id, id, id_len) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+static void free_display_list(int i) {
+  free(display_lists[i].id);
+  free(display_lists[i].version);
+  free(display_lists[i].commands);
+  display_lists[i] = display_lists[--display_lists_count];
+}
+
+
+bool rencache_begin_list(const char *id, size_t id_len, const char *version, size_t version_len) {
+  /* lists opened inside a list being recorded are simply part of it */
+  if (list_depth++ > 0) {
+    return true;
+  }
+  int i = find_display_list(id, id_len);
+  if (i != -1) {
+    DisplayList *list = &display_lists[i];
+    if (list->version && list->record_begin == -1 && list->version_len == version_len && memcmp(list->version, version, version_len) == 0
+        && memcmp(&list->clip_begin, &last_clip_rect, sizeof(RenRect)) == 0 && push_commands(list->commands, list->size)) {
+      list->used = true;
+      frame_stats.lists_replayed++;
+      last_clip_rect = list->clip_end;
+      list_depth--;
+      return false;
+    }
+  } else {
+    if (!grow_buffer((void**)&display_lists, &display_lists_capacity, display_lists_count, sizeof(DisplayList))) {
+      return true;
+    }
+    i = display_lists_count++;
+    display_lists[i] = (DisplayList) { .id = malloc(id_len + 1), .id_len = id_len, .record_begin = -1 };
+    if (!display_lists[i].id) {
+      free_display_list(i);
+      return true;
+    }
+    memcpy(display_lists[i].id, id, id_len);
+  }
+  DisplayList *list = &display_lists[i];
+  free(list->version);
+  list->version = malloc(version_len + 1);
+  list->version_len = version_len;
+  if (list->version) {
+    memcpy(list->version, version, version_len);
+  }
+  list->clip_begin = last_clip_rect;
+  list->record_begin = command_buf_idx;
+  list->used = true;
+  recording_list = i;
+  return true;
+}
+
+
+void rencache_end_list(void) {
+  if (list_depth == 0 || --list_depth > 0 || recording_list == -1) {
+    return;
+  }
+  display_lists[recording_list].record_end = command_buf_idx;
+  display_lists[recording_list].clip_end = last_clip_rect;
+  recording_list = -1;
+}
+
+
+bool rencache_is_recording(void) {
+  return recording_list != -1;
+}
+
+
+bool rencache_has_list(const char *id, size_t id_len) {
+  return find_display_list(id, id_len) != -1;
+}
+
+
+void rencache_drop_lists(void) {
+  while (display_lists_count > 0) {
+    free_display_list(display_lists_count - 1);
+  }
+  recording_list = -1;
+}
+
+
+static void abandon_recording(void) {
+  if (recording_list != -1) {
+    display_lists[recording_list].record_end = -1;
+    recording_list = -1;
+  }
+  list_depth = 0;
+}
+
+
+/* keeps the lists recorded this frame, with the hashes of their commands, and drops the ones not drawn */
+static void update_display_lists(void) {
+  abandon_recording();
+  for (int i = display_lists_count - 1; i >= 0; i--) {
+    DisplayList *list = &display_lists[i];
+    if (list->record_begin != -1) {
+      int size = list->record_end - list->record_begin;
+      /* unfinished, or missing commands the buffer had no room for */
+      bool complete = size >= 0 && !resize_issue && list->version;
+      if (complete && size > 0) {
+        uint8_t *commands = realloc(list->commands, size);
+        if ((complete = commands != NULL)) {
+          memcpy(commands, command_buf + list->record_begin, size);
+          list->commands = commands;
+        }
+      }
+      if (!complete) {
+        free_display_list(i);
+        continue;
+      }
+      list->size = size;
+      list->record_begin = -1;
+    }
+    if (!list->used) {
+      free_display_list(i);
+      continue;
+    }
+    list->used = false;
+  }
+}
+
+
 void rencache_invalidate(void) {
-  memset(cells_prev, 0xff, sizeof(cells_buf1));
+  if (cells_prev) {
+    memset(cells_prev, 0xff, cells_x * cells_y * sizeof(unsigned));
+  }
+}
+
+
+static int choose_cell_size(int w, int h) {
+  int size = line_height ? (line_height * CELL_LINES + CELL_SIZE_STEP - 1) / CELL_SIZE_STEP * CELL_SIZE_STEP : CELL_SIZE_MAX;
+  size = rencache_max(CELL_SIZE_MIN, rencache_min(size, CELL_SIZE_MAX));
+  while ((w / size + 1) * (h / size + 1) > CELLS_MAX) {
+    size += CELL_SIZE_STEP;
+  }
+  return size;
+}
+
+
+static void* resize_cell_buffer(void *buf, size_t size) {
+  void *new_buf = realloc(buf, size);
+  if (!new_buf) {
+    fprintf(stderr, "Error: (" __FILE__ "): unable to allocate the cell grid (%zu)\n", size);
+    exit(1);
+  }
+  return new_buf;
+}
+
+
+static void resize_cells(int w, int h, int size) {
+  cell_size = size;
+  /* the cells past the right and bottom edges are touched by commands ending on them */
+  cells_x = w / size + 1;
+  cells_y = h / size + 1;
+  int count = cells_x * cells_y;
+  cells = resize_cell_buffer(cells, count * sizeof(unsigned));
+  cells_prev = resize_cell_buffer(cells_prev, count * sizeof(unsigned));
+  cells_moved = resize_cell_buffer(cells_moved, count * sizeof(unsigned));
+  cells_dirty = resize_cell_buffer(cells_dirty, count * sizeof(bool));
+  cells_coarse_x = w / CELL_SIZE_MAX + 1;
+  cells_coarse_y = h / CELL_SIZE_MAX + 1;
+  cells_coarse = resize_cell_buffer(cells_coarse, cells_coarse_x * cells_coarse_y * sizeof(bool));
+  cell_commands_head = resize_cell_buffer(cell_commands_head, count * sizeof(int));
+  cell_commands_tail = resize_cell_buffer(cell_commands_tail, count * sizeof(int));
+  /* one more rect for the scrolled region */
+  rect_buf = resize_cell_buffer(rect_buf, (count + 1) * sizeof(RenRect));
+  rect_commands_start = resize_cell_buffer(rect_commands_start, (count + 1) * sizeof(int));
+  for (int i = 0; i < count; i++) {
+    cells[i] = HASH_INITIAL;
+  }
 }
 
 
 void rencache_begin_frame(RenWindow *window_renderer) {
-  /* reset all cells if the screen width/height has changed */
+  /* reset all cells if the screen width/height or the cell size has changed */
   int w, h;
   resize_issue = false;
   ren_get_size(window_renderer, &w, &h);
-  if (screen_rect.width != w || h != screen_rect.height) {
+  int size = choose_cell_size(w, h);
+  if (screen_rect.width != w || h != screen_rect.height || size != cell_size) {
     screen_rect.width = w;
     screen_rect.height = h;
+    resize_cells(w, h, size);
     rencache_invalidate();
   }
   last_clip_rect = screen_rect;
+  abandon_recording();
+  frame_stats = (RenCacheStats) { 0 };
+  frame_begin = SDL_GetPerformanceCounter();
+}
+
+
+static inline RenRect move_rect(RenRect r, int dy) {
+  return (RenRect) { r.x, r.y + dy, r.width, r.height };
 }
 
 
-static void update_overlapping_cells(RenRect r, unsigned h) {
-  int x1 = r.x / CELL_SIZE;
-  int y1 = r.y / CELL_SIZE;
-  int x2 = (r.x + r.width) / CELL_SIZE;
-  int y2 = (r.y + r.height) / CELL_SIZE;
+/* hashes a command into the rows [row1, row2) of grid, as if it had been drawn dy higher */
+static void update_overlapping_cells(unsigned *grid, Command *cmd, RenRect clip, RenRect r, unsigned content, int dy, int row1, int row2, int binned) {
+  r = intersect_rects(move_rect(r, -dy), screen_rect);
+  if (r.width == 0 || r.height == 0) { return; }
+  clip = move_rect(clip, -dy);
+  int text_y = cmd->command[0].y - dy;
+  int x1 = r.x / cell_size;
+  int y1 = rencache_max(r.y / cell_size, row1);
+  int x2 = (r.x + r.width) / cell_size;
+  int y2 = rencache_min((r.y + r.height) / cell_size, row2 - 1);
 
   for (int y = y1; y <= y2; y++) {
     for (int x = x1; x <= x2; x++) {
       int idx = cell_idx(x, y);
-      hash(&cells[idx], &h, sizeof(h));
+      RenRect cell = { x * cell_size, y * cell_size, cell_size, cell_size };
+      CellHash h = { content, intersect_rects(cmd->type == DRAW_TEXT ? clip : r, cell), 0 };
+      if (h.footprint.width == 0 || h.footprint.height == 0) {
+        h.footprint = (RenRect) { 0 };
+      } else {
+        h.footprint.x -= cell.x;
+        h.footprint.y -= cell.y;
+      }
+      if (cmd->type == DRAW_TEXT) {
+        h.y = text_y - cell.y;
+      }
+      hash(&grid[idx], &h, sizeof(h));
+      if (binned == -1 || binning_issue) {
+        continue;
+      }
+      if (!grow_buffer((void**)&cell_commands, &cell_commands_capacity, cell_commands_count, sizeof(CellCommand))) {
+        binning_issue = true;
+        continue;
+      }
+      int entry = cell_commands_count++;
+      cell_commands[entry] = (CellCommand) { binned, -1 };
+      if (cell_commands_head[idx] == -1) {
+        cell_commands_head[idx] = entry;
+      } else {
+        cell_commands[cell_commands_tail[idx]].next = entry;
+      }
+      cell_commands_tail[idx] = entry;
     }
   }
 }
 
 
+/* gathers the commands of the cells covered by r (still in cell units), in draw order. commands
+** spanning several cells are marked once in a bitmask, which is then read back in order */
+static void bin_rect_commands(RenRect r) {
+  int words = (binned_commands_count + 63) / 64;
+  if (binning_issue || !grow_buffer((void**)&rect_mask, &rect_mask_capacity, words, sizeof(uint64_t))) {
+    binning_issue = true;
+    return;
+  }
+  memset(rect_mask, 0, words * sizeof(uint64_t));
+  for (int y = r.y; y < r.y + r.height; y++) {
+    for (int x = r.x; x < r.x + r.width; x++) {
+      for (int entry = cell_commands_head[cell_idx(x, y)]; entry != -1; entry = cell_commands[entry].next) {
+        int binned = cell_commands[entry].binned;
+        rect_mask[binned / 64] |= (uint64_t)1 << (binned % 64);
+      }
+    }
+  }
+  for (int i = 0; i < words; i++) {
+    uint64_t bits = rect_mask[i];
+    for (int bit = 0; bits; bit++, bits >>= 1) {
+      if (!(bits & 1)) { continue; }
+      if (!grow_buffer((void**)&rect_commands, &rect_commands_capacity, rect_commands_count, sizeof(BinnedCommand))) {
+        binning_issue = true;
+        return;
+      }
+      rect_commands[rect_commands_count++] = binned_commands[i * 64 + bit];
+    }
+  }
+}
+
+
+/* the area of r a command may draw to, within its clip */
+static RenRect command_area(BinnedCommand *entry, RenRect r) {
+  Command *cmd = (Command*)(command_buf + entry->command);
+  RenRect area = cmd->command[0];
+  if (cmd->type == DRAW_TEXT) {
+    /* glyphs may reach past the box they're measured by, both ways */
+    int overhang = area.height / TEXT_OVERHANG_DIV + 1;
+    area = (RenRect) { area.x - overhang, area.y - overhang, area.width + overhang * 2, area.height + overhang * 2 };
+  }
+  if (entry->clip != -1) {
+    area = intersect_rects(area, ((Command*)(command_buf + entry->clip))->command[0]);
+  }
+  return intersect_rects(area, r);
+}
+
+
+static inline bool rect_contains(RenRect a, RenRect b) {
+  return b.x >= a.x && b.y >= a.y && b.x + b.width <= a.x + a.width && b.y + b.height <= a.y + a.height;
+}
+
+
+/* drops the commands of rect_buf[rect_idx] that opaque rects drawn after them cover entirely.
+** walking back from the last command, the largest opaque rects seen so far are the occluders */
+static int cull_rect_commands(int rect_idx, int out) {
+  RenRect r = rect_buf[rect_idx];
+  RenRect occluders[OCCLUDERS_MAX];
+  int occluders_count = 0, start = rect_commands_start[rect_idx], end = rect_commands_start[rect_idx + 1];
+  for (int i = end - 1; i >= start; i--) {
+    BinnedCommand *entry = &rect_commands[i];
+    RenRect area = command_area(entry, r);
+    bool hidden = area.width == 0 || area.height == 0;
+    for (int j = 0; j < occluders_count && !hidden; j++) {
+      hidden = rect_contains(occluders[j], area);
+    }
+    if (hidden) {
+      entry->command = -1;
+      continue;
+    }
+    Command *cmd = (Command*)(command_buf + entry->command);
+    if (cmd->type == DRAW_RECT && ((DrawRectCommand*)cmd->command)->color.a == 0xff) {
+      int smallest = 0;
+      for (int j = 1; j < occluders_count; j++) {
+        if (occluders[j].width * occluders[j].height < occluders[smallest].width * occluders[smallest].height)
+          smallest = j;
+      }
+      if (occluders_count < OCCLUDERS_MAX) {
+        occluders[occluders_count++] = area;
+      } else if (area.width * area.height > occluders[smallest].width * occluders[smallest].height) {
+        occluders[smallest] = area;
+      }
+    }
+  }
+  /* compact what's left, in order, to start at out */
+  rect_commands_start[rect_idx] = out;
+  for (int i = start; i < end; i++) {
+    if (rect_commands[i].command != -1) {
+      rect_commands[out++] = rect_commands[i];
+    } else {
+      frame_stats.culled++;
+    }
+  }
+  return out;
+}
+
+
+/* r is a run of changed cells on a row; it extends a rect covering the same columns on the rows
+** above it, so that rects never overlap and no cell that didn't change gets redrawn */
 static void push_rect(RenRect r, int *count) {
   /* try to merge with existing rectangle */
   for (int i = *count - 1; i >= 0; i--) {
     RenRect *rp = &rect_buf[i];
-    if (rects_overlap(*rp, r)) {
-      *rp = merge_rects(*rp, r);
+    if (rp->x == r.x && rp->width == r.width && rp->y + rp->height == r.y) {
+      rp->height += r.height;
       return;
     }
   }
@@ -261,80 +751,567 @@ static void push_rect(RenRect r, int *count) {
 }
 
 
-void rencache_end_frame(RenWindow *window_renderer) {
-  /* update cells from commands */
+static void draw_command(RenSurface *rs, Command *cmd) {
+  DrawRectCommand *rcmd = (DrawRectCommand*)&cmd->command;
+  DrawTextCommand *tcmd = (DrawTextCommand*)&cmd->command;
+  switch (cmd->type) {
+    case DRAW_RECT:
+      ren_draw_rect(rs, rcmd->rect, rcmd->color);
+      break;
+    case DRAW_TEXT:
+      ren_draw_text(rs, tcmd->fonts, tcmd->text, tcmd->len, tcmd->text_x, tcmd->rect.y, tcmd->color, tcmd->tab_size);
+      break;
+    default:
+      break;
+  }
+}
+
+
+/* replays the commands of rect_buf[rect_idx] clipped to r, which lies within it */
+static void draw_commands(RenSurface *rs, RenRect r, int rect_idx) {
+  ren_surface_set_clip_rect(rs, r);
+  if (binning_issue) {
+    /* no bins this frame, walk the whole buffer */
+    Command *cmd = NULL;
+    while (next_command(&cmd)) {
+      if (cmd->type == SET_CLIP)
+        ren_surface_set_clip_rect(rs, intersect_rects(((SetClipCommand*)&cmd->command)->rect, r));
+      else
+        draw_command(rs, cmd);
+    }
+    return;
+  }
+  int clip = -1;
+  for (int i = rect_commands_start[rect_idx]; i < rect_commands_start[rect_idx + 1]; i++) {
+    BinnedCommand *entry = &rect_commands[i];
+    if (entry->clip != clip) {
+      clip = entry->clip;
+      SetClipCommand *ccmd = (SetClipCommand*)&((Command*)(command_buf + clip))->command;
+      ren_surface_set_clip_rect(rs, intersect_rects(ccmd->rect, r));
+    }
+    draw_command(rs, (Command*)(command_buf + entry->command));
+  }
+}
+
+
+static void render_pool_draw_bands(void) {
+  int band;
+  while ((band = SDL_AtomicAdd(&render_pool.next_band, 1)) < render_pool.band_count) {
+    RenRect band_rect = { 0, render_pool.band_y + band * render_pool.band_height, screen_rect.width, render_pool.band_height };
+    RenSurface rs = render_pool.surface;
+    for (int i = 0; i < render_pool.rect_count; i++) {
+      RenRect r = intersect_rects(rect_buf[i], band_rect);
+      if (r.width > 0 && r.height > 0)
+        draw_commands(&rs, r, i);
+    }
+  }
+}
+
+
+static int render_pool_run(UNUSED void *data) {
+  while (true) {
+    SDL_SemWait(render_pool.start);
+    if (render_pool.quit)
+      break;
+    render_pool_draw_bands();
+    SDL_SemPost(render_pool.done);
+  }
+  return 0;
+}
+
+
+void rencache_stop_threads(void) {
+  if (!render_pool.initialized)
+    return;
+  render_pool.quit = true;
+  for (int i = 0; i < render_pool.thread_count; i++)
+    SDL_SemPost(render_pool.start);
+  for (int i = 0; i < render_pool.thread_count; i++)
+    SDL_WaitThread(render_pool.threads[i], NULL);
+  render_pool.quit = false;
+  render_pool.thread_count = 0;
+  SDL_DestroySemaphore(render_pool.start);
+  SDL_DestroySemaphore(render_pool.done);
+  render_pool.start = render_pool.done = NULL;
+  render_pool.initialized = false;
+}
+
+
+void rencache_set_thread_count(int count) {
+  rencache_stop_threads();
+  render_pool.start = SDL_CreateSemaphore(0);
+  render_pool.done = SDL_CreateSemaphore(0);
+  render_pool.initialized = true;
+  /* the main thread draws too, so it's one less thread to start */
+  count = rencache_min(count, RENDER_THREADS_MAX + 1) - 1;
+  if (!render_pool.start || !render_pool.done)
+    count = 0;
+  for (int i = 0; i < count; i++) {
+    render_pool.threads[i] = SDL_CreateThread(render_pool_run, "render", NULL);
+    if (!render_pool.threads[i]) {
+      fprintf(stderr, "Warning: (" __FILE__ "): unable to create render thread: %s\n", SDL_GetError());
+      break;
+    }
+    render_pool.thread_count++;
+  }
+}
+
+
+static void prepare_command(RenSurface *rs, Command *cmd) {
+  if (cmd->type == DRAW_TEXT) {
+    DrawTextCommand *tcmd = (DrawTextCommand*)&cmd->command;
+    ren_prepare_text(rs, tcmd->fonts, tcmd->text, tcmd->len, tcmd->text_x, tcmd->color, tcmd->tab_size);
+  }
+}
+
+
+/* loads every glyph the dirty region needs up front, as the glyph caches can't be written to while drawing concurrently */
+static void prepare_commands(RenSurface *rs, int rect_count) {
+  if (binning_issue) {
+    Command *cmd = NULL;
+    while (next_command(&cmd))
+      prepare_command(rs, cmd);
+    return;
+  }
+  for (int i = 0; i < rect_commands_start[rect_count]; i++)
+    prepare_command(rs, (Command*)(command_buf + rect_commands[i].command));
+}
+
+
+/* returns false if a glyph was missing from the caches and the region has to be drawn again */
+static bool draw_concurrently(RenSurface *rs, int rect_count) {
+  int y1 = screen_rect.height, y2 = 0;
+  for (int i = 0; i < rect_count; i++) {
+    y1 = rencache_min(y1, rect_buf[i].y);
+    y2 = rencache_max(y2, rect_buf[i].y + rect_buf[i].height);
+  }
+  int bands = (render_pool.thread_count + 1) * RENDER_BANDS_PER_THREAD;
+  render_pool.band_y = y1;
+  render_pool.band_height = rencache_max(RENDER_BAND_MIN_HEIGHT, (y2 - y1 + bands - 1) / bands);
+  render_pool.band_count = (y2 - y1 + render_pool.band_height - 1) / render_pool.band_height;
+  render_pool.rect_count = rect_count;
+  render_pool.surface = *rs;
+  SDL_AtomicSet(&render_pool.next_band, 0);
+
+  prepare_commands(rs, rect_count);
+  ren_begin_concurrent_draw();
+  for (int i = 0; i < render_pool.thread_count; i++)
+    SDL_SemPost(render_pool.start);
+  render_pool_draw_bands();
+  for (int i = 0; i < render_pool.thread_count; i++)
+    SDL_SemWait(render_pool.done);
+  return ren_end_concurrent_draw();
+}
+
+
+/* moves line_height to the smallest text height of the frame once the last LINE_HEIGHT_FRAMES
+** frames all agree it's smaller (or larger) than line_height; the first frame sets it right away */
+static void update_line_height(void) {
+  if (!frame_line_height) { return; }
+  line_heights[line_heights_next] = frame_line_height;
+  line_heights_next = (line_heights_next + 1) % LINE_HEIGHT_FRAMES;
+  line_heights_count = rencache_min(line_heights_count + 1, LINE_HEIGHT_FRAMES);
+  if (!line_height) {
+    line_height = frame_line_height;
+    return;
+  }
+  if (line_heights_count < LINE_HEIGHT_FRAMES) { return; }
+  int min = line_heights[0], max = line_heights[0];
+  for (int i = 1; i < LINE_HEIGHT_FRAMES; i++) {
+    min = rencache_min(min, line_heights[i]);
+    max = rencache_max(max, line_heights[i]);
+  }
+  if (max < line_height) {
+    line_height = max;
+  } else if (min > line_height) {
+    line_height = min;
+  }
+}
+
+
+/* the area the dirty rects would have covered with the largest cells, for the stats */
+static int coarse_dirty_area(int rect_count) {
+  memset(cells_coarse, 0, cells_coarse_x * cells_coarse_y * sizeof(bool));
+  int area = 0;
+  for (int i = 0; i < rect_count; i++) {
+    RenRect r = rect_buf[i];
+    for (int y = r.y / CELL_SIZE_MAX; y <= (r.y + r.height - 1) / CELL_SIZE_MAX; y++) {
+      for (int x = r.x / CELL_SIZE_MAX; x <= (r.x + r.width - 1) / CELL_SIZE_MAX; x++) {
+        if (!cells_coarse[x + y * cells_coarse_x]) {
+          cells_coarse[x + y * cells_coarse_x] = true;
+          RenRect cell = intersect_rects((RenRect) { x * CELL_SIZE_MAX, y * CELL_SIZE_MAX, CELL_SIZE_MAX, CELL_SIZE_MAX }, screen_rect);
+          area += cell.width * cell.height;
+        }
+      }
+    }
+  }
+  return area;
+}
+
+
+/* hashes the commands into the rows [row1, row2) of grid, as if they had been drawn dy higher.
+** the pass over the actual frame (dy == 0, into cells) also bins the commands and notes where
+** text was drawn */
+static void hash_commands(unsigned *grid, int dy, int row1, int row2) {
   Command *cmd = NULL;
   RenRect cr = screen_rect;
+  int clip = -1;
+  bool frame = grid == cells;
   while (next_command(&cmd)) {
+    if (frame) { frame_stats.commands++; }
     /* cmd->command[0] should always be the Command rect */
-    if (cmd->type == SET_CLIP) { cr = cmd->command[0]; }
-    RenRect r = intersect_rects(cmd->command[0], cr);
+    if (cmd->type == SET_CLIP) { cr = cmd->command[0]; clip = (uint8_t*)cmd - command_buf; continue; }
+    RenRect r = cmd->command[0];
+    if (cmd->type == DRAW_TEXT) {
+      /* glyphs may reach past the advance they're measured by (italics, box drawing) */
+      int overhang = r.height / TEXT_OVERHANG_DIV + 1;
+      r = (RenRect) { r.x - overhang, r.y, r.width + overhang * 2, r.height };
+    }
+    r = intersect_rects(r, cr);
     if (r.width == 0 || r.height == 0) { continue; }
-    unsigned h = HASH_INITIAL;
-    hash(&h, cmd, cmd->size);
-    update_overlapping_cells(r, h);
+    /* the rect goes into each cell's hash separately, relative to the cell */
+    unsigned content = cmd->hash;
+    if (!content) {
+      content = HASH_INITIAL;
+      hash(&content, &cmd->type, sizeof(cmd->type));
+      hash(&content, &cmd->size, sizeof(cmd->size));
+      hash(&content, (uint8_t*)cmd->command + sizeof(RenRect), cmd->size - COMMAND_BARE_SIZE - sizeof(RenRect));
+      cmd->hash = content;
+    }
+    int binned = -1;
+    if (frame && !binning_issue) {
+      if (grow_buffer((void**)&binned_commands, &binned_commands_capacity, binned_commands_count, sizeof(BinnedCommand))) {
+        binned = binned_commands_count++;
+        binned_commands[binned] = (BinnedCommand) { (uint8_t*)cmd - command_buf, clip };
+      } else {
+        binning_issue = true;
+      }
+    }
+    if (frame && cmd->type == DRAW_TEXT) {
+      if (cmd->command[0].height > 0 && (!frame_line_height || cmd->command[0].height < frame_line_height)) {
+        frame_line_height = cmd->command[0].height;
+      }
+      if (grow_buffer((void**)&texts, &texts_capacity, texts_count, sizeof(TextPosition))) {
+        texts[texts_count++] = (TextPosition) { content, cmd->command[0].y, cr };
+      }
+    }
+    update_overlapping_cells(grid, cmd, cr, r, content, dy, row1, row2, binned);
+  }
+}
+
+
+/* rebuilds the table of the previous frame's text positions, an open addressed hash on their content */
+static void index_texts(void) {
+  TextPosition *tmp = texts_prev;
+  texts_prev = texts;
+  texts = tmp;
+  int capacity = texts_prev_capacity;
+  texts_prev_capacity = texts_capacity;
+  texts_capacity = capacity;
+  texts_prev_count = texts_count;
+  texts_count = 0;
+
+  int size = 64;
+  while (size < texts_prev_count * 2) {
+    size *= 2;
+  }
+  if (size > texts_table_size) {
+    int *new_table = realloc(texts_table, size * sizeof(int));
+    if (!new_table) {
+      texts_prev_count = 0;
+      return;
+    }
+    texts_table = new_table;
+    texts_table_size = size;
+  }
+  memset(texts_table, 0xff, texts_table_size * sizeof(int));
+  for (int i = 0; i < texts_prev_count; i++) {
+    int slot = texts_prev[i].content & (texts_table_size - 1);
+    while (texts_table[slot] != -1) {
+      slot = (slot + 1) & (texts_table_size - 1);
+    }
+    texts_table[slot] = i;
+  }
+}
+
+
+/* guesses which clip region scrolled, and by how much, from the text that was drawn again in the
+** same region at another height. the guess only decides what to check, the cells decide what is kept */
+static bool find_scroll(RenRect *region, int *dy) {
+  ScrollCandidate candidates[SCROLL_CANDIDATES];
+  int candidate_count = 0;
+  if (texts_prev_count == 0) { return false; }
+  for (int i = 0; i < texts_count; i++) {
+    TextPosition *text = &texts[i];
+    int matches = 0;
+    for (int slot = text->content & (texts_table_size - 1); texts_table[slot] != -1 && matches < SCROLL_MAX_MATCHES; slot = (slot + 1) & (texts_table_size - 1)) {
+      TextPosition *prev = &texts_prev[texts_table[slot]];
+      if (prev->content != text->content || memcmp(&prev->clip, &text->clip, sizeof(RenRect)) != 0) { continue; }
+      matches++;
+      int moved = text->y - prev->y;
+      if (moved == 0 || abs(moved) >= text->clip.height) { continue; }
+      int c = 0;
+      while (c < candidate_count && (candidates[c].dy != moved || memcmp(&candidates[c].clip, &text->clip, sizeof(RenRect)) != 0)) {
+        c++;
+      }
+      if (c == candidate_count) {
+        if (candidate_count == SCROLL_CANDIDATES) { continue; }
+        candidates[candidate_count++] = (ScrollCandidate) { text->clip, moved, 0 };
+      }
+      candidates[c].votes++;
+    }
+  }
+  int best = -1;
+  for (int c = 0; c < candidate_count; c++) {
+    if (candidates[c].votes >= SCROLL_MIN_VOTES && (best == -1 || candidates[c].votes > candidates[best].votes)) {
+      best = c;
+    }
+  }
+  if (best == -1) { return false; }
+  *region = candidates[best].clip;
+  *dy = candidates[best].dy;
+  return true;
+}
+
+
+/* whether a cell has to be redrawn once the region is moved by dy: the part of the cell inside the
+** moved region must come from cells whose content moved unchanged, the rest mustn't have changed */
+static bool cell_changed_after_move(int x, int y, RenRect moved, int dy) {
+  int idx = cell_idx(x, y);
+  RenRect cell = intersect_rects((RenRect) { x * cell_size, y * cell_size, cell_size, cell_size }, screen_rect);
+  RenRect inside = intersect_rects(cell, moved);
+  if (inside.width == 0 || inside.height == 0) {
+    return cells[idx] != cells_prev[idx];
+  }
+  if ((inside.width != cell.width || inside.height != cell.height) && cells[idx] != cells_prev[idx]) {
+    return true;
+  }
+  for (int from = (inside.y - dy) / cell_size; from <= (inside.y + inside.height - 1 - dy) / cell_size; from++) {
+    if (cells_moved[cell_idx(x, from)] != cells_prev[cell_idx(x, from)]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/* marks the cells to redraw; returns the part of the screen that can be moved by dy instead, if any */
+static RenRect mark_dirty_cells(int *dy) {
+  int dirty = 0;
+  for (int i = 0; i < cells_x * cells_y; i++) {
+    cells_dirty[i] = cells[i] != cells_prev[i];
+    dirty += cells_dirty[i];
+  }
+  RenRect region;
+  if (dirty < cells_x || !find_scroll(&region, dy)) {
+    return (RenRect) { 0 };
+  }
+  RenRect moved = intersect_rects(region, move_rect(region, *dy));
+  int row1 = (moved.y - *dy) / cell_size, row2 = (moved.y + moved.height - 1 - *dy) / cell_size + 1;
+  for (int i = row1 * cells_x; i < row2 * cells_x; i++) {
+    cells_moved[i] = HASH_INITIAL;
+  }
+  hash_commands(cells_moved, *dy, row1, row2);
+
+  int dirty_moved = 0;
+  for (int y = 0; y < cells_y; y++) {
+    for (int x = 0; x < cells_x; x++) {
+      dirty_moved += cell_changed_after_move(x, y, moved, *dy);
+    }
+  }
+  /* moving the pixels isn't free, it has to save a good share of the redraw */
+  if (dirty_moved * 2 > dirty) {
+    return (RenRect) { 0 };
+  }
+  for (int y = 0; y < cells_y; y++) {
+    for (int x = 0; x < cells_x; x++) {
+      cells_dirty[cell_idx(x, y)] = cell_changed_after_move(x, y, moved, *dy);
+    }
+  }
+  return region;
+}
+
+
+static bool record_font(RenFont *font, int tab_size, uint32_t *id) {
+  for (int i = 0; i < record_fonts_count; i++) {
+    if (record_fonts[i].font == font && record_fonts[i].tab_size == tab_size) {
+      *id = i;
+      return true;
+    }
+  }
+  if (!grow_buffer((void**)&record_fonts, &record_fonts_capacity, record_fonts_count, sizeof(*record_fonts))) {
+    return false;
   }
+  *id = record_fonts_count;
+  record_fonts[record_fonts_count].font = font;
+  record_fonts[record_fonts_count++].tab_size = tab_size;
+  float size;
+  ERenFontAntialiasing antialiasing;
+  ERenFontHinting hinting;
+  unsigned char style;
+  ren_font_get_options(font, &size, &antialiasing, &hinting, &style);
+  const char *path = ren_font_get_path(font);
+  uint32_t path_len = strlen(path);
+  uint8_t kind = RENCACHE_RECORD_FONT, options[4] = { antialiasing, hinting, style, tab_size };
+  return fwrite(&kind, 1, 1, record_file) && fwrite(id, sizeof(*id), 1, record_file)
+    && fwrite(&size, sizeof(size), 1, record_file) && fwrite(options, sizeof(options), 1, record_file)
+    && fwrite(&path_len, sizeof(path_len), 1, record_file) && fwrite(path, 1, path_len, record_file) == path_len;
+}
+
+
+/* writes the frame's commands as they were issued, fonts identified by how they were loaded */
+static void record_frame(void) {
+  uint8_t kind = RENCACHE_RECORD_FRAME;
+  bool ok = fwrite(&kind, 1, 1, record_file) && fwrite(&screen_rect.width, sizeof(int), 1, record_file)
+    && fwrite(&screen_rect.height, sizeof(int), 1, record_file);
+  record_fonts_count = 0;
+  Command *cmd = NULL;
+  while (ok && next_command(&cmd)) {
+    switch (cmd->type) {
+      case SET_CLIP: {
+        kind = RENCACHE_RECORD_CLIP;
+        ok = fwrite(&kind, 1, 1, record_file) && fwrite(&cmd->command[0], sizeof(RenRect), 1, record_file);
+        break;
+      }
+      case DRAW_RECT: {
+        DrawRectCommand *rcmd = (DrawRectCommand*)cmd->command;
+        kind = RENCACHE_RECORD_RECT;
+        ok = fwrite(&kind, 1, 1, record_file) && fwrite(&rcmd->rect, sizeof(RenRect), 1, record_file)
+          && fwrite(&rcmd->color, sizeof(RenColor), 1, record_file);
+        break;
+      }
+      case DRAW_TEXT: {
+        DrawTextCommand *tcmd = (DrawTextCommand*)cmd->command;
+        uint32_t ids[FONT_FALLBACK_MAX], count = 0, len = tcmd->len;
+        while (ok && count < FONT_FALLBACK_MAX && tcmd->fonts[count]) {
+          ok = record_font(tcmd->fonts[count], tcmd->tab_size, &ids[count]);
+          count++;
+        }
+        double x = tcmd->text_x;
+        kind = RENCACHE_RECORD_TEXT;
+        ok = ok && fwrite(&kind, 1, 1, record_file) && fwrite(&x, sizeof(x), 1, record_file)
+          && fwrite(&tcmd->rect.y, sizeof(int), 1, record_file) && fwrite(&tcmd->color, sizeof(RenColor), 1, record_file)
+          && fwrite(&count, sizeof(count), 1, record_file) && fwrite(ids, sizeof(uint32_t), count, record_file) == count
+          && fwrite(&len, sizeof(len), 1, record_file) && fwrite(tcmd->text, 1, len, record_file) == len;
+        break;
+      }
+    }
+  }
+  kind = RENCACHE_RECORD_END_FRAME;
+  if (!ok || !fwrite(&kind, 1, 1, record_file)) {
+    fprintf(stderr, "Warning: (" __FILE__ "): unable to record commands, recording stopped\n");
+    rencache_record_commands(NULL);
+  }
+}
+
+
+static double seconds_since(Uint64 start) {
+  return (SDL_GetPerformanceCounter() - start) / (double) SDL_GetPerformanceFrequency();
+}
+
+
+void rencache_end_frame(RenWindow *window_renderer) {
+  Uint64 end_frame_begin = SDL_GetPerformanceCounter();
+  frame_stats.lua_time = seconds_since(frame_begin);
+  frame_stats.command_bytes = command_buf_idx;
+  if (record_file) {
+    record_frame();
+  }
+  /* update cells from commands */
+  binning_issue = false;
+  cell_commands_count = 0;
+  binned_commands_count = 0;
+  frame_line_height = 0;
+  memset(cell_commands_head, 0xff, cells_x * cells_y * sizeof(int));
+  hash_commands(cells, 0, 0, cells_y);
+  update_display_lists();
+  int dy = 0;
+  RenRect scrolled = mark_dirty_cells(&dy);
+  index_texts();
 
   /* push rects for all cells changed from last frame, reset cells */
   int rect_count = 0;
-  int max_x = screen_rect.width / CELL_SIZE + 1;
-  int max_y = screen_rect.height / CELL_SIZE + 1;
-  for (int y = 0; y < max_y; y++) {
-    for (int x = 0; x < max_x; x++) {
-      /* compare previous and current cell for change */
+  for (int y = 0; y < cells_y; y++) {
+    int run = -1;
+    for (int x = 0; x <= cells_x; x++) {
       int idx = cell_idx(x, y);
-      if (cells[idx] != cells_prev[idx]) {
-        push_rect((RenRect) { x, y, 1, 1 }, &rect_count);
+      bool changed = x < cells_x && cells_dirty[idx];
+      frame_stats.cells_dirty += changed;
+      if (changed && run == -1) {
+        run = x;
+      } else if (!changed && run != -1) {
+        push_rect((RenRect) { run, y, x - run, 1 }, &rect_count);
+        run = -1;
+      }
+      if (x < cells_x) {
+        cells_prev[idx] = HASH_INITIAL;
       }
-      cells_prev[idx] = HASH_INITIAL;
     }
   }
 
-  /* expand rects from cells to pixels */
+  /* gather the commands of each rect, then expand rects from cells to pixels */
+  rect_commands_count = 0;
+  for (int i = 0; i < rect_count; i++) {
+    rect_commands_start[i] = rect_commands_count;
+    bin_rect_commands(rect_buf[i]);
+  }
+  rect_commands_start[rect_count] = rect_commands_count;
   for (int i = 0; i < rect_count; i++) {
     RenRect *r = &rect_buf[i];
-    r->x *= CELL_SIZE;
-    r->y *= CELL_SIZE;
-    r->width *= CELL_SIZE;
-    r->height *= CELL_SIZE;
+    r->x *= cell_size;
+    r->y *= cell_size;
+    r->width *= cell_size;
+    r->height *= cell_size;
     *r = intersect_rects(*r, screen_rect);
   }
+  if (!binning_issue) {
+    int kept = 0;
+    for (int i = 0; i < rect_count; i++)
+      kept = cull_rect_commands(i, kept);
+    rect_commands_start[rect_count] = kept;
+  }
+  /* the grid follows the text size, from the next frame on */
+  update_line_height();
 
   RenSurface rs = renwin_get_surface(window_renderer);
-  /* redraw updated regions */
-  for (int i = 0; i < rect_count; i++) {
-    /* draw */
-    RenRect r = rect_buf[i];
-    ren_set_clip_rect(window_renderer, r);
+  /* move what scrolled before drawing over what didn't */
+  if (scrolled.width > 0) {
+    ren_move_rect(&rs, scrolled, dy);
+  }
+  if (!render_pool.initialized)
+    rencache_set_thread_count(SDL_GetCPUCount());
+  int dirty_area = 0;
+  for (int i = 0; i < rect_count; i++)
+    dirty_area += rect_buf[i].width * rect_buf[i].height;
 
-    cmd = NULL;
-    while (next_command(&cmd)) {
-      SetClipCommand *ccmd = (SetClipCommand*)&cmd->command;
-      DrawRectCommand *rcmd = (DrawRectCommand*)&cmd->command;
-      DrawTextCommand *tcmd = (DrawTextCommand*)&cmd->command;
-      switch (cmd->type) {
-        case SET_CLIP:
-          ren_set_clip_rect(window_renderer, intersect_rects(ccmd->rect, r));
-          break;
-        case DRAW_RECT:
-          ren_draw_rect(&rs, rcmd->rect, rcmd->color);
-          break;
-        case DRAW_TEXT:
-          ren_font_group_set_tab_size(tcmd->fonts, tcmd->tab_size);
-          ren_draw_text(&rs, tcmd->fonts, tcmd->text, tcmd->len, tcmd->text_x, tcmd->rect.y, tcmd->color);
-          break;
-      }
-    }
+  /* redraw updated regions */
+  if (render_pool.thread_count == 0 || dirty_area < RENDER_CONCURRENT_MIN_AREA || !draw_concurrently(&rs, rect_count)) {
+    for (int i = 0; i < rect_count; i++)
+      draw_commands(&rs, rect_buf[i], i);
+  }
 
-    if (show_debug) {
+  if (show_debug) {
+    for (int i = 0; i < rect_count; i++) {
       RenColor color = { rand(), rand(), rand(), 50 };
-      ren_draw_rect(&rs, r, color);
+      ren_surface_set_clip_rect(&rs, rect_buf[i]);
+      ren_draw_rect(&rs, rect_buf[i], color);
     }
   }
 
+  frame_stats.cells = cells_x * cells_y;
+  frame_stats.rects = rect_count;
+  frame_stats.pixels = dirty_area;
+  frame_stats.pixels_saved = rect_count > 0 ? coarse_dirty_area(rect_count) - dirty_area : 0;
+  frame_stats.moved_pixels = scrolled.width * scrolled.height;
+
   /* update dirty rects */
+  if (scrolled.width > 0) {
+    rect_buf[rect_count++] = intersect_rects(scrolled, screen_rect);
+  }
   if (rect_count > 0) {
+    Uint64 update_begin = SDL_GetPerformanceCounter();
     ren_update_rects(window_renderer, rect_buf, rect_count);
+    frame_stats.update_rects_time = seconds_since(update_begin);
   }
 
   /* swap cell buffer and reset */
@@ -342,5 +1319,7 @@ void rencache_end_frame(RenWindow *window_renderer) {
   cells = cells_prev;
   cells_prev = tmp;
   command_buf_idx = 0;
+  frame_stats.end_frame_time = seconds_since(end_frame_begin);
+  stats = frame_stats;
 }
 
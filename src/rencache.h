@@ -5,11 +5,46 @@
 #include <lua.h>
 #include "renderer.h"
 
+/* counters and timings (in seconds) of the last frame */
+typedef struct {
+  int commands, command_bytes, lists_replayed, culled;
+  int cells, cells_dirty;
+  /* pixels_saved: how many fewer pixels were redrawn than with the largest cells */
+  int rects, pixels, pixels_saved, moved_pixels;
+  double lua_time, end_frame_time, update_rects_time;
+} RenCacheStats;
+
+/* a file written by rencache_record_commands begins with RENCACHE_RECORD_MAGIC, followed by
+** records made of a kind byte and their fields, in native byte order:
+**   FRAME      int width, height
+**   FONT       uint32_t id, float size, uint8_t antialiasing, hinting, style, tab_size,
+**              uint32_t path_len, char path[path_len]
+**   CLIP       RenRect rect
+**   RECT       RenRect rect, RenColor color
+**   TEXT       double x, int y, RenColor color, uint32_t font_count, uint32_t font_ids[font_count],
+**              uint32_t len, char text[len]
+**   END_FRAME
+** font ids are only valid until the end of the frame that defines them */
+#define RENCACHE_RECORD_MAGIC "LXRC1\n"
+enum {
+  RENCACHE_RECORD_FRAME = 'F', RENCACHE_RECORD_FONT = 'f', RENCACHE_RECORD_CLIP = 'c',
+  RENCACHE_RECORD_RECT = 'r', RENCACHE_RECORD_TEXT = 't', RENCACHE_RECORD_END_FRAME = 'E'
+};
+
 void  rencache_show_debug(bool enable);
+bool  rencache_record_commands(const char *path);
+void  rencache_get_stats(RenCacheStats *stats);
+void  rencache_set_thread_count(int count);
+void  rencache_stop_threads(void);
 void  rencache_set_clip_rect(RenRect rect);
 void  rencache_draw_rect(RenRect rect, RenColor color);
 double rencache_draw_text(RenWindow *window_renderer, RenFont **font, const char *text, size_t len, double x, int y, RenColor color);
 void  rencache_invalidate(void);
+bool  rencache_begin_list(const char *id, size_t id_len, const char *version, size_t version_len);
+void  rencache_end_list(void);
+bool  rencache_is_recording(void);
+bool  rencache_has_list(const char *id, size_t id_len);
+void  rencache_drop_lists(void);
 void  rencache_begin_frame(RenWindow *window_renderer);
 void  rencache_end_frame(RenWindow *window_renderer);
 
@@ -3,14 +3,30 @@
 #include <stdint.h>
 #include <assert.h>
 #include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
 #include <ft2build.h>
 #include <freetype/ftlcdfil.h>
 #include <freetype/ftoutln.h>
 #include FT_FREETYPE_H
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define RENDERER_BLEND_X86 1
+  #include <immintrin.h>
+#elif defined(__ARM_NEON)
+  #define RENDERER_BLEND_NEON 1
+  #include <arm_neon.h>
+#endif
+
 #ifdef _WIN32
 #include <windows.h>
+#include <direct.h>
 LPWSTR utfconv_utf8towc(const char *str);
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 #include "renderer.h"
@@ -19,12 +35,30 @@ LPWSTR utfconv_utf8towc(const char *str);
 #define MAX_GLYPHSET 256
 #define MAX_LOADABLE_GLYPHSETS 1024
 #define SUBPIXEL_BITMAPS_CACHED 3
+#define GLYPH_ATLAS_WIDTH 1024
+#define GLYPH_ATLAS_INITIAL_SHELVES 8
+#ifndef GLYPH_ATLAS_MAX_SIZE
+  #define GLYPH_ATLAS_MAX_SIZE (8 * 1024 * 1024)
+#endif
+#define WIDTH_CACHE_SIZE 1024
+#define WIDTH_CACHE_MAX_TEXT 256
+#define GLYPH_CACHE_MAGIC "LXLGLYPH"
+#define GLYPH_CACHE_VERSION 2
 
 RenWindow window_renderer = {0};
 static FT_Library library;
+static unsigned int font_generation;
+// directory the persistent glyph caches are stored in; NULL if disabled.
+static char* glyph_cache_dir;
 
 // draw_rect_surface is used as a 1x1 surface to simplify ren_draw_rect with blending
 static SDL_Surface *draw_rect_surface;
+static SDL_mutex *draw_rect_lock;
+
+// while set, several threads are drawing at once; the glyph caches are only read, and anything
+// that isn't already cached marks the draw as incomplete, instead of being loaded.
+static bool draw_concurrent;
+static SDL_atomic_t draw_incomplete;
 
 static void* check_alloc(void *ptr) {
   if (!ptr) {
@@ -34,24 +68,92 @@ static void* check_alloc(void *ptr) {
   return ptr;
 }
 
+// 64bit fnv-1a hash
+#define FNV_HASH_INITIAL 14695981039346656037ULL
+static uint64_t fnv_hash(uint64_t hash, const void* data, size_t size) {
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ ((const uint8_t*)data)[i]) * 1099511628211ULL;
+  return hash;
+}
+
 /************************* Fonts *************************/
 
+// location of a rasterized bitmap in the font's atlas; only valid while the generation matches the shelf's.
+// if the glyph worker prerendered the bitmap (only ever for offset 0), staged points to its tightly packed rows,
+// which are copied into the atlas on use.
 typedef struct {
-  unsigned short x0, x1, y0, y1, loaded;
+  unsigned short x0, x1, y0, y1;
   short bitmap_left, bitmap_top;
+  unsigned short shelf;
+  unsigned int generation;
+  const uint8_t* staged;
+} GlyphBitmap;
+
+// metrics are resolved the first time a codepoint is looked up, and are shared by every subpixel offset;
+// bitmaps are only rasterized for the offsets that are actually drawn.
+typedef struct {
+  bool resolved, loaded;
   float xadvance;
+  unsigned int glyph_index;
+  GlyphBitmap bitmaps[SUBPIXEL_BITMAPS_CACHED];
 } GlyphMetric;
 
 typedef struct {
-  SDL_Surface* surface;
   GlyphMetric metrics[MAX_GLYPHSET];
+  uint8_t* staging;
+  int staging_size;
 } GlyphSet;
 
+// a shelf is a horizontal band of the atlas that glyphs are packed into left to right.
+// shelves are the unit of eviction; evicting one bumps its generation, which invalidates every glyph on it.
+typedef struct {
+  unsigned int last_used, generation;
+  unsigned short pen_x;
+} GlyphShelf;
+
+typedef struct {
+  SDL_Surface* surface;
+  GlyphShelf* shelves;
+  int shelf_count, shelf_capacity, shelf_height;
+  unsigned int tick, glyphs, evictions;
+  // if the surface was restored from a glyph cache file, its pixels are backed by this mapping.
+  void* mapping;
+  size_t mapping_size;
+  // bytes of the font's memory budget held by the surface.
+  int reserved;
+} GlyphAtlas;
+
+typedef struct {
+  uint64_t hash;
+  double width;
+  size_t len;
+  char* text;
+} WidthCacheEntry;
+
+// direct-mapped cache of text run widths, owned by the first font of a group.
+typedef struct {
+  WidthCacheEntry* entries;
+  unsigned int hits, misses;
+} WidthCache;
+
 typedef struct RenFont {
   FT_Face face;
-  GlyphSet* sets[SUBPIXEL_BITMAPS_CACHED][MAX_LOADABLE_GLYPHSETS];
+  // a separate face for the glyph worker, only touched while holding its render lock.
+  FT_Face worker_face;
+  int pixel_size, worker_pixel_size;
+  GlyphSet* sets[MAX_LOADABLE_GLYPHSETS];
+  GlyphAtlas atlas;
+  // bytes held by the atlas surface and the glyph worker's staging buffers, which share GLYPH_ATLAS_MAX_SIZE.
+  SDL_atomic_t memory_used;
+  WidthCache width_cache;
+  // unique across all fonts, and renewed whenever the font's metrics change; used to key cached widths.
+  unsigned int generation;
+  // identifies the font file for the persistent glyph cache; dirty is set when glyphs were rasterized since it was loaded.
+  int64_t source_mtime;
+  uint64_t source_size;
+  bool glyph_cache_dirty;
   float size, space_advance, tab_advance;
-  unsigned short max_height, baseline, height;
+  unsigned short baseline, height;
   ERenFontAntialiasing antialiasing;
   ERenFontHinting hinting;
   unsigned char style;
@@ -87,7 +189,7 @@ static int font_set_load_options(RenFont* font) {
   return load_target | hinting;
 }
 
-static int font_set_render_options(RenFont* font) {
+static int font_set_render_options(RenFont* font, FT_Library library) {
   if (font->antialiasing == FONT_ANTIALIASING_NONE)
     return FT_RENDER_MODE_MONO;
   if (font->antialiasing == FONT_ANTIALIASING_SUBPIXEL) {
@@ -121,100 +223,828 @@ static int font_set_style(FT_Outline* outline, int x_translation, unsigned char
   return 0;
 }
 
-static void font_load_glyphset(RenFont* font, int idx) {
-  unsigned int render_option = font_set_render_options(font), load_option = font_set_load_options(font);
-  int bitmaps_cached = font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? SUBPIXEL_BITMAPS_CACHED : 1;
-  unsigned int byte_width = font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? 3 : 1;
-  for (int j = 0, pen_x = 0; j < bitmaps_cached; ++j) {
-    GlyphSet* set = check_alloc(calloc(1, sizeof(GlyphSet)));
-    font->sets[j][idx] = set;
-    for (int i = 0; i < MAX_GLYPHSET; ++i) {
-      int glyph_index = FT_Get_Char_Index(font->face, i + idx * MAX_GLYPHSET);
-      if (!glyph_index || FT_Load_Glyph(font->face, glyph_index, load_option | FT_LOAD_BITMAP_METRICS_ONLY)
-        || font_set_style(&font->face->glyph->outline, j * (64 / SUBPIXEL_BITMAPS_CACHED), font->style) || FT_Render_Glyph(font->face->glyph, render_option)) {
-        continue;
-      }
-      FT_GlyphSlot slot = font->face->glyph;
-      int glyph_width = slot->bitmap.width / byte_width;
-      if (font->antialiasing == FONT_ANTIALIASING_NONE)
-        glyph_width *= 8;
-      set->metrics[i] = (GlyphMetric){ pen_x, pen_x + glyph_width, 0, slot->bitmap.rows, true, slot->bitmap_left, slot->bitmap_top, (slot->advance.x + slot->lsb_delta - slot->rsb_delta) / 64.0f};
-      pen_x += glyph_width;
-      font->max_height = slot->bitmap.rows > font->max_height ? slot->bitmap.rows : font->max_height;
-      // In order to fix issues with monospacing; we need the unhinted xadvance; as FreeType doesn't correctly report the hinted advance for spaces on monospace fonts (like RobotoMono). See #843.
-      if (!glyph_index || FT_Load_Glyph(font->face, glyph_index, (load_option | FT_LOAD_BITMAP_METRICS_ONLY | FT_LOAD_NO_HINTING) & ~FT_LOAD_FORCE_AUTOHINT)
-        || font_set_style(&font->face->glyph->outline, j * (64 / SUBPIXEL_BITMAPS_CACHED), font->style) || FT_Render_Glyph(font->face->glyph, render_option)) {
-        continue;
-      }
-      slot = font->face->glyph;
-      set->metrics[i].xadvance = slot->advance.x / 64.0f;
-    }
-    if (pen_x == 0)
-      continue;
-    set->surface = check_alloc(SDL_CreateRGBSurface(0, pen_x, font->max_height, font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? 24 : 8, 0, 0, 0, 0));
-    uint8_t* pixels = set->surface->pixels;
-    for (int i = 0; i < MAX_GLYPHSET; ++i) {
-      int glyph_index = FT_Get_Char_Index(font->face, i + idx * MAX_GLYPHSET);
-      if (!glyph_index || FT_Load_Glyph(font->face, glyph_index, load_option))
-        continue;
-      FT_GlyphSlot slot = font->face->glyph;
-      font_set_style(&slot->outline, (64 / bitmaps_cached) * j, font->style);
-      if (FT_Render_Glyph(slot, render_option))
-        continue;
-      for (unsigned int line = 0; line < slot->bitmap.rows; ++line) {
-        int target_offset = set->surface->pitch * line + set->metrics[i].x0 * byte_width;
-        int source_offset = line * slot->bitmap.pitch;
-        if (font->antialiasing == FONT_ANTIALIASING_NONE) {
-          for (unsigned int column = 0; column < slot->bitmap.width; ++column) {
-            int current_source_offset = source_offset + (column / 8);
-            int source_pixel = slot->bitmap.buffer[current_source_offset];
-            pixels[++target_offset] = ((source_pixel >> (7 - (column % 8))) & 0x1) << 7;
-          }
-        } else
-          memcpy(&pixels[target_offset], &slot->bitmap.buffer[source_offset], slot->bitmap.width);
-      }
+static int font_get_byte_width(RenFont* font) {
+  return font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? 3 : 1;
+}
+
+static void font_load_glyph_metric(RenFont* font, FT_Face face, GlyphMetric* metric, unsigned int codepoint) {
+  metric->resolved = true;
+  metric->glyph_index = FT_Get_Char_Index(face, codepoint);
+  // In order to fix issues with monospacing; we need the unhinted xadvance; as FreeType doesn't correctly report the hinted advance for spaces on monospace fonts (like RobotoMono). See #843.
+  if (!metric->glyph_index || FT_Load_Glyph(face, metric->glyph_index, (font_set_load_options(font) | FT_LOAD_BITMAP_METRICS_ONLY | FT_LOAD_NO_HINTING) & ~FT_LOAD_FORCE_AUTOHINT))
+    return;
+  metric->loaded = true;
+  metric->xadvance = face->glyph->advance.x / 64.0f;
+}
+
+static FT_GlyphSlot font_render_glyph(RenFont* font, FT_Library library, FT_Face face, unsigned int glyph_index, int subpixel_idx) {
+  unsigned int render_option = font_set_render_options(font, library), load_option = font_set_load_options(font);
+  if (!glyph_index || FT_Load_Glyph(face, glyph_index, load_option))
+    return NULL;
+  FT_GlyphSlot slot = face->glyph;
+  font_set_style(&slot->outline, (64 / SUBPIXEL_BITMAPS_CACHED) * subpixel_idx, font->style);
+  if (FT_Render_Glyph(slot, render_option))
+    return NULL;
+  return slot;
+}
+
+static unsigned int font_get_glyph_width(RenFont* font, FT_GlyphSlot slot) {
+  unsigned int width = font->antialiasing == FONT_ANTIALIASING_NONE ? slot->bitmap.width : slot->bitmap.width / font_get_byte_width(font);
+  return width > GLYPH_ATLAS_WIDTH ? GLYPH_ATLAS_WIDTH : width;
+}
+
+// the set table is shared with the glyph worker, which publishes complete sets into empty slots.
+static GlyphSet* font_get_glyphset(RenFont* font, unsigned int codepoint) {
+  int idx = (codepoint >> 8) % MAX_LOADABLE_GLYPHSETS;
+  GlyphSet* set = SDL_AtomicGetPtr((void**)&font->sets[idx]);
+  if (!set) {
+    set = check_alloc(calloc(1, sizeof(GlyphSet)));
+    if (!SDL_AtomicCASPtr((void**)&font->sets[idx], NULL, set)) {
+      free(set);
+      set = SDL_AtomicGetPtr((void**)&font->sets[idx]);
     }
   }
+  return set;
 }
 
-static GlyphSet* font_get_glyphset(RenFont* font, unsigned int codepoint, int subpixel_idx) {
-  int idx = (codepoint >> 8) % MAX_LOADABLE_GLYPHSETS;
-  if (!font->sets[font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? subpixel_idx : 0][idx])
-    font_load_glyphset(font, idx);
-  return font->sets[font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? subpixel_idx : 0][idx];
+static GlyphMetric* font_get_glyph_metric(RenFont* font, unsigned int codepoint) {
+  if (draw_concurrent) {
+    static GlyphMetric missing = { true, false };
+    GlyphSet* set = SDL_AtomicGetPtr((void**)&font->sets[(codepoint >> 8) % MAX_LOADABLE_GLYPHSETS]);
+    if (set && set->metrics[codepoint % MAX_GLYPHSET].resolved)
+      return &set->metrics[codepoint % MAX_GLYPHSET];
+    SDL_AtomicSet(&draw_incomplete, 1);
+    return &missing;
+  }
+  GlyphMetric* metric = &font_get_glyphset(font, codepoint)->metrics[codepoint % MAX_GLYPHSET];
+  if (!metric->resolved)
+    font_load_glyph_metric(font, font->face, metric, codepoint);
+  return metric;
 }
 
-static RenFont* font_group_get_glyph(GlyphSet** set, GlyphMetric** metric, RenFont** fonts, unsigned int codepoint, int bitmap_index) {
+static RenFont* font_group_get_glyph(GlyphMetric** metric, RenFont** fonts, unsigned int codepoint) {
   if (!metric) {
     return NULL;
   }
-  if (bitmap_index < 0)
-    bitmap_index += SUBPIXEL_BITMAPS_CACHED;
   for (int i = 0; i < FONT_FALLBACK_MAX && fonts[i]; ++i) {
-    *set = font_get_glyphset(fonts[i], codepoint, bitmap_index);
-    *metric = &(*set)->metrics[codepoint % 256];
+    *metric = font_get_glyph_metric(fonts[i], codepoint);
     if ((*metric)->loaded || codepoint < 0xFF)
       return fonts[i];
   }
   if (*metric && !(*metric)->loaded && codepoint > 0xFF && codepoint != 0x25A1)
-    return font_group_get_glyph(set, metric, fonts, 0x25A1, bitmap_index);
+    return font_group_get_glyph(metric, fonts, 0x25A1);
   return fonts[0];
 }
 
+/******************* Glyph Atlas *********************/
+
+// reserves up to bytes of the font's memory budget, in multiples of unit, and returns how many were reserved.
+// the budget is shared with the glyph worker, which reserves the staging buffers of the sets it builds.
+static int font_reserve_memory(RenFont* font, int bytes, int unit) {
+  while (true) {
+    int used = SDL_AtomicGet(&font->memory_used);
+    int available = (GLYPH_ATLAS_MAX_SIZE - used) / unit * unit;
+    int reserved = bytes < available ? bytes : available;
+    if (reserved <= 0)
+      return 0;
+    if (SDL_AtomicCAS(&font->memory_used, used, used + reserved))
+      return reserved;
+  }
+}
+
+static void font_release_memory(RenFont* font, int bytes) {
+  SDL_AtomicAdd(&font->memory_used, -bytes);
+}
+
+static int atlas_get_shelf_height(RenFont* font) {
+  FT_Face face = font->face;
+  int height = FT_IS_SCALABLE(face) ? FT_MulFix(face->bbox.yMax - face->bbox.yMin, face->size->metrics.y_scale) >> 6 : face->size->metrics.height >> 6;
+  // leave some room for emboldening and the italic transform.
+  return (height > 0 ? height : 1) + 2;
+}
+
+static void atlas_free_surface(GlyphAtlas* atlas) {
+  if (atlas->surface)
+    SDL_FreeSurface(atlas->surface);
+  atlas->surface = NULL;
+  if (atlas->mapping) {
+#ifdef _WIN32
+    free(atlas->mapping);
+#else
+    munmap(atlas->mapping, atlas->mapping_size);
+#endif
+    atlas->mapping = NULL;
+    atlas->mapping_size = 0;
+  }
+}
+
+static void atlas_free(RenFont* font) {
+  GlyphAtlas* atlas = &font->atlas;
+  font_release_memory(font, atlas->reserved);
+  atlas_free_surface(atlas);
+  free(atlas->shelves);
+  unsigned int glyphs = atlas->glyphs, evictions = atlas->evictions;
+  memset(atlas, 0, sizeof(GlyphAtlas));
+  atlas->glyphs = glyphs;
+  atlas->evictions = evictions;
+}
+
+static int atlas_get_max_shelves(RenFont* font) {
+  int max_shelves = GLYPH_ATLAS_MAX_SIZE / (GLYPH_ATLAS_WIDTH * font_get_byte_width(font) * font->atlas.shelf_height);
+  return max_shelves > 1 ? max_shelves : 1;
+}
+
+// grows the atlas surface, keeping the existing pixels in place, so that every glyph coordinate stays valid.
+static bool atlas_grow(RenFont* font) {
+  GlyphAtlas* atlas = &font->atlas;
+  if (!atlas->shelf_height)
+    atlas->shelf_height = atlas_get_shelf_height(font);
+  int max_shelves = atlas_get_max_shelves(font);
+  if (atlas->shelf_capacity >= max_shelves)
+    return false;
+  int capacity = atlas->shelf_capacity ? atlas->shelf_capacity * 2 : GLYPH_ATLAS_INITIAL_SHELVES;
+  capacity = capacity > max_shelves ? max_shelves : capacity;
+  // staged glyph sets may hold part of the budget
+  int shelf_size = GLYPH_ATLAS_WIDTH * font_get_byte_width(font) * atlas->shelf_height;
+  int reserved = font_reserve_memory(font, (capacity - atlas->shelf_capacity) * shelf_size, shelf_size);
+  if (!reserved)
+    return false;
+  atlas->reserved += reserved;
+  capacity = atlas->shelf_capacity + reserved / shelf_size;
+  SDL_Surface* surface = check_alloc(SDL_CreateRGBSurface(0, GLYPH_ATLAS_WIDTH, capacity * atlas->shelf_height, font_get_byte_width(font) * 8, 0, 0, 0, 0));
+  if (atlas->surface) {
+    memcpy(surface->pixels, atlas->surface->pixels, atlas->surface->pitch * atlas->surface->h);
+    atlas_free_surface(atlas);
+  }
+  atlas->surface = surface;
+  atlas->shelves = check_alloc(realloc(atlas->shelves, sizeof(GlyphShelf) * capacity));
+  memset(&atlas->shelves[atlas->shelf_capacity], 0, sizeof(GlyphShelf) * (capacity - atlas->shelf_capacity));
+  atlas->shelf_capacity = capacity;
+  return true;
+}
+
+// finds room for a glyph of the specified width; if the atlas is at its memory budget, evicts the least recently used shelf.
+static int atlas_allocate(RenFont* font, int width, unsigned short* x) {
+  GlyphAtlas* atlas = &font->atlas;
+  for (int i = atlas->shelf_count - 1; i >= 0; --i) {
+    if (atlas->shelves[i].pen_x + width <= GLYPH_ATLAS_WIDTH) {
+      *x = atlas->shelves[i].pen_x;
+      atlas->shelves[i].pen_x += width;
+      return i;
+    }
+  }
+  if (atlas->shelf_count < atlas->shelf_capacity || atlas_grow(font)) {
+    GlyphShelf* shelf = &atlas->shelves[atlas->shelf_count];
+    shelf->generation++;
+    shelf->pen_x = width;
+    *x = 0;
+    return atlas->shelf_count++;
+  }
+  int lru = 0;
+  for (int i = 1; i < atlas->shelf_count; ++i) {
+    if (atlas->shelves[i].last_used < atlas->shelves[lru].last_used)
+      lru = i;
+  }
+  atlas->shelves[lru].generation++;
+  atlas->shelves[lru].pen_x = width;
+  atlas->evictions++;
+  *x = 0;
+  return lru;
+}
+
+static bool atlas_has_glyph(GlyphAtlas* atlas, GlyphBitmap* bitmap) {
+  return bitmap->generation && bitmap->shelf < atlas->shelf_count && atlas->shelves[bitmap->shelf].generation == bitmap->generation;
+}
+
+static void font_rasterize_glyph(RenFont* font, GlyphMetric* metric, int subpixel_idx) {
+  GlyphBitmap* bitmap = &metric->bitmaps[subpixel_idx];
+  unsigned int byte_width = font_get_byte_width(font);
+  unsigned int glyph_width, glyph_height;
+  const uint8_t* source;
+  int pitch;
+  bool mono = false;
+  if (bitmap->staged) {
+    source = bitmap->staged;
+    glyph_width = bitmap->x1 - bitmap->x0;
+    glyph_height = bitmap->y1 - bitmap->y0;
+    pitch = glyph_width * byte_width;
+  } else {
+    FT_GlyphSlot slot = font_render_glyph(font, library, font->face, metric->glyph_index, subpixel_idx);
+    if (!slot)
+      return;
+    source = slot->bitmap.buffer;
+    pitch = slot->bitmap.pitch;
+    mono = font->antialiasing == FONT_ANTIALIASING_NONE;
+    glyph_width = font_get_glyph_width(font, slot);
+    glyph_height = slot->bitmap.rows;
+    bitmap->bitmap_left = slot->bitmap_left;
+    bitmap->bitmap_top = slot->bitmap_top;
+  }
+  GlyphAtlas* atlas = &font->atlas;
+  if (!atlas->surface && !atlas_grow(font))
+    return;
+  glyph_height = glyph_height > (unsigned int)atlas->shelf_height ? (unsigned int)atlas->shelf_height : glyph_height;
+  unsigned short x;
+  int shelf = atlas_allocate(font, glyph_width, &x);
+  bitmap->shelf = shelf;
+  bitmap->generation = atlas->shelves[shelf].generation;
+  bitmap->x0 = x;
+  bitmap->x1 = x + glyph_width;
+  bitmap->y0 = shelf * atlas->shelf_height;
+  bitmap->y1 = bitmap->y0 + glyph_height;
+  atlas->glyphs++;
+  font->glyph_cache_dirty = true;
+  uint8_t* pixels = atlas->surface->pixels;
+  for (unsigned int line = 0; line < glyph_height; ++line) {
+    int target_offset = atlas->surface->pitch * (bitmap->y0 + line) + bitmap->x0 * byte_width;
+    int source_offset = line * pitch;
+    if (mono) {
+      for (unsigned int column = 0; column < glyph_width; ++column) {
+        int source_pixel = source[source_offset + (column / 8)];
+        pixels[target_offset + column] = ((source_pixel >> (7 - (column % 8))) & 0x1) << 7;
+      }
+    } else
+      memcpy(&pixels[target_offset], &source[source_offset], glyph_width * byte_width);
+  }
+}
+
+// returns the atlas surface containing the glyph's bitmap for the subpixel offset, rasterizing the glyph if it isn't already present.
+static SDL_Surface* font_get_glyph_bitmap(RenFont* font, GlyphMetric* metric, int subpixel_idx, GlyphBitmap** bitmap) {
+  GlyphAtlas* atlas = &font->atlas;
+  *bitmap = NULL;
+  if (!metric->loaded)
+    return NULL;
+  if (font->antialiasing != FONT_ANTIALIASING_SUBPIXEL)
+    subpixel_idx = 0;
+  if (draw_concurrent) {
+    if (!atlas_has_glyph(atlas, &metric->bitmaps[subpixel_idx])) {
+      SDL_AtomicSet(&draw_incomplete, 1);
+      return NULL;
+    }
+    *bitmap = &metric->bitmaps[subpixel_idx];
+    return atlas->surface;
+  }
+  if (!atlas_has_glyph(atlas, &metric->bitmaps[subpixel_idx]))
+    font_rasterize_glyph(font, metric, subpixel_idx);
+  if (!atlas_has_glyph(atlas, &metric->bitmaps[subpixel_idx]))
+    return NULL;
+  *bitmap = &metric->bitmaps[subpixel_idx];
+  atlas->shelves[(*bitmap)->shelf].last_used = ++atlas->tick;
+  return atlas->surface;
+}
+
 static void font_clear_glyph_cache(RenFont* font) {
-  for (int i = 0; i < SUBPIXEL_BITMAPS_CACHED; ++i) {
+  for (int i = 0; i < MAX_LOADABLE_GLYPHSETS; ++i) {
+    if (font->sets[i]) {
+      font_release_memory(font, font->sets[i]->staging_size);
+      free(font->sets[i]->staging);
+      free(font->sets[i]);
+      font->sets[i] = NULL;
+    }
+  }
+  atlas_free(font);
+}
+
+/******************* Width Cache *********************/
+
+static uint64_t width_cache_hash(RenFont** fonts, const char* text, size_t len) {
+  uint64_t hash = FNV_HASH_INITIAL;
+  for (int i = 0; i < FONT_FALLBACK_MAX && fonts[i]; ++i)
+    hash = fnv_hash(hash, &fonts[i]->generation, sizeof(fonts[i]->generation));
+  // the tab advance is part of the key, as documents with different indent sizes routinely share a font.
+  float tab_advance = font_get_glyph_metric(fonts[0], '\t')->xadvance;
+  hash = fnv_hash(hash, &tab_advance, sizeof(tab_advance));
+  return fnv_hash(hash, text, len);
+}
+
+static WidthCacheEntry* width_cache_get_entry(WidthCache* cache, uint64_t hash) {
+  if (!cache->entries)
+    cache->entries = check_alloc(calloc(WIDTH_CACHE_SIZE, sizeof(WidthCacheEntry)));
+  return &cache->entries[hash & (WIDTH_CACHE_SIZE - 1)];
+}
+
+static void width_cache_store(WidthCacheEntry* entry, uint64_t hash, const char* text, size_t len, double width) {
+  if (!entry->text || entry->len < len)
+    entry->text = check_alloc(realloc(entry->text, len ? len : 1));
+  memcpy(entry->text, text, len);
+  entry->hash = hash;
+  entry->len = len;
+  entry->width = width;
+}
+
+static void width_cache_free(WidthCache* cache) {
+  if (cache->entries) {
+    for (int i = 0; i < WIDTH_CACHE_SIZE; ++i)
+      free(cache->entries[i].text);
+    free(cache->entries);
+  }
+  memset(cache, 0, sizeof(WidthCache));
+}
+
+/******************* Glyph Cache *********************/
+// The atlas and glyph metrics of a font can be persisted to a file in the glyph cache directory, so that
+// subsequent launches don't have to rasterize the same glyphs again. The file is named after the font path,
+// pixel size and render options, and is only used if the font file's modification time and size still match.
+// The atlas pixels are mapped copy-on-write directly from the file, where supported.
+
+typedef struct {
+  char magic[8];
+  uint32_t version, header_size, metric_size, shelf_size;
+  int64_t source_mtime;
+  uint64_t source_size;
+  uint32_t pixel_size, antialiasing, hinting, style;
+  int32_t shelf_height, shelf_count, shelf_capacity, pitch;
+  uint32_t set_count, tick, path_length;
+  uint64_t pixels_offset;
+} GlyphCacheHeader;
+
+static void glyph_cache_get_key(RenFont* font, GlyphCacheHeader* header) {
+  memset(header, 0, sizeof(GlyphCacheHeader));
+  memcpy(header->magic, GLYPH_CACHE_MAGIC, sizeof(header->magic));
+  header->version = GLYPH_CACHE_VERSION;
+  header->header_size = sizeof(GlyphCacheHeader);
+  header->metric_size = sizeof(GlyphMetric);
+  header->shelf_size = sizeof(GlyphShelf);
+  header->source_mtime = font->source_mtime;
+  header->source_size = font->source_size;
+  header->pixel_size = font->face->size->metrics.y_ppem;
+  header->antialiasing = font->antialiasing;
+  header->hinting = font->hinting;
+  header->style = font->style;
+  header->path_length = strlen(font->path);
+}
+
+static char* glyph_cache_get_path(RenFont* font, const char* suffix) {
+  GlyphCacheHeader key;
+  glyph_cache_get_key(font, &key);
+  uint64_t hash = fnv_hash(FNV_HASH_INITIAL, font->path, key.path_length);
+  hash = fnv_hash(hash, &key.pixel_size, sizeof(uint32_t) * 4);
+  size_t length = strlen(glyph_cache_dir) + 32 + strlen(suffix);
+  char* path = check_alloc(malloc(length));
+  snprintf(path, length, "%s/%016llx.glyphs%s", glyph_cache_dir, (unsigned long long)hash, suffix);
+  return path;
+}
+
+static void font_get_source_info(const char* path, int64_t* mtime, uint64_t* size) {
+  *mtime = 0;
+  *size = 0;
+#ifdef _WIN32
+  struct _stat64 info;
+  LPWSTR wpath = utfconv_utf8towc(path);
+  int err = wpath ? _wstat64(wpath, &info) : -1;
+  free(wpath);
+#else
+  struct stat info;
+  int err = stat(path, &info);
+#endif
+  if (err == 0) {
+    *mtime = info.st_mtime;
+    *size = info.st_size;
+  }
+}
+
+static FILE* glyph_cache_open(const char* path, const char* mode) {
+#ifdef _WIN32
+  LPWSTR wpath = utfconv_utf8towc(path), wmode = utfconv_utf8towc(mode);
+  FILE* file = wpath && wmode ? _wfopen(wpath, wmode) : NULL;
+  free(wpath);
+  free(wmode);
+  return file;
+#else
+  return fopen(path, mode);
+#endif
+}
+
+// maps the whole file privately, so that the atlas can keep being written to without touching the file.
+static void* glyph_cache_map(const char* path, size_t* size) {
+#ifdef _WIN32
+  FILE* file = glyph_cache_open(path, "rb");
+  if (!file)
+    return NULL;
+  void* data = NULL;
+  if (fseek(file, 0, SEEK_END) == 0 && (*size = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0) {
+    data = check_alloc(malloc(*size));
+    if (fread(data, 1, *size, file) != *size) {
+      free(data);
+      data = NULL;
+    }
+  }
+  fclose(file);
+  return data;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return NULL;
+  struct stat info;
+  void* data = NULL;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    *size = info.st_size;
+    data = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+      data = NULL;
+  }
+  close(fd);
+  return data;
+#endif
+}
+
+static void glyph_cache_unmap(void* data, size_t size) {
+#ifdef _WIN32
+  free(data);
+#else
+  munmap(data, size);
+#endif
+}
+
+// a rasterized bitmap has to lie inside its shelf, or drawing it would read past the atlas.
+static bool glyph_cache_set_is_valid(GlyphSet* set, GlyphCacheHeader* header) {
+  for (int i = 0; i < MAX_GLYPHSET; ++i) {
+    for (int j = 0; j < SUBPIXEL_BITMAPS_CACHED; ++j) {
+      GlyphBitmap* bitmap = &set->metrics[i].bitmaps[j];
+      if (!bitmap->generation)
+        continue;
+      int y0 = bitmap->shelf * header->shelf_height;
+      if (bitmap->shelf >= header->shelf_count || bitmap->x0 > bitmap->x1 || bitmap->x1 > GLYPH_ATLAS_WIDTH
+        || bitmap->y0 != y0 || bitmap->y1 < bitmap->y0 || bitmap->y1 > y0 + header->shelf_height)
+        return false;
+    }
+  }
+  return true;
+}
+
+static void font_load_glyph_cache(RenFont* font) {
+  if (!glyph_cache_dir)
+    return;
+  char* path = glyph_cache_get_path(font, "");
+  size_t size;
+  uint8_t* data = glyph_cache_map(path, &size);
+  free(path);
+  if (!data)
+    return;
+  GlyphCacheHeader key, header;
+  glyph_cache_get_key(font, &key);
+  if (size < sizeof(GlyphCacheHeader))
+    goto invalid;
+  memcpy(&header, data, sizeof(GlyphCacheHeader));
+  // everything up to the key's end has to match exactly; the rest describes the atlas.
+  if (memcmp(&header, &key, offsetof(GlyphCacheHeader, shelf_height)) || header.path_length != key.path_length)
+    goto invalid;
+  size_t offset = sizeof(GlyphCacheHeader);
+  if (offset + header.path_length > size || memcmp(&data[offset], font->path, header.path_length))
+    goto invalid;
+  offset += header.path_length;
+  GlyphAtlas* atlas = &font->atlas;
+  atlas->shelf_height = atlas_get_shelf_height(font);
+  size_t set_size = sizeof(uint32_t) + sizeof(GlyphSet);
+  size_t pixels_size = (size_t)header.pitch * header.shelf_capacity * header.shelf_height;
+  if (header.shelf_height != atlas->shelf_height || header.shelf_capacity <= 0 || header.shelf_capacity > atlas_get_max_shelves(font)
+    || header.shelf_count < 0 || header.shelf_count > header.shelf_capacity || header.pitch < GLYPH_ATLAS_WIDTH * font_get_byte_width(font)
+    || header.set_count > MAX_LOADABLE_GLYPHSETS || offset + sizeof(GlyphShelf) * header.shelf_capacity + set_size * header.set_count > header.pixels_offset
+    || header.pixels_offset % 16 || pixels_size > GLYPH_ATLAS_MAX_SIZE || header.pixels_offset + pixels_size > size)
+    goto invalid;
+  atlas->shelves = check_alloc(malloc(sizeof(GlyphShelf) * header.shelf_capacity));
+  memcpy(atlas->shelves, &data[offset], sizeof(GlyphShelf) * header.shelf_capacity);
+  offset += sizeof(GlyphShelf) * header.shelf_capacity;
+  for (int i = 0; i < header.shelf_count; ++i) {
+    if (atlas->shelves[i].pen_x > GLYPH_ATLAS_WIDTH)
+      goto invalid_sets;
+  }
+  for (unsigned int i = 0; i < header.set_count; ++i, offset += set_size) {
+    uint32_t idx;
+    memcpy(&idx, &data[offset], sizeof(uint32_t));
+    if (idx >= MAX_LOADABLE_GLYPHSETS || font->sets[idx])
+      continue;
+    GlyphSet* set = check_alloc(malloc(sizeof(GlyphSet)));
+    memcpy(set, &data[offset + sizeof(uint32_t)], sizeof(GlyphSet));
+    set->staging = NULL;
+    set->staging_size = 0;
     for (int j = 0; j < MAX_GLYPHSET; ++j) {
-      if (font->sets[i][j]) {
-        if (font->sets[i][j]->surface)
-          SDL_FreeSurface(font->sets[i][j]->surface);
-        free(font->sets[i][j]);
-        font->sets[i][j] = NULL;
-      }
+      for (int k = 0; k < SUBPIXEL_BITMAPS_CACHED; ++k)
+        set->metrics[j].bitmaps[k].staged = NULL;
     }
+    font->sets[idx] = set;
+    if (!glyph_cache_set_is_valid(set, &header))
+      goto invalid_sets;
+  }
+  if (!(atlas->reserved = font_reserve_memory(font, pixels_size, pixels_size)))
+    goto invalid_sets;
+  // the tab advance is changed at runtime by set_tab_size; let it be resolved again.
+  if (font->sets[0])
+    font->sets[0]->metrics['\t'].resolved = false;
+  atlas->surface = check_alloc(SDL_CreateRGBSurfaceFrom(&data[header.pixels_offset], GLYPH_ATLAS_WIDTH, header.shelf_capacity * header.shelf_height,
+    font_get_byte_width(font) * 8, header.pitch, 0, 0, 0, 0));
+  atlas->shelf_count = header.shelf_count;
+  atlas->shelf_capacity = header.shelf_capacity;
+  atlas->tick = header.tick;
+  atlas->mapping = data;
+  atlas->mapping_size = size;
+  font->glyph_cache_dirty = false;
+  return;
+
+invalid_sets:
+  // nothing else can have loaded sets yet, as the glyph worker only learns about the font afterwards.
+  for (int i = 0; i < MAX_LOADABLE_GLYPHSETS; ++i) {
+    free(font->sets[i]);
+    font->sets[i] = NULL;
+  }
+  free(atlas->shelves);
+  atlas->shelves = NULL;
+invalid:
+  glyph_cache_unmap(data, size);
+}
+
+static void font_save_glyph_cache(RenFont* font) {
+  GlyphAtlas* atlas = &font->atlas;
+  if (!glyph_cache_dir || !font->glyph_cache_dirty || !atlas->surface)
+    return;
+#ifdef _WIN32
+  LPWSTR wdir = utfconv_utf8towc(glyph_cache_dir);
+  if (wdir)
+    _wmkdir(wdir);
+  free(wdir);
+#else
+  mkdir(glyph_cache_dir, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+#endif
+  char* path = glyph_cache_get_path(font, "");
+  char* temporary_path = glyph_cache_get_path(font, ".tmp");
+  FILE* file = glyph_cache_open(temporary_path, "wb");
+  if (!file)
+    goto done;
+  GlyphCacheHeader header;
+  glyph_cache_get_key(font, &header);
+  header.shelf_height = atlas->shelf_height;
+  header.shelf_count = atlas->shelf_count;
+  header.shelf_capacity = atlas->shelf_capacity;
+  header.pitch = atlas->surface->pitch;
+  header.tick = atlas->tick;
+  for (int i = 0; i < MAX_LOADABLE_GLYPHSETS; ++i)
+    header.set_count += font->sets[i] ? 1 : 0;
+  size_t offset = sizeof(GlyphCacheHeader) + header.path_length + sizeof(GlyphShelf) * header.shelf_capacity + (sizeof(uint32_t) + sizeof(GlyphSet)) * header.set_count;
+  header.pixels_offset = (offset + 15) & ~(size_t)15;
+  static const uint8_t padding[16] = {0};
+  bool written = fwrite(&header, sizeof(GlyphCacheHeader), 1, file) == 1
+    && fwrite(font->path, 1, header.path_length, file) == header.path_length
+    && fwrite(atlas->shelves, sizeof(GlyphShelf), header.shelf_capacity, file) == (size_t)header.shelf_capacity;
+  for (uint32_t i = 0; written && i < MAX_LOADABLE_GLYPHSETS; ++i) {
+    if (font->sets[i])
+      written = fwrite(&i, sizeof(uint32_t), 1, file) == 1 && fwrite(font->sets[i], sizeof(GlyphSet), 1, file) == 1;
   }
+  written = written && fwrite(padding, 1, header.pixels_offset - offset, file) == header.pixels_offset - offset
+    && fwrite(atlas->surface->pixels, atlas->surface->pitch, atlas->surface->h, file) == (size_t)atlas->surface->h;
+  written = fclose(file) == 0 && written;
+#ifdef _WIN32
+  LPWSTR wtemporary_path = utfconv_utf8towc(temporary_path), wpath = utfconv_utf8towc(path);
+  if (!written || !wtemporary_path || !wpath || !MoveFileExW(wtemporary_path, wpath, MOVEFILE_REPLACE_EXISTING))
+    _wremove(wtemporary_path);
+  free(wtemporary_path);
+  free(wpath);
+#else
+  if (!written || rename(temporary_path, path))
+    remove(temporary_path);
+#endif
+  font->glyph_cache_dirty = false;
+
+done:
+  free(path);
+  free(temporary_path);
+}
+
+void ren_set_glyph_cache_dir(const char* path) {
+  free(glyph_cache_dir);
+  glyph_cache_dir = path ? check_alloc(strdup(path)) : NULL;
 }
 
+/******************* Glyph Worker ********************/
+// A background thread that loads whole glyph sets ahead of need, with its own FreeType library and faces.
+// Sets are built privately, with every glyph prerendered at offset 0 into a staging buffer, and then published into
+// empty slots of the font's set table with a compare-and-swap, so the UI thread never blocks on the worker
+// while drawing; it only has to copy staged bitmaps into the atlas. The render lock is held by the worker
+// while it uses a font, and by the UI thread when changing or freeing one.
+
+typedef struct {
+  RenFont* font;
+  int idx;
+} GlyphWorkerJob;
+
+static struct {
+  SDL_Thread* thread;
+  SDL_mutex* queue_lock;
+  SDL_mutex* render_lock;
+  SDL_cond* queue_cond;
+  GlyphWorkerJob* jobs;
+  int job_count, job_capacity;
+  bool quit;
+  FT_Library library;
+} glyph_worker;
+
 const char* retrieve_internal_file(const char* path, int* size);
+
+static bool glyph_worker_prepare_face(RenFont* font) {
+  if (!font->worker_face) {
+    int internal_size;
+    const char* internal_file = retrieve_internal_file(font->path, &internal_size);
+    if (internal_file) {
+      FT_Open_Args args = { FT_OPEN_MEMORY, (const FT_Byte*)internal_file, internal_size, (char*)font->path };
+      if (FT_Open_Face(glyph_worker.library, &args, 0, &font->worker_face))
+        return false;
+    } else {
+#ifdef _WIN32
+      if (FT_New_Memory_Face(glyph_worker.library, font->file, font->source_size, 0, &font->worker_face))
+        return false;
+#else
+      if (FT_New_Face(glyph_worker.library, font->path, 0, &font->worker_face))
+        return false;
+#endif
+    }
+    font->worker_pixel_size = 0;
+  }
+  if (font->worker_pixel_size != font->pixel_size) {
+    if (FT_Set_Pixel_Sizes(font->worker_face, 0, font->pixel_size))
+      return false;
+    font->worker_pixel_size = font->pixel_size;
+  }
+  return true;
+}
+
+// the other subpixel offsets are only rasterized, by the UI thread, once they're drawn; the staging buffer is
+// reserved from the font's memory budget, and the set is published without bitmaps if it doesn't fit.
+static void glyph_worker_load_glyphset(RenFont* font, int idx) {
+  if (SDL_AtomicGetPtr((void**)&font->sets[idx]) || !glyph_worker_prepare_face(font))
+    return;
+  unsigned int byte_width = font_get_byte_width(font);
+  bool stage = SDL_AtomicGet(&font->memory_used) < GLYPH_ATLAS_MAX_SIZE;
+  GlyphSet* set = check_alloc(calloc(1, sizeof(GlyphSet)));
+  size_t staging_size = 0, staging_capacity = 0;
+  size_t offsets[MAX_GLYPHSET];
+  for (int i = 0; i < MAX_GLYPHSET; ++i) {
+    GlyphMetric* metric = &set->metrics[i];
+    font_load_glyph_metric(font, font->worker_face, metric, idx * MAX_GLYPHSET + i);
+    offsets[i] = SIZE_MAX;
+    FT_GlyphSlot slot = metric->loaded && stage ? font_render_glyph(font, glyph_worker.library, font->worker_face, metric->glyph_index, 0) : NULL;
+    if (!slot)
+      continue;
+    unsigned int width = font_get_glyph_width(font, slot), rows = slot->bitmap.rows;
+    if (staging_size + width * byte_width * rows > staging_capacity) {
+      staging_capacity = (staging_size + width * byte_width * rows) * 2;
+      set->staging = check_alloc(realloc(set->staging, staging_capacity));
+    }
+    for (unsigned int line = 0; line < rows; ++line) {
+      uint8_t* target = &set->staging[staging_size + line * width * byte_width];
+      const uint8_t* source = &slot->bitmap.buffer[line * slot->bitmap.pitch];
+      if (font->antialiasing == FONT_ANTIALIASING_NONE) {
+        for (unsigned int column = 0; column < width; ++column)
+          target[column] = ((source[column / 8] >> (7 - (column % 8))) & 0x1) << 7;
+      } else
+        memcpy(target, source, width * byte_width);
+    }
+    metric->bitmaps[0] = (GlyphBitmap){ 0, width, 0, rows, slot->bitmap_left, slot->bitmap_top };
+    offsets[i] = staging_size;
+    staging_size += width * byte_width * rows;
+  }
+  if (staging_size > 0 && font_reserve_memory(font, staging_size, staging_size)) {
+    set->staging = check_alloc(realloc(set->staging, staging_size));
+    set->staging_size = staging_size;
+    for (int i = 0; i < MAX_GLYPHSET; ++i) {
+      if (offsets[i] != SIZE_MAX)
+        set->metrics[i].bitmaps[0].staged = &set->staging[offsets[i]];
+    }
+  } else {
+    free(set->staging);
+    set->staging = NULL;
+  }
+  if (!SDL_AtomicCASPtr((void**)&font->sets[idx], NULL, set)) {
+    font_release_memory(font, set->staging_size);
+    free(set->staging);
+    free(set);
+  }
+}
+
+static int glyph_worker_run(UNUSED void* data) {
+  while (true) {
+    SDL_LockMutex(glyph_worker.queue_lock);
+    while (glyph_worker.job_count == 0 && !glyph_worker.quit)
+      SDL_CondWait(glyph_worker.queue_cond, glyph_worker.queue_lock);
+    bool quit = glyph_worker.quit;
+    SDL_UnlockMutex(glyph_worker.queue_lock);
+    if (quit)
+      break;
+    // jobs are only dequeued under the render lock, so that a font can't be freed between dequeuing and loading.
+    SDL_LockMutex(glyph_worker.render_lock);
+    SDL_LockMutex(glyph_worker.queue_lock);
+    GlyphWorkerJob job = { NULL, 0 };
+    if (glyph_worker.job_count > 0) {
+      job = glyph_worker.jobs[0];
+      memmove(&glyph_worker.jobs[0], &glyph_worker.jobs[1], sizeof(GlyphWorkerJob) * --glyph_worker.job_count);
+    }
+    SDL_UnlockMutex(glyph_worker.queue_lock);
+    if (job.font)
+      glyph_worker_load_glyphset(job.font, job.idx);
+    SDL_UnlockMutex(glyph_worker.render_lock);
+  }
+  return 0;
+}
+
+static void glyph_worker_init(void) {
+  if (FT_Init_FreeType(&glyph_worker.library))
+    return;
+  glyph_worker.queue_lock = SDL_CreateMutex();
+  glyph_worker.render_lock = SDL_CreateMutex();
+  glyph_worker.queue_cond = SDL_CreateCond();
+  if (glyph_worker.queue_lock && glyph_worker.render_lock && glyph_worker.queue_cond)
+    glyph_worker.thread = SDL_CreateThread(glyph_worker_run, "glyph worker", NULL);
+  if (!glyph_worker.thread)
+    fprintf(stderr, "warning: unable to start the glyph worker: %s\n", SDL_GetError());
+}
+
+// stops the worker once it's done with its current set; the sets still queued are dropped.
+static void glyph_worker_free(void) {
+  if (glyph_worker.thread) {
+    SDL_LockMutex(glyph_worker.queue_lock);
+    glyph_worker.quit = true;
+    SDL_CondSignal(glyph_worker.queue_cond);
+    SDL_UnlockMutex(glyph_worker.queue_lock);
+    SDL_WaitThread(glyph_worker.thread, NULL);
+    glyph_worker.thread = NULL;
+  }
+  free(glyph_worker.jobs);
+  glyph_worker.jobs = NULL;
+  glyph_worker.job_count = glyph_worker.job_capacity = 0;
+  SDL_DestroyCond(glyph_worker.queue_cond);
+  SDL_DestroyMutex(glyph_worker.render_lock);
+  SDL_DestroyMutex(glyph_worker.queue_lock);
+  glyph_worker.queue_cond = NULL;
+  glyph_worker.render_lock = glyph_worker.queue_lock = NULL;
+}
+
+static void glyph_worker_queue(RenFont* font, int idx) {
+  if (!glyph_worker.thread || SDL_AtomicGetPtr((void**)&font->sets[idx]))
+    return;
+  SDL_LockMutex(glyph_worker.queue_lock);
+  for (int i = 0; i < glyph_worker.job_count; ++i) {
+    if (glyph_worker.jobs[i].font == font && glyph_worker.jobs[i].idx == idx) {
+      SDL_UnlockMutex(glyph_worker.queue_lock);
+      return;
+    }
+  }
+  if (glyph_worker.job_count == glyph_worker.job_capacity) {
+    glyph_worker.job_capacity = glyph_worker.job_capacity ? glyph_worker.job_capacity * 2 : 16;
+    glyph_worker.jobs = check_alloc(realloc(glyph_worker.jobs, sizeof(GlyphWorkerJob) * glyph_worker.job_capacity));
+  }
+  glyph_worker.jobs[glyph_worker.job_count++] = (GlyphWorkerJob){ font, idx };
+  SDL_CondSignal(glyph_worker.queue_cond);
+  SDL_UnlockMutex(glyph_worker.queue_lock);
+}
+
+static void glyph_worker_lock(void) {
+  if (glyph_worker.thread)
+    SDL_LockMutex(glyph_worker.render_lock);
+}
+
+static void glyph_worker_unlock(void) {
+  if (glyph_worker.thread)
+    SDL_UnlockMutex(glyph_worker.render_lock);
+}
+
+// must be called with the render lock held; drops the font's pending jobs and its worker face.
+static void glyph_worker_release_font(RenFont* font) {
+  // the worker may have been stopped after loading sets for the font
+  if (glyph_worker.thread) {
+    SDL_LockMutex(glyph_worker.queue_lock);
+    int count = 0;
+    for (int i = 0; i < glyph_worker.job_count; ++i) {
+      if (glyph_worker.jobs[i].font != font)
+        glyph_worker.jobs[count++] = glyph_worker.jobs[i];
+    }
+    glyph_worker.job_count = count;
+    SDL_UnlockMutex(glyph_worker.queue_lock);
+  }
+  if (font->worker_face)
+    FT_Done_Face(font->worker_face);
+  font->worker_face = NULL;
+}
+
+// warms the sets that almost every document needs: ASCII and Latin-1, Latin Extended-A, general punctuation and box drawing.
+static void glyph_worker_queue_common(RenFont* font) {
+  static const int common_sets[] = { 0x00, 0x01, 0x20, 0x25 };
+  for (size_t i = 0; i < sizeof(common_sets) / sizeof(common_sets[0]); ++i)
+    glyph_worker_queue(font, common_sets[i]);
+}
+
+void ren_font_group_warm(RenFont **fonts, const char *text, size_t len) {
+  uint8_t queued[MAX_LOADABLE_GLYPHSETS / 8] = {0};
+  const char* end = text + len;
+  while (text < end) {
+    unsigned int codepoint;
+    text = utf8_to_codepoint(text, &codepoint);
+    int idx = (codepoint >> 8) % MAX_LOADABLE_GLYPHSETS;
+    if (queued[idx / 8] & (1 << (idx % 8)))
+      continue;
+    queued[idx / 8] |= 1 << (idx % 8);
+    for (int i = 0; i < FONT_FALLBACK_MAX && fonts[i]; ++i)
+      glyph_worker_queue(fonts[i], idx);
+  }
+}
+
 RenFont* ren_font_load(RenWindow *window_renderer, const char* path, float size, ERenFontAntialiasing antialiasing, ERenFontHinting hinting, unsigned char style) {
   FT_Face face = NULL;
 #ifdef _WIN32
@@ -273,12 +1103,18 @@ RenFont* ren_font_load(RenWindow *window_renderer, const char* path, float size,
   RenFont* font = check_alloc(calloc(1, sizeof(RenFont) + len + 1));
   strcpy(font->path, path);
   font->face = face;
+  font->generation = ++font_generation;
+  font->pixel_size = (int)(size*surface_scale);
   font->size = size;
   font->height = (short)((face->height / (float)face->units_per_EM) * font->size);
   font->baseline = (short)((face->ascender / (float)face->units_per_EM) * font->size);
   font->antialiasing = antialiasing;
   font->hinting = hinting;
   font->style = style;
+  if (internal_file)
+    font->source_size = internal_size;
+  else
+    font_get_source_info(path, &font->source_mtime, &font->source_size);
 
 #ifdef _WIN32
   // we need to keep this for freetype
@@ -296,6 +1132,8 @@ RenFont* ren_font_load(RenWindow *window_renderer, const char* path, float size,
   }
   font->space_advance = face->glyph->advance.x / 64.0f;
   font->tab_advance = font->space_advance * 2;
+  font_load_glyph_cache(font);
+  glyph_worker_queue_common(font);
   return font;
 
 failure:
@@ -323,8 +1161,20 @@ const char* ren_font_get_path(RenFont *font) {
   return font->path;
 }
 
+void ren_font_get_options(RenFont *font, float *size, ERenFontAntialiasing *antialiasing, ERenFontHinting *hinting, unsigned char *style) {
+  *size = font->size;
+  *antialiasing = font->antialiasing;
+  *hinting = font->hinting;
+  *style = font->style;
+}
+
 void ren_font_free(RenFont* font) {
+  glyph_worker_lock();
+  glyph_worker_release_font(font);
+  font_save_glyph_cache(font);
   font_clear_glyph_cache(font);
+  glyph_worker_unlock();
+  width_cache_free(&font->width_cache);
   FT_Done_Face(font->face);
 #ifdef _WIN32
   free(font->file);
@@ -333,15 +1183,19 @@ void ren_font_free(RenFont* font) {
   free(font);
 }
 
-void ren_font_group_set_tab_size(RenFont **fonts, int n) {
+bool ren_font_group_set_tab_size(RenFont **fonts, int n) {
+  bool changed = false;
   for (int j = 0; j < FONT_FALLBACK_MAX && fonts[j]; ++j) {
-    for (int i = 0; i < (fonts[j]->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? SUBPIXEL_BITMAPS_CACHED : 1); ++i)
-      font_get_glyphset(fonts[j], '\t', i)->metrics['\t'].xadvance = fonts[j]->space_advance * n;
+    GlyphMetric *metric = font_get_glyph_metric(fonts[j], '\t');
+    float xadvance = fonts[j]->space_advance * n;
+    changed = changed || metric->xadvance != xadvance;
+    metric->xadvance = xadvance;
   }
+  return changed;
 }
 
 int ren_font_group_get_tab_size(RenFont **fonts) {
-  float advance = font_get_glyphset(fonts[0], '\t', 0)->metrics['\t'].xadvance;
+  float advance = font_get_glyph_metric(fonts[0], '\t')->xadvance;
   if (fonts[0]->space_advance) {
     advance /= fonts[0]->space_advance;
   }
@@ -354,16 +1208,38 @@ float ren_font_group_get_size(RenFont **fonts) {
 
 void ren_font_group_set_size(RenWindow *window_renderer, RenFont **fonts, float size) {
   const int surface_scale = renwin_get_surface(window_renderer).scale;
+  glyph_worker_lock();
   for (int i = 0; i < FONT_FALLBACK_MAX && fonts[i]; ++i) {
+    font_save_glyph_cache(fonts[i]);
     font_clear_glyph_cache(fonts[i]);
+    fonts[i]->generation = ++font_generation;
     FT_Face face = fonts[i]->face;
-    FT_Set_Pixel_Sizes(face, 0, (int)(size*surface_scale));
+    fonts[i]->pixel_size = (int)(size*surface_scale);
+    FT_Set_Pixel_Sizes(face, 0, fonts[i]->pixel_size);
     fonts[i]->size = size;
     fonts[i]->height = (short)((face->height / (float)face->units_per_EM) * size);
     fonts[i]->baseline = (short)((face->ascender / (float)face->units_per_EM) * size);
     FT_Load_Char(face, ' ', font_set_load_options(fonts[i]));
     fonts[i]->space_advance = face->glyph->advance.x / 64.0f;
     fonts[i]->tab_advance = fonts[i]->space_advance * 2;
+    font_load_glyph_cache(fonts[i]);
+  }
+  glyph_worker_unlock();
+  for (int i = 0; i < FONT_FALLBACK_MAX && fonts[i]; ++i)
+    glyph_worker_queue_common(fonts[i]);
+}
+
+void ren_font_group_get_atlas_stats(RenFont **fonts, RenAtlasStats *stats) {
+  memset(stats, 0, sizeof(RenAtlasStats));
+  for (int i = 0; i < FONT_FALLBACK_MAX && fonts[i]; ++i) {
+    GlyphAtlas* atlas = &fonts[i]->atlas;
+    size_t shelf_size = (size_t)GLYPH_ATLAS_WIDTH * font_get_byte_width(fonts[i]) * atlas->shelf_height;
+    for (int j = 0; j < atlas->shelf_count; ++j)
+      stats->used += (size_t)atlas->shelves[j].pen_x * font_get_byte_width(fonts[i]) * atlas->shelf_height;
+    stats->size += shelf_size * atlas->shelf_capacity;
+    stats->capacity += atlas->shelf_height ? shelf_size * atlas_get_max_shelves(fonts[i]) : GLYPH_ATLAS_MAX_SIZE;
+    stats->glyphs += atlas->glyphs;
+    stats->evictions += atlas->evictions;
   }
 }
 
@@ -372,25 +1248,246 @@ int ren_font_group_get_height(RenFont **fonts) {
 }
 
 double ren_font_group_get_width(RenWindow *window_renderer, RenFont **fonts, const char *text, size_t len) {
+  const int surface_scale = renwin_get_surface(window_renderer).scale;
+  WidthCacheEntry* entry = NULL;
+  uint64_t hash = 0;
+  if (len <= WIDTH_CACHE_MAX_TEXT) {
+    hash = width_cache_hash(fonts, text, len);
+    entry = width_cache_get_entry(&fonts[0]->width_cache, hash);
+    if (entry->text && entry->hash == hash && entry->len == len && memcmp(entry->text, text, len) == 0) {
+      fonts[0]->width_cache.hits++;
+      return entry->width / surface_scale;
+    }
+    fonts[0]->width_cache.misses++;
+  }
   double width = 0;
-  const char* end = text + len;
-  GlyphMetric* metric = NULL; GlyphSet* set = NULL;
+  const char* start = text, *end = text + len;
+  GlyphMetric* metric = NULL;
   while (text < end) {
     unsigned int codepoint;
     text = utf8_to_codepoint(text, &codepoint);
-    RenFont* font = font_group_get_glyph(&set, &metric, fonts, codepoint, 0);
+    RenFont* font = font_group_get_glyph(&metric, fonts, codepoint);
     if (!metric)
       break;
     width += (!font || metric->xadvance) ? metric->xadvance : fonts[0]->space_advance;
   }
-  const int surface_scale = renwin_get_surface(window_renderer).scale;
+  if (entry)
+    width_cache_store(entry, hash, start, len, width);
   return width / surface_scale;
 }
 
-double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t len, float x, int y, RenColor color) {
+void ren_font_group_get_width_cache_stats(RenFont **fonts, unsigned int *hits, unsigned int *misses) {
+  *hits = fonts[0]->width_cache.hits;
+  *misses = fonts[0]->width_cache.misses;
+}
+
+/******************* Text Blending *******************/
+// Glyph coverage is composited onto the surface with, for every channel,
+//   out = (color * src * alpha + dst * (65025 - src * alpha) + 32767) / 65025
+// The numerator never exceeds 2^24, and for that range the division is exactly a multiplication
+// by 0x1020305 followed by a shift of 40 bits, which is what the vectorized kernels use.
+#define BLEND_DIVIDE_MAGIC 0x1020305
+#define BLEND_DIVIDE_SHIFT 40
+
+typedef void (*BlendRowFunction)(uint32_t* destination, const uint8_t* source, int width, bool subpixel, RenColor color, uint32_t amask);
+static BlendRowFunction blend_row;
+// full coverage, for filling translucent rects with the same kernels a chunk of a row at a time.
+#define BLEND_FILL_CHUNK 256
+static uint8_t blend_fill_coverage[BLEND_FILL_CHUNK];
+
+static inline uint32_t blend_channel(uint32_t color, uint32_t coverage, uint32_t destination) {
+  return (color * coverage + destination * (65025 - coverage) + 32767) / 65025;
+}
+
+// Specialized for 32-bit XRGB/ARGB surfaces; the destination alpha, if any, is preserved.
+static void blend_row_scalar(uint32_t* destination, const uint8_t* source, int width, bool subpixel, RenColor color, uint32_t amask) {
+  for (int x = 0; x < width; ++x, source += subpixel ? 3 : 1) {
+    uint32_t pixel = destination[x];
+    uint32_t r = blend_channel(color.r, source[0] * color.a, (pixel >> 16) & 0xFF);
+    uint32_t g = blend_channel(color.g, source[subpixel ? 1 : 0] * color.a, (pixel >> 8) & 0xFF);
+    uint32_t b = blend_channel(color.b, source[subpixel ? 2 : 0] * color.a, pixel & 0xFF);
+    destination[x] = (pixel & amask) | r << 16 | g << 8 | b;
+  }
+}
+
+#ifdef RENDERER_BLEND_X86
+__attribute__((target("sse2")))
+static inline __m128i blend_divide_sse2(__m128i x) {
+  const __m128i magic = _mm_set1_epi32(BLEND_DIVIDE_MAGIC);
+  __m128i even = _mm_srli_epi64(_mm_mul_epu32(x, magic), BLEND_DIVIDE_SHIFT);
+  __m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), magic), BLEND_DIVIDE_SHIFT);
+  return _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+}
+
+// blends one channel of 8 pixels held as 16-bit lanes; the result is returned as two vectors of 4 32-bit lanes.
+__attribute__((target("sse2")))
+static inline void blend_channel_sse2(__m128i source, __m128i alpha, __m128i color, __m128i destination, __m128i* lo, __m128i* hi) {
+  const __m128i bias = _mm_set1_epi32(32767);
+  __m128i coverage = _mm_mullo_epi16(source, alpha);
+  __m128i inverse = _mm_sub_epi16(_mm_set1_epi16((short)65025), coverage);
+  __m128i color_lo = _mm_mullo_epi16(color, coverage), color_hi = _mm_mulhi_epu16(color, coverage);
+  __m128i destination_lo = _mm_mullo_epi16(destination, inverse), destination_hi = _mm_mulhi_epu16(destination, inverse);
+  *lo = blend_divide_sse2(_mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(color_lo, color_hi), _mm_unpacklo_epi16(destination_lo, destination_hi)), bias));
+  *hi = blend_divide_sse2(_mm_add_epi32(_mm_add_epi32(_mm_unpackhi_epi16(color_lo, color_hi), _mm_unpackhi_epi16(destination_lo, destination_hi)), bias));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i blend_extract_sse2(__m128i lo, __m128i hi, int shift) {
+  const __m128i mask = _mm_set1_epi32(0xFF);
+  return _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, shift), mask), _mm_and_si128(_mm_srli_epi32(hi, shift), mask));
+}
+
+__attribute__((target("sse2")))
+static void blend_row_sse2(uint32_t* destination, const uint8_t* source, int width, bool subpixel, RenColor color, uint32_t amask) {
+  const __m128i alpha = _mm_set1_epi16(color.a), zero = _mm_setzero_si128(), alpha_mask = _mm_set1_epi32(amask);
+  const __m128i color_r = _mm_set1_epi16(color.r), color_g = _mm_set1_epi16(color.g), color_b = _mm_set1_epi16(color.b);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i source_r, source_g, source_b;
+    if (subpixel) {
+      const uint8_t* s = &source[x * 3];
+      source_r = _mm_setr_epi16(s[0], s[3], s[6], s[9], s[12], s[15], s[18], s[21]);
+      source_g = _mm_setr_epi16(s[1], s[4], s[7], s[10], s[13], s[16], s[19], s[22]);
+      source_b = _mm_setr_epi16(s[2], s[5], s[8], s[11], s[14], s[17], s[20], s[23]);
+    } else
+      source_r = source_g = source_b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)&source[x]), zero);
+    __m128i lo = _mm_loadu_si128((const __m128i*)&destination[x]), hi = _mm_loadu_si128((const __m128i*)&destination[x + 4]);
+    __m128i r_lo, r_hi, g_lo, g_hi, b_lo, b_hi;
+    blend_channel_sse2(source_r, alpha, color_r, blend_extract_sse2(lo, hi, 16), &r_lo, &r_hi);
+    blend_channel_sse2(source_g, alpha, color_g, blend_extract_sse2(lo, hi, 8), &g_lo, &g_hi);
+    blend_channel_sse2(source_b, alpha, color_b, blend_extract_sse2(lo, hi, 0), &b_lo, &b_hi);
+    lo = _mm_or_si128(_mm_or_si128(_mm_and_si128(lo, alpha_mask), _mm_slli_epi32(r_lo, 16)), _mm_or_si128(_mm_slli_epi32(g_lo, 8), b_lo));
+    hi = _mm_or_si128(_mm_or_si128(_mm_and_si128(hi, alpha_mask), _mm_slli_epi32(r_hi, 16)), _mm_or_si128(_mm_slli_epi32(g_hi, 8), b_hi));
+    _mm_storeu_si128((__m128i*)&destination[x], lo);
+    _mm_storeu_si128((__m128i*)&destination[x + 4], hi);
+  }
+  blend_row_scalar(&destination[x], &source[x * (subpixel ? 3 : 1)], width - x, subpixel, color, amask);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blend_divide_avx2(__m256i x) {
+  const __m256i magic = _mm256_set1_epi32(BLEND_DIVIDE_MAGIC);
+  __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(x, magic), BLEND_DIVIDE_SHIFT);
+  __m256i odd = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), magic), BLEND_DIVIDE_SHIFT);
+  return _mm256_or_si256(even, _mm256_slli_epi64(odd, 32));
+}
+
+// same as the SSE2 version; lanes are packed and unpacked within each 128-bit half, so pixel order is preserved.
+__attribute__((target("avx2")))
+static inline void blend_channel_avx2(__m256i source, __m256i alpha, __m256i color, __m256i destination, __m256i* lo, __m256i* hi) {
+  const __m256i bias = _mm256_set1_epi32(32767);
+  __m256i coverage = _mm256_mullo_epi16(source, alpha);
+  __m256i inverse = _mm256_sub_epi16(_mm256_set1_epi16((short)65025), coverage);
+  __m256i color_lo = _mm256_mullo_epi16(color, coverage), color_hi = _mm256_mulhi_epu16(color, coverage);
+  __m256i destination_lo = _mm256_mullo_epi16(destination, inverse), destination_hi = _mm256_mulhi_epu16(destination, inverse);
+  *lo = blend_divide_avx2(_mm256_add_epi32(_mm256_add_epi32(_mm256_unpacklo_epi16(color_lo, color_hi), _mm256_unpacklo_epi16(destination_lo, destination_hi)), bias));
+  *hi = blend_divide_avx2(_mm256_add_epi32(_mm256_add_epi32(_mm256_unpackhi_epi16(color_lo, color_hi), _mm256_unpackhi_epi16(destination_lo, destination_hi)), bias));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blend_extract_avx2(__m256i lo, __m256i hi, int shift) {
+  const __m256i mask = _mm256_set1_epi32(0xFF);
+  return _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(lo, shift), mask), _mm256_and_si256(_mm256_srli_epi32(hi, shift), mask));
+}
+
+__attribute__((target("avx2")))
+static void blend_row_avx2(uint32_t* destination, const uint8_t* source, int width, bool subpixel, RenColor color, uint32_t amask) {
+  const __m256i alpha = _mm256_set1_epi16(color.a), alpha_mask = _mm256_set1_epi32(amask);
+  const __m256i color_r = _mm256_set1_epi16(color.r), color_g = _mm256_set1_epi16(color.g), color_b = _mm256_set1_epi16(color.b);
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m256i source_r, source_g, source_b;
+    if (subpixel) {
+      const uint8_t* s = &source[x * 3];
+      source_r = blend_extract_avx2(_mm256_setr_epi32(s[0], s[3], s[6], s[9], s[12], s[15], s[18], s[21]), _mm256_setr_epi32(s[24], s[27], s[30], s[33], s[36], s[39], s[42], s[45]), 0);
+      source_g = blend_extract_avx2(_mm256_setr_epi32(s[1], s[4], s[7], s[10], s[13], s[16], s[19], s[22]), _mm256_setr_epi32(s[25], s[28], s[31], s[34], s[37], s[40], s[43], s[46]), 0);
+      source_b = blend_extract_avx2(_mm256_setr_epi32(s[2], s[5], s[8], s[11], s[14], s[17], s[20], s[23]), _mm256_setr_epi32(s[26], s[29], s[32], s[35], s[38], s[41], s[44], s[47]), 0);
+    } else {
+      __m256i first = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&source[x]));
+      __m256i second = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&source[x + 8]));
+      source_r = source_g = source_b = _mm256_packs_epi32(first, second);
+    }
+    __m256i lo = _mm256_loadu_si256((const __m256i*)&destination[x]), hi = _mm256_loadu_si256((const __m256i*)&destination[x + 8]);
+    __m256i r_lo, r_hi, g_lo, g_hi, b_lo, b_hi;
+    blend_channel_avx2(source_r, alpha, color_r, blend_extract_avx2(lo, hi, 16), &r_lo, &r_hi);
+    blend_channel_avx2(source_g, alpha, color_g, blend_extract_avx2(lo, hi, 8), &g_lo, &g_hi);
+    blend_channel_avx2(source_b, alpha, color_b, blend_extract_avx2(lo, hi, 0), &b_lo, &b_hi);
+    lo = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(lo, alpha_mask), _mm256_slli_epi32(r_lo, 16)), _mm256_or_si256(_mm256_slli_epi32(g_lo, 8), b_lo));
+    hi = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(hi, alpha_mask), _mm256_slli_epi32(r_hi, 16)), _mm256_or_si256(_mm256_slli_epi32(g_hi, 8), b_hi));
+    _mm256_storeu_si256((__m256i*)&destination[x], lo);
+    _mm256_storeu_si256((__m256i*)&destination[x + 8], hi);
+  }
+  blend_row_sse2(&destination[x], &source[x * (subpixel ? 3 : 1)], width - x, subpixel, color, amask);
+}
+#endif
+
+#ifdef RENDERER_BLEND_NEON
+static inline uint32x4_t blend_divide_neon(uint32x4_t x) {
+  const uint32x2_t magic = vdup_n_u32(BLEND_DIVIDE_MAGIC);
+  uint32x2_t lo = vmovn_u64(vshrq_n_u64(vmull_u32(vget_low_u32(x), magic), BLEND_DIVIDE_SHIFT));
+  uint32x2_t hi = vmovn_u64(vshrq_n_u64(vmull_u32(vget_high_u32(x), magic), BLEND_DIVIDE_SHIFT));
+  return vcombine_u32(lo, hi);
+}
+
+static inline void blend_channel_neon(uint16x8_t source, uint16x8_t alpha, uint16x8_t color, uint16x8_t destination, uint32x4_t* lo, uint32x4_t* hi) {
+  const uint32x4_t bias = vdupq_n_u32(32767);
+  uint16x8_t coverage = vmulq_u16(source, alpha);
+  uint16x8_t inverse = vsubq_u16(vdupq_n_u16(65025), coverage);
+  *lo = blend_divide_neon(vmlal_u16(vmlal_u16(bias, vget_low_u16(color), vget_low_u16(coverage)), vget_low_u16(destination), vget_low_u16(inverse)));
+  *hi = blend_divide_neon(vmlal_u16(vmlal_u16(bias, vget_high_u16(color), vget_high_u16(coverage)), vget_high_u16(destination), vget_high_u16(inverse)));
+}
+
+static inline uint16x8_t blend_extract_neon(uint32x4_t lo, uint32x4_t hi, int shift) {
+  const uint32x4_t mask = vdupq_n_u32(0xFF);
+  return vcombine_u16(vmovn_u32(vandq_u32(vshlq_u32(lo, vdupq_n_s32(-shift)), mask)), vmovn_u32(vandq_u32(vshlq_u32(hi, vdupq_n_s32(-shift)), mask)));
+}
+
+static void blend_row_neon(uint32_t* destination, const uint8_t* source, int width, bool subpixel, RenColor color, uint32_t amask) {
+  const uint16x8_t alpha = vdupq_n_u16(color.a), color_r = vdupq_n_u16(color.r), color_g = vdupq_n_u16(color.g), color_b = vdupq_n_u16(color.b);
+  const uint32x4_t alpha_mask = vdupq_n_u32(amask);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    uint16x8_t source_r, source_g, source_b;
+    if (subpixel) {
+      uint8x8x3_t s = vld3_u8(&source[x * 3]);
+      source_r = vmovl_u8(s.val[0]);
+      source_g = vmovl_u8(s.val[1]);
+      source_b = vmovl_u8(s.val[2]);
+    } else
+      source_r = source_g = source_b = vmovl_u8(vld1_u8(&source[x]));
+    uint32x4_t lo = vld1q_u32(&destination[x]), hi = vld1q_u32(&destination[x + 4]);
+    uint32x4_t r_lo, r_hi, g_lo, g_hi, b_lo, b_hi;
+    blend_channel_neon(source_r, alpha, color_r, blend_extract_neon(lo, hi, 16), &r_lo, &r_hi);
+    blend_channel_neon(source_g, alpha, color_g, blend_extract_neon(lo, hi, 8), &g_lo, &g_hi);
+    blend_channel_neon(source_b, alpha, color_b, blend_extract_neon(lo, hi, 0), &b_lo, &b_hi);
+    vst1q_u32(&destination[x], vorrq_u32(vorrq_u32(vandq_u32(lo, alpha_mask), vshlq_n_u32(r_lo, 16)), vorrq_u32(vshlq_n_u32(g_lo, 8), b_lo)));
+    vst1q_u32(&destination[x + 4], vorrq_u32(vorrq_u32(vandq_u32(hi, alpha_mask), vshlq_n_u32(r_hi, 16)), vorrq_u32(vshlq_n_u32(g_hi, 8), b_hi)));
+  }
+  blend_row_scalar(&destination[x], &source[x * (subpixel ? 3 : 1)], width - x, subpixel, color, amask);
+}
+#endif
+
+static void blend_init(void) {
+  memset(blend_fill_coverage, 0xFF, sizeof(blend_fill_coverage));
+  blend_row = blend_row_scalar;
+#if defined(RENDERER_BLEND_X86)
+  if (SDL_HasAVX2())
+    blend_row = blend_row_avx2;
+  else if (SDL_HasSSE2())
+    blend_row = blend_row_sse2;
+#elif defined(RENDERER_BLEND_NEON)
+  blend_row = blend_row_neon;
+#endif
+}
+
+static bool blend_is_fast_format(SDL_PixelFormat* format) {
+  return format->BytesPerPixel == 4 && format->Rmask == 0xFF0000 && format->Gmask == 0xFF00 && format->Bmask == 0xFF && (format->Amask == 0 || format->Amask == 0xFF000000);
+}
+
+// if draw is false, only loads the glyphs that drawing the text would need, so that it can then be drawn concurrently.
+static double font_group_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t len, float x, int y, RenColor color, int tab_size, bool draw) {
   SDL_Surface *surface = rs->surface;
-  SDL_Rect clip;
-  SDL_GetClipRect(surface, &clip);
+  SDL_Rect clip = rs->clip;
 
   const int surface_scale = rs->scale;
   double pen_x = x * surface_scale;
@@ -399,6 +1496,7 @@ double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t l
   const char* end = text + len;
   uint8_t* destination_pixels = surface->pixels;
   int clip_end_x = clip.x + clip.w, clip_end_y = clip.y + clip.h;
+  bool fast_format = blend_is_fast_format(surface->format);
 
   RenFont* last = NULL;
   double last_pen_x = x;
@@ -408,19 +1506,24 @@ double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t l
   while (text < end) {
     unsigned int codepoint, r, g, b;
     text = utf8_to_codepoint(text, &codepoint);
-    GlyphSet* set = NULL; GlyphMetric* metric = NULL;
-    RenFont* font = font_group_get_glyph(&set, &metric, fonts, codepoint, (int)(fmod(pen_x, 1.0) * SUBPIXEL_BITMAPS_CACHED));
+    GlyphMetric* metric = NULL;
+    int subpixel_idx = (int)(fmod(pen_x, 1.0) * SUBPIXEL_BITMAPS_CACHED);
+    if (subpixel_idx < 0)
+      subpixel_idx += SUBPIXEL_BITMAPS_CACHED;
+    RenFont* font = font_group_get_glyph(&metric, fonts, codepoint);
     if (!metric)
       break;
-    int start_x = floor(pen_x) + metric->bitmap_left;
-    int end_x = (metric->x1 - metric->x0) + start_x;
-    int glyph_end = metric->x1, glyph_start = metric->x0;
-    if (!metric->loaded && codepoint > 0xFF)
+    GlyphBitmap* bitmap = NULL;
+    SDL_Surface* atlas = color.a > 0 ? font_get_glyph_bitmap(font, metric, subpixel_idx, &bitmap) : NULL;
+    int start_x = floor(pen_x) + (bitmap ? bitmap->bitmap_left : 0);
+    int end_x = bitmap ? (bitmap->x1 - bitmap->x0) + start_x : start_x;
+    int glyph_end = bitmap ? bitmap->x1 : 0, glyph_start = bitmap ? bitmap->x0 : 0;
+    if (!metric->loaded && codepoint > 0xFF && draw)
       ren_draw_rect(rs, (RenRect){ start_x + 1, y, font->space_advance - 1, ren_font_group_get_height(fonts) }, color);
-    if (set->surface && color.a > 0 && end_x >= clip.x && start_x < clip_end_x) {
-      uint8_t* source_pixels = set->surface->pixels;
-      for (int line = metric->y0; line < metric->y1; ++line) {
-        int target_y = line + y - metric->bitmap_top + font->baseline * surface_scale;
+    if (atlas && draw && end_x >= clip.x && start_x < clip_end_x) {
+      uint8_t* source_pixels = atlas->pixels;
+      for (int line = bitmap->y0; line < bitmap->y1; ++line) {
+        int target_y = line - bitmap->y0 + y - bitmap->bitmap_top + font->baseline * surface_scale;
         if (target_y < clip.y)
           continue;
         if (target_y >= clip_end_y)
@@ -433,7 +1536,11 @@ double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t l
           glyph_start += offset;
         }
         uint32_t* destination_pixel = (uint32_t*)&(destination_pixels[surface->pitch * target_y + start_x * bytes_per_pixel]);
-        uint8_t* source_pixel = &source_pixels[line * set->surface->pitch + glyph_start * (font->antialiasing == FONT_ANTIALIASING_SUBPIXEL ? 3 : 1)];
+        uint8_t* source_pixel = &source_pixels[line * atlas->pitch + glyph_start * font_get_byte_width(font)];
+        if (fast_format) {
+          blend_row(destination_pixel, source_pixel, glyph_end - glyph_start, font->antialiasing == FONT_ANTIALIASING_SUBPIXEL, color, surface->format->Amask);
+          continue;
+        }
         for (int x = glyph_start; x < glyph_end; ++x) {
           uint32_t destination_color = *destination_pixel;
           // the standard way of doing this would be SDL_GetRGBA, but that introduces a performance regression. needs to be investigated
@@ -461,8 +1568,12 @@ double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t l
       }
     }
 
-    float adv = metric->xadvance ? metric->xadvance : font->space_advance;
+    float adv = codepoint == '\t' ? font->space_advance * tab_size : (metric->xadvance ? metric->xadvance : font->space_advance);
 
+    if (!draw) {
+      pen_x += adv;
+      continue;
+    }
     if(!last) last = font;
     else if(font != last || text == end) {
       double local_pen_x = text == end ? pen_x + adv : pen_x;
@@ -479,6 +1590,24 @@ double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t l
   return pen_x / surface_scale;
 }
 
+double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t len, float x, int y, RenColor color, int tab_size) {
+  return font_group_draw_text(rs, fonts, text, len, x, y, color, tab_size, true);
+}
+
+void ren_prepare_text(RenSurface *rs, RenFont **fonts, const char *text, size_t len, float x, RenColor color, int tab_size) {
+  font_group_draw_text(rs, fonts, text, len, x, 0, color, tab_size, false);
+}
+
+void ren_begin_concurrent_draw(void) {
+  SDL_AtomicSet(&draw_incomplete, 0);
+  draw_concurrent = true;
+}
+
+bool ren_end_concurrent_draw(void) {
+  draw_concurrent = false;
+  return !SDL_AtomicGet(&draw_incomplete);
+}
+
 /******************* Rectangles **********************/
 static inline RenColor blend_pixel(RenColor dst, RenColor src) {
   int ia = 0xff - src.a;
@@ -488,6 +1617,18 @@ static inline RenColor blend_pixel(RenColor dst, RenColor src) {
   return dst;
 }
 
+// rect must already be clipped to the surface, which must be in a format blend_is_fast_format accepts.
+static void fill_rect_blended(SDL_Surface *surface, SDL_Rect rect, RenColor color) {
+  uint8_t *row = (uint8_t*)surface->pixels + rect.y * surface->pitch + rect.x * 4;
+  for (int y = 0; y < rect.h; ++y, row += surface->pitch) {
+    uint32_t *destination = (uint32_t*)row;
+    for (int x = 0; x < rect.w; x += BLEND_FILL_CHUNK) {
+      int width = rect.w - x < BLEND_FILL_CHUNK ? rect.w - x : BLEND_FILL_CHUNK;
+      blend_row(&destination[x], blend_fill_coverage, width, false, color, surface->format->Amask);
+    }
+  }
+}
+
 void ren_draw_rect(RenSurface *rs, RenRect rect, RenColor color) {
   if (color.a == 0) { return; }
 
@@ -499,19 +1640,45 @@ void ren_draw_rect(RenSurface *rs, RenRect rect, RenColor color) {
                          rect.width * surface_scale,
                          rect.height * surface_scale };
 
+  // the surface's own clip rect is shared by every thread drawing to it, so we "clip" manually.
+  if (!SDL_IntersectRect(&rs->clip, &dest_rect, &dest_rect)) return;
   if (color.a == 0xff) {
     uint32_t translated = SDL_MapRGB(surface->format, color.r, color.g, color.b);
     SDL_FillRect(surface, &dest_rect, translated);
+  } else if (blend_is_fast_format(surface->format)) {
+    fill_rect_blended(surface, dest_rect, color);
   } else {
-    // Seems like SDL doesn't handle clipping as we expect when using
-    // scaled blitting, so we "clip" manually.
-    SDL_Rect clip;
-    SDL_GetClipRect(surface, &clip);
-    if (!SDL_IntersectRect(&clip, &dest_rect, &dest_rect)) return;
-
+    if (draw_concurrent)
+      SDL_LockMutex(draw_rect_lock);
     uint32_t *pixel = (uint32_t *)draw_rect_surface->pixels;
     *pixel = SDL_MapRGBA(draw_rect_surface->format, color.r, color.g, color.b, color.a);
     SDL_BlitScaled(draw_rect_surface, NULL, surface, &dest_rect);
+    if (draw_concurrent)
+      SDL_UnlockMutex(draw_rect_lock);
+  }
+}
+
+
+/* moves the pixels inside rect by dy; the ones moved past its edges are dropped and the strip
+** they leave behind keeps its previous content */
+void ren_move_rect(RenSurface *rs, RenRect rect, int dy) {
+  SDL_Surface *surface = rs->surface;
+  const int surface_scale = rs->scale;
+  SDL_Rect full = { 0, 0, surface->w, surface->h };
+  SDL_Rect area = { rect.x * surface_scale, rect.y * surface_scale, rect.width * surface_scale, rect.height * surface_scale };
+  dy *= surface_scale;
+  if (!SDL_IntersectRect(&full, &area, &area) || abs(dy) >= area.h) return;
+
+  const int bpp = surface->format->BytesPerPixel;
+  const size_t row_size = area.w * bpp;
+  uint8_t *pixels = (uint8_t *)surface->pixels + area.x * bpp;
+  /* walk away from the destination, so no row is overwritten before it's copied */
+  if (dy > 0) {
+    for (int y = area.y + area.h - 1; y >= area.y + dy; y--)
+      memcpy(pixels + y * surface->pitch, pixels + (y - dy) * surface->pitch, row_size);
+  } else {
+    for (int y = area.y; y < area.y + area.h + dy; y++)
+      memcpy(pixels + y * surface->pitch, pixels + (y - dy) * surface->pitch, row_size);
   }
 }
 
@@ -519,6 +1686,7 @@ void ren_draw_rect(RenSurface *rs, RenRect rect, RenColor color) {
 void ren_free_window_resources(RenWindow *window_renderer) {
   extern uint8_t *command_buf;
   extern size_t command_buf_size;
+  glyph_worker_free();
   renwin_free(window_renderer);
   SDL_FreeSurface(draw_rect_surface);
   free(command_buf);
@@ -534,11 +1702,14 @@ void ren_init(SDL_Window *win) {
     fprintf(stderr, "internal font error when starting the application\n");
     return;
   }
+  blend_init();
+  glyph_worker_init();
   window_renderer.window = win;
   renwin_init_surface(&window_renderer);
   renwin_clip_to_surface(&window_renderer);
   draw_rect_surface = SDL_CreateRGBSurface(0, 1, 1, 32,
                        0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF);
+  draw_rect_lock = SDL_CreateMutex();
 }
 
 
@@ -562,6 +1733,14 @@ void ren_set_clip_rect(RenWindow *window_renderer, RenRect rect) {
 }
 
 
+void ren_surface_set_clip_rect(RenSurface *rs, RenRect rect) {
+  SDL_Rect full = { 0, 0, rs->surface->w, rs->surface->h };
+  SDL_Rect clip = { rect.x * rs->scale, rect.y * rs->scale, rect.width * rs->scale, rect.height * rs->scale };
+  if (!SDL_IntersectRect(&full, &clip, &rs->clip))
+    rs->clip = (SDL_Rect){ 0, 0, 0, 0 };
+}
+
+
 void ren_get_size(RenWindow *window_renderer, int *x, int *y) {
   RenSurface rs = renwin_get_surface(window_renderer);
   *x = rs.surface->w / rs.scale;
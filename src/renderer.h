@@ -19,7 +19,8 @@ typedef enum { FONT_ANTIALIASING_NONE, FONT_ANTIALIASING_GRAYSCALE, FONT_ANTIALI
 typedef enum { FONT_STYLE_BOLD = 1, FONT_STYLE_ITALIC = 2, FONT_STYLE_UNDERLINE = 4, FONT_STYLE_SMOOTH = 8, FONT_STYLE_STRIKETHROUGH = 16 } ERenFontStyle;
 typedef struct { uint8_t b, g, r, a; } RenColor;
 typedef struct { int x, y, width, height; } RenRect;
-typedef struct { SDL_Surface *surface; int scale; } RenSurface;
+typedef struct { SDL_Surface *surface; int scale; SDL_Rect clip; } RenSurface;
+typedef struct { size_t size, capacity, used; unsigned int glyphs, evictions; } RenAtlasStats;
 
 struct RenWindow;
 typedef struct RenWindow RenWindow;
@@ -28,21 +29,31 @@ extern RenWindow window_renderer;
 RenFont* ren_font_load(RenWindow *window_renderer, const char *filename, float size, ERenFontAntialiasing antialiasing, ERenFontHinting hinting, unsigned char style);
 RenFont* ren_font_copy(RenWindow *window_renderer, RenFont* font, float size, ERenFontAntialiasing antialiasing, ERenFontHinting hinting, int style);
 const char* ren_font_get_path(RenFont *font);
+void ren_font_get_options(RenFont *font, float *size, ERenFontAntialiasing *antialiasing, ERenFontHinting *hinting, unsigned char *style);
 void ren_font_free(RenFont *font);
+void ren_set_glyph_cache_dir(const char *path);
 int ren_font_group_get_tab_size(RenFont **font);
 int ren_font_group_get_height(RenFont **font);
 float ren_font_group_get_size(RenFont **font);
 void ren_font_group_set_size(RenWindow *window_renderer, RenFont **font, float size);
-void ren_font_group_set_tab_size(RenFont **font, int n);
+bool ren_font_group_set_tab_size(RenFont **font, int n);
+void ren_font_group_get_atlas_stats(RenFont **font, RenAtlasStats *stats);
+void ren_font_group_warm(RenFont **font, const char *text, size_t len);
 double ren_font_group_get_width(RenWindow *window_renderer, RenFont **font, const char *text, size_t len);
-double ren_draw_text(RenSurface *rs, RenFont **font, const char *text, size_t len, float x, int y, RenColor color);
+void ren_font_group_get_width_cache_stats(RenFont **font, unsigned int *hits, unsigned int *misses);
+double ren_draw_text(RenSurface *rs, RenFont **font, const char *text, size_t len, float x, int y, RenColor color, int tab_size);
+void ren_prepare_text(RenSurface *rs, RenFont **font, const char *text, size_t len, float x, RenColor color, int tab_size);
+void ren_begin_concurrent_draw(void);
+bool ren_end_concurrent_draw(void);
 
 void ren_draw_rect(RenSurface *rs, RenRect rect, RenColor color);
+void ren_move_rect(RenSurface *rs, RenRect rect, int dy);
 
 void ren_init(SDL_Window *win);
 void ren_resize_window(RenWindow *window_renderer);
 void ren_update_rects(RenWindow *window_renderer, RenRect *rects, int count);
 void ren_set_clip_rect(RenWindow *window_renderer, RenRect rect);
+void ren_surface_set_clip_rect(RenSurface *rs, RenRect rect);
 void ren_get_size(RenWindow *window_renderer, int *x, int *y); /* Reports the size in points. */
 void ren_free_window_resources(RenWindow *window_renderer);
 
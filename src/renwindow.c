@@ -65,14 +65,16 @@ void renwin_set_clip_rect(RenWindow *ren, RenRect rect) {
 
 RenSurface renwin_get_surface(RenWindow *ren) {
 #ifdef LITE_USE_SDL_RENDERER
-  return ren->rensurface;
+  RenSurface rs = ren->rensurface;
+  rs.clip = rs.surface->clip_rect;
+  return rs;
 #else
   SDL_Surface *surface = SDL_GetWindowSurface(ren->window);
   if (!surface) {
     fprintf(stderr, "Error getting window surface: %s", SDL_GetError());
     exit(1);
   }
-  return (RenSurface){.surface = surface, .scale = 1};
+  return (RenSurface){.surface = surface, .scale = 1, .clip = surface->clip_rect};
 #endif
 }
 